@@ -0,0 +1,89 @@
+#ifndef LIBASS_ASS_H
+#define LIBASS_ASS_H
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+typedef struct ass_library ASS_Library;
+typedef struct ass_renderer ASS_Renderer;
+typedef struct render_priv ASS_RenderPriv;
+typedef struct parser_priv ASS_ParserPriv;
+typedef struct ass_image {
+    int w, h; int stride; unsigned char *bitmap; uint32_t color; int dst_x, dst_y;
+    struct ass_image *next;
+    enum { IMAGE_TYPE_CHARACTER, IMAGE_TYPE_OUTLINE, IMAGE_TYPE_SHADOW } type;
+} ASS_Image;
+typedef struct ass_style {
+    char *Name; char *FontName; double FontSize;
+    uint32_t PrimaryColour, SecondaryColour, OutlineColour, BackColour;
+    int Bold, Italic, Underline, StrikeOut;
+    double ScaleX, ScaleY, Spacing, Angle;
+    int BorderStyle; double Outline, Shadow;
+    int Alignment, MarginL, MarginR, MarginV, Encoding, treat_fontname_as_pattern;
+    double Blur; int Justify;
+} ASS_Style;
+typedef struct ass_event {
+    long long Start, Duration; int ReadOrder, Layer, Style; char *Name;
+    int MarginL, MarginR, MarginV; char *Effect; char *Text; ASS_RenderPriv *render_priv;
+} ASS_Event;
+typedef struct ass_track {
+    int n_styles, max_styles, n_events, max_events;
+    ASS_Style *styles; ASS_Event *events; char *style_format, *event_format;
+    enum { TRACK_TYPE_UNKNOWN = 0, TRACK_TYPE_ASS, TRACK_TYPE_SSA } track_type;
+    int PlayResX, PlayResY; double Timer; int WrapStyle, ScaledBorderAndShadow, Kerning;
+    char *Language; int YCbCrMatrix; int default_style; char *name;
+    ASS_Library *library; ASS_ParserPriv *parser_priv; int LayoutResX, LayoutResY;
+} ASS_Track;
+typedef enum { ASS_HINTING_NONE = 0, ASS_HINTING_LIGHT, ASS_HINTING_NORMAL, ASS_HINTING_NATIVE } ASS_Hinting;
+typedef enum { ASS_SHAPING_SIMPLE = 0, ASS_SHAPING_COMPLEX } ASS_ShapingLevel;
+typedef enum { ASS_FONTPROVIDER_NONE = 0, ASS_FONTPROVIDER_AUTODETECT = 1, ASS_FONTPROVIDER_CORETEXT, ASS_FONTPROVIDER_FONTCONFIG, ASS_FONTPROVIDER_DIRECTWRITE } ASS_DefaultFontProvider;
+int ass_library_version(void);
+ASS_Library *ass_library_init(void);
+void ass_library_done(ASS_Library *priv);
+void ass_set_fonts_dir(ASS_Library *priv, const char *fonts_dir);
+void ass_set_extract_fonts(ASS_Library *priv, int extract);
+void ass_set_style_overrides(ASS_Library *priv, char **list);
+void ass_process_force_style(ASS_Track *track);
+void ass_set_message_cb(ASS_Library *priv, void (*msg_cb)(int level, const char *fmt, va_list args, void *data), void *data);
+ASS_Renderer *ass_renderer_init(ASS_Library *);
+void ass_renderer_done(ASS_Renderer *priv);
+void ass_set_frame_size(ASS_Renderer *priv, int w, int h);
+void ass_set_storage_size(ASS_Renderer *priv, int w, int h);
+void ass_set_shaper(ASS_Renderer *priv, ASS_ShapingLevel level);
+void ass_set_margins(ASS_Renderer *priv, int t, int b, int l, int r);
+void ass_set_use_margins(ASS_Renderer *priv, int use);
+void ass_set_pixel_aspect(ASS_Renderer *priv, double par);
+void ass_set_aspect_ratio(ASS_Renderer *priv, double dar, double sar);
+void ass_set_font_scale(ASS_Renderer *priv, double font_scale);
+void ass_set_hinting(ASS_Renderer *priv, ASS_Hinting ht);
+void ass_set_line_spacing(ASS_Renderer *priv, double line_spacing);
+void ass_set_line_position(ASS_Renderer *priv, double line_position);
+void ass_set_fonts(ASS_Renderer *priv, const char *default_font, const char *default_family, int dfp, const char *config, int update);
+void ass_set_selective_style_override_enabled(ASS_Renderer *priv, int bits);
+void ass_set_selective_style_override(ASS_Renderer *priv, ASS_Style *style);
+int ass_fonts_update(ASS_Renderer *priv);
+void ass_set_cache_limits(ASS_Renderer *priv, int glyph_max, int bitmap_max_size);
+ASS_Image *ass_render_frame(ASS_Renderer *priv, ASS_Track *track, long long now, int *detect_change);
+ASS_Track *ass_new_track(ASS_Library *);
+void ass_free_track(ASS_Track *track);
+int ass_alloc_style(ASS_Track *track);
+int ass_alloc_event(ASS_Track *track);
+void ass_free_style(ASS_Track *track, int sid);
+void ass_free_event(ASS_Track *track, int eid);
+void ass_process_data(ASS_Track *track, char *data, int size);
+void ass_process_codec_private(ASS_Track *track, char *data, int size);
+void ass_process_chunk(ASS_Track *track, char *data, int size, long long timecode, long long duration);
+void ass_set_check_readorder(ASS_Track *track, int check_readorder);
+void ass_flush_events(ASS_Track *track);
+ASS_Track *ass_read_file(ASS_Library *library, char *fname, char *codepage);
+ASS_Track *ass_read_memory(ASS_Library *library, char *buf, size_t bufsize, char *codepage);
+int ass_read_styles(ASS_Track *track, char *fname, char *codepage);
+void ass_add_font(ASS_Library *library, char *name, char *data, int data_size);
+void ass_clear_fonts(ASS_Library *library);
+long long ass_step_sub(ASS_Track *track, long long now, int movement);
+#ifdef __cplusplus
+}
+#endif
+#endif
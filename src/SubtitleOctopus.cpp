@@ -6,29 +6,104 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
+#include <strings.h>
+#ifdef OCTP_NATIVE
+#include <ass/ass.h>
+#else
 #include "../lib/libass/libass/ass.h"
+#endif
 
 #include "libass.cpp"
+#include "blend.h"
+#include "event_index.h"
+#include "track_snapshot.h"
+#include "track_batch.h"
+#include "render_stats.h"
+#include "bitmap_atlas.h"
+#include "span_codec.h"
+#include "override_tags.h"
+#ifdef OCTP_THREADS
+#include "thread_pool.h"
+#endif
 
 #ifdef __EMSCRIPTEN__
 #include <emscripten.h>
+#ifdef OCTP_THREADS
+#include <emscripten/threading.h>
+#endif
 #else
-// make IDE happy
-#define emscripten_get_now() 0.0
+#include <time.h>
+#ifdef OCTP_THREADS
+#include <unistd.h>
+#endif
+static double emscripten_get_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+#endif
+
+#ifndef OCTP_ASSETS_DIR
+#define OCTP_ASSETS_DIR "/assets"
+#endif
+
+// upper limit of extra threads blending regions with OCTP_THREADS
+#ifndef OCTP_BLEND_THREADS
+#define OCTP_BLEND_THREADS 3
 #endif
 
 int log_level = 3;
 
+/**
+ * Memory shared by several buffers with an optional upper limit. Buffers
+ * may grow from different threads at once, hence the atomics.
+ */
+class BufferBudget {
+public:
+    BufferBudget(): used(0), peak(0), limit(0) {}
+
+    /**
+     * \brief Account for a buffer changing its size
+     * \return false if growing it would exceed the limit, nothing is accounted then
+     */
+    bool resize(size_t old_size, size_t new_size) {
+        size_t current = __atomic_load_n(&used, __ATOMIC_RELAXED), next;
+        do {
+            next = current - old_size + new_size;
+            if (new_size > old_size && limit != 0 && next > limit) return false;
+        } while (!__atomic_compare_exchange_n(&used, &current, next, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+        size_t highest = __atomic_load_n(&peak, __ATOMIC_RELAXED);
+        while (next > highest &&
+               !__atomic_compare_exchange_n(&peak, &highest, next, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+        return true;
+    }
+
+    size_t used;
+    size_t peak;
+    size_t limit; // 0 - no limit
+};
+
 class ReusableBuffer {
 public:
-    ReusableBuffer(): buffer(NULL), size(0), lessen_counter(0) {}
+    ReusableBuffer(): buffer(NULL), size(0), lessen_counter(0), reallocs(0), budget(NULL) {}
 
     ~ReusableBuffer() {
+        // the budget may be gone already, it goes with the buffers anyway
         free(buffer);
     }
 
+    /**
+     * \brief Account the memory of the buffer to a budget shared with other buffers
+     */
+    void setBudget(BufferBudget *shared) {
+        if (budget) budget->resize(size, 0);
+        budget = shared;
+        if (budget) budget->resize(0, size);
+    }
+
     void clear() {
         free(buffer);
+        if (budget) budget->resize(size, 0);
         buffer = NULL;
         size = 0;
         lessen_counter = 0;
@@ -48,18 +123,31 @@ public:
             }
         }
 
+        if (budget && !budget->resize(size, new_size)) {
+            // over budget, the old contents are of no use to the caller either
+            if (!keep_content) clear();
+            return NULL;
+        }
+
         void *newbuf;
         if (keep_content) {
             newbuf = realloc(buffer, new_size);
         } else {
+            // let go of the old one first, so both never take memory at once
+            free(buffer);
+            buffer = NULL;
             newbuf = malloc(new_size);
         }
-        if (!newbuf) return NULL;
+        if (!newbuf) {
+            if (budget) budget->resize(new_size, buffer ? size : 0);
+            if (!buffer) size = 0;
+            return NULL;
+        }
 
-        if (!keep_content) free(buffer);
         buffer = newbuf;
         size = new_size;
         lessen_counter = 0;
+        reallocs++;
         return buffer;
     }
 
@@ -67,10 +155,80 @@ public:
         return size;
     }
 
+    /**
+     * \brief How many times the buffer was (re)allocated so far
+     */
+    size_t reallocations() const {
+        return reallocs;
+    }
+
 private:
     void *buffer;
     size_t size;
     size_t lessen_counter;
+    size_t reallocs;
+    BufferBudget *budget;
+};
+
+/**
+ * \brief Font names separated by newlines, each listed once whatever its case
+ */
+class FontNames {
+public:
+    FontNames(): m_size(0) {}
+
+    void clear() {
+        m_size = 0;
+    }
+
+    /**
+     * \brief Add a name unless it is listed already; surrounding blanks are dropped
+     */
+    void add(const char *name, size_t len) {
+        while (len > 0 && (*name == ' ' || *name == '\t')) name++, len--;
+        while (len > 0 && (name[len - 1] == ' ' || name[len - 1] == '\t')) len--;
+
+        char *names = (char*)m_names.take(m_size + len + 2, true);
+        if (!names) return;
+        names[m_size] = '\0';
+        if (len == 0) return;
+
+        for (const char *cur = names; cur < names + m_size; ) {
+            const char *next = (const char*)memchr(cur, '\n', names + m_size - cur);
+            size_t cur_len = next ? next - cur : names + m_size - cur;
+            if (cur_len == len && strncasecmp(cur, name, len) == 0) return;
+            cur += cur_len + 1;
+        }
+
+        if (m_size > 0) names[m_size++] = '\n';
+        memcpy(names + m_size, name, len);
+        m_size += len;
+        names[m_size] = '\0';
+    }
+
+    void addAll(FontNames &other) {
+        const char *names = other.get();
+        while (*names) {
+            const char *next = strchr(names, '\n');
+            size_t len = next ? (size_t)(next - names) : strlen(names);
+            add(names, len);
+            names += next ? len + 1 : len;
+        }
+    }
+
+    /**
+     * \return the names, valid until the list changes
+     */
+    const char* get() {
+        char *names = (char*)m_names.take(m_size + 1, true);
+        if (!names) return "";
+        names[m_size] = '\0';
+        return names;
+    }
+
+private:
+    ReusableBuffer m_names;
+    size_t m_size;
 };
 
 void msg_callback(int level, const char *fmt, va_list va, void *data) {
@@ -85,14 +243,10 @@ void msg_callback(int level, const char *fmt, va_list va, void *data) {
     fprintf(stream, "\n");
 }
 
-const float MIN_UINT8_CAST = 0.9 / 255;
-const float MAX_UINT8_CAST = 255.9 / 255;
-
-#define CLAMP_UINT8(value) ((value > MIN_UINT8_CAST) ? ((value < MAX_UINT8_CAST) ? (int)(value * 255) : 255) : 0)
-
 struct RenderBlendPart {
     int dest_x, dest_y, dest_width, dest_height;
     unsigned char *image;
+    int unchanged; // same region and contents as in the previous frame, image was not rebuilt
     RenderBlendPart *next;
 };
 
@@ -102,12 +256,47 @@ struct RenderBlendResult {
     RenderBlendPart *part;
 };
 
-// maximum regions - a grid of 3x3
-#define MAX_BLEND_STORAGES (3 * 3)
+// maximum regions of a frame, see RegionPartitioner
+#define MAX_BLEND_STORAGES 32
+// fixed cost of a region (blend setup, transfer, drawing) in pixels; regions are
+// merged as long as that adds fewer transparent pixels to blend than this
+#define BLEND_PART_OVERHEAD (64 * 64)
 struct RenderBlendStorage {
     RenderBlendPart part;
     ReusableBuffer buf;
     bool taken;
+    bool reusable; // holds a part of the previous frame
+    uint64_t hash; // of the images blended into the part
+
+    RenderBlendStorage(): taken(false), reusable(false), hash(0) {}
+};
+
+// frame slots for handing blended frames to the main thread through shared memory
+#define MAX_FRAME_SLOTS 4
+#define FRAME_SLOT_FREE 0
+#define FRAME_SLOT_READY 1
+
+/*
+ * Frame ring layout as read by the main thread from the wasm heap, hence
+ * 32-bit fields only. The worker publishes a slot by storing its state with
+ * release semantics, the main thread hands it back by storing FRAME_SLOT_FREE.
+ */
+struct FrameSlotPart {
+    int32_t x, y, w, h;
+    uint32_t image; // offset of RGBA pixels in the heap
+};
+
+struct FrameSlot {
+    int32_t state;
+    int32_t seq;
+    int32_t count;
+    FrameSlotPart parts[MAX_BLEND_STORAGES];
+};
+
+struct FrameRing {
+    int32_t published; // seq of the most recently published slot
+    int32_t slots;
+    FrameSlot slot[MAX_FRAME_SLOTS];
 };
 
 struct EventStopTimesResult {
@@ -128,6 +317,19 @@ public:
         return min_x == -1;
     }
 
+    bool equals(const BoundingBox& other) const {
+        return min_x == other.min_x && max_x == other.max_x &&
+               min_y == other.min_y && max_y == other.max_y;
+    }
+
+    /**
+     * \brief Check whether an image lies fully within the box, same as renderBlendPart does
+     */
+    bool contains(const ASS_Image *img) const {
+        return img->dst_x >= min_x && img->dst_y >= min_y &&
+               img->dst_x + img->w - 1 <= max_x && img->dst_y + img->h - 1 <= max_y;
+    }
+
     void add(int x1, int y1, int w, int h) {
         int x2 = x1 + w - 1, y2 = y1 + h - 1;
         min_x = (min_x < 0) ? x1 : MIN(min_x, x1);
@@ -146,16 +348,143 @@ public:
     bool tryMerge(BoundingBox& other) {
         if (!intersets(other)) return false;
 
+        merge(other);
+        return true;
+    }
+
+    void merge(const BoundingBox& other) {
         min_x = MIN(min_x, other.min_x);
         min_y = MIN(min_y, other.min_y);
         max_x = MAX(max_x, other.max_x);
         max_y = MAX(max_y, other.max_y);
-        return true;
     }
 
     void clear() {
         min_x = max_x = min_y = max_y = -1;
     }
+
+    int64_t area() const {
+        return (int64_t)(max_x - min_x + 1) * (max_y - min_y + 1);
+    }
+
+    /**
+     * \brief Pixels a box covering both would add to the area of the two
+     */
+    int64_t mergeWaste(const BoundingBox& other) const {
+        BoundingBox both = *this;
+        both.merge(other);
+        return both.area() - area() - other.area();
+    }
+};
+
+/**
+ * Groups the images of a frame into disjoint regions which are blended
+ * separately: images whose boxes intersect always share a region, other
+ * regions are merged greedily while that wastes fewer transparent pixels
+ * than the overhead of a region, and by least waste while there are too many.
+ */
+class RegionPartitioner {
+public:
+    /**
+     * \return number of regions written to `boxes`, at most `max_boxes`
+     */
+    int partition(ASS_Image *img, BoundingBox *boxes, int max_boxes) {
+        int images = 0;
+        for (ASS_Image *cur = img; cur != NULL; cur = cur->next) images++;
+        BoundingBox *clusters = (BoundingBox*)m_clusters.take(sizeof(BoundingBox) * (images ? images : 1), false);
+        if (clusters == NULL) {
+            // blend everything at once then
+            for (ASS_Image *cur = img; cur != NULL; cur = cur->next) {
+                if (cur->w != 0 && cur->h != 0) boxes[0].add(cur->dst_x, cur->dst_y, cur->w, cur->h);
+            }
+            return boxes[0].empty() ? 0 : 1;
+        }
+
+        int count = 0;
+        for (ASS_Image *cur = img; cur != NULL; cur = cur->next) {
+            if (cur->w == 0 || cur->h == 0) continue; // skip empty images
+            BoundingBox box;
+            box.add(cur->dst_x, cur->dst_y, cur->w, cur->h);
+            count = addCluster(clusters, count, box);
+        }
+
+        // cheap merges first, in a single sweep over all pairs per round
+        for (bool merged = true; merged;) {
+            merged = false;
+            for (int box1 = 0; box1 < count - 1; box1++) {
+                for (int box2 = box1 + 1; box2 < count; box2++) {
+                    if (clusters[box1].mergeWaste(clusters[box2]) > BLEND_PART_OVERHEAD) continue;
+                    clusters[box1].merge(clusters[box2]);
+                    clusters[box2] = clusters[--count];
+                    box2 = box1; // the grown box needs to be compared to all again
+                    merged = true;
+                }
+            }
+            if (merged) count = absorbAll(clusters, count);
+        }
+
+        // then the least wasteful ones until the regions fit
+        while (count > max_boxes) {
+            int best1 = 0, best2 = 1;
+            int64_t best = -1;
+            for (int box1 = 0; box1 < count - 1; box1++) {
+                for (int box2 = box1 + 1; box2 < count; box2++) {
+                    int64_t waste = clusters[box1].mergeWaste(clusters[box2]);
+                    if (best < 0 || waste < best) {
+                        best = waste;
+                        best1 = box1;
+                        best2 = box2;
+                    }
+                }
+            }
+            clusters[best1].merge(clusters[best2]);
+            clusters[best2] = clusters[--count];
+            count = absorbAll(clusters, count);
+        }
+
+        for (int i = 0; i < count; i++) boxes[i] = clusters[i];
+        return count;
+    }
+
+private:
+    /**
+     * \brief Add a box to disjoint clusters, taking in all clusters it
+     * intersects as it grows
+     * \return new number of clusters
+     */
+    static int addCluster(BoundingBox *clusters, int count, BoundingBox box) {
+        for (int i = 0; i < count;) {
+            if (!box.tryMerge(clusters[i])) {
+                i++;
+                continue;
+            }
+            clusters[i] = clusters[--count];
+            i = 0; // the grown box may reach clusters checked already
+        }
+        clusters[count] = box;
+        return count + 1;
+    }
+
+    /**
+     * \brief Make clusters disjoint again after some of them grew
+     * \return new number of clusters
+     */
+    static int absorbAll(BoundingBox *clusters, int count) {
+        for (bool merged = true; merged;) {
+            merged = false;
+            for (int i = 0; i < count - 1; i++) {
+                for (int j = i + 1; j < count; j++) {
+                    if (!clusters[i].tryMerge(clusters[j])) continue;
+                    clusters[j] = clusters[--count];
+                    j = i; // compare the grown box to all again
+                    merged = true;
+                }
+            }
+        }
+        return count;
+    }
+
+    ReusableBuffer m_clusters;
 };
 
 /**
@@ -213,74 +542,198 @@ static bool _is_animated_tag(char *begin, char *end) {
 }
 
 /**
- * \param start First character after { (optionally spaces can be dropped)
- * \param end   Last character before } (optionally spaces can be dropped)
+ * \brief Add the font of a \\fn tag to `fonts`
+ * \return false if it is another tag
+ */
+static bool _add_font_tag(const OverrideTag& tag, FontNames *fonts) {
+    if (tag.end <= tag.name || tag.name[0] != 'f' || tag.name[1] != 'n') return false;
+    fonts->add(tag.name + 2, tag.end - tag.name - 1);
+    return true;
+}
+
+/**
+ * \param event ASS event to be processed
  * \param drop_animations If true animation tags will be discarded
+ * \param fonts if not NULL, gets the fonts of \\fn overrides in the same pass
  * \return true if after processing the event may contain animations
            (i.e. when dropping animations this is always false)
  */
-static bool _is_block_animated(char *start, char *end, bool drop_animations)
-{
-    char *tag_start = NULL; // points to beginning backslash
-    for (char *p = start; p <= end; p++) {
-        if (*p == '\\') {
-            // It is safe to go one before and beyond unconditionally
-            // because the text passed in must be surronded by { }
-            if (tag_start && _is_animated_tag(tag_start + 1, p - 1)) {
-                if (!drop_animations)
-                    return true;
-                // For \t transforms this will assume the final state
-                _remove_tag(tag_start, p - 1);
+static bool _is_event_animated(ASS_Event *event, bool drop_animations, FontNames *fonts = NULL) {
+    bool animated = false;
+    // Event is animated if it has an Effect or animated override tags
+    if (event->Effect && event->Effect[0] != '\0') {
+        if (!drop_animations && !fonts) return true;
+        if (drop_animations) event->Effect[0] = '\0';
+        else animated = true;
+    }
+    if (!event->Text) return animated; // allocated, not filled in yet
+
+    // Only closed {...}-blocks are parsed by VSFilters and libass
+    OverrideTagScanner scanner(event->Text);
+    OverrideTag tag;
+    while (scanner.next(&tag)) {
+        if (_is_animated_tag(tag.name, tag.end)) {
+            if (!drop_animations) {
+                if (!fonts) return true;
+                animated = true;
+                continue;
             }
-            tag_start = p;
+            // For \t transforms this will assume the final state
+            _remove_tag(tag.name - 1, tag.end);
+        } else if (fonts) {
+            _add_font_tag(tag, fonts);
         }
     }
 
-    if (tag_start && _is_animated_tag(tag_start + 1, end)) {
-        if (!drop_animations)
-            return true;
-        _remove_tag(tag_start, end);
+    return animated;
+}
+
+/**
+ * \brief Collects when the animations of one event run, to tell whether
+ * its output changes at a given time and when it will change next
+ * All times are in ms relative to the start of the event.
+ */
+struct AnimationTimes {
+    long long now, duration;
+    bool active;    // some animation runs at `now`
+    long long next; // earliest start of an animation after `now`, -1 if none
+
+    AnimationTimes(long long now, long long duration): now(now), duration(duration), active(false), next(-1) {}
+
+    /**
+     * \brief Output changes during [from, to); a change at an instant is [t, t + 1)
+     */
+    void add(long long from, long long to) {
+        if (from < 0) from = 0;
+        if (to > duration) to = duration;
+        if (to <= from) {
+            if (from >= duration) return;
+            to = from + 1;
+        }
+        if (from <= now && now < to) {
+            active = true;
+        } else if (from > now && (next == -1 || from < next)) {
+            next = from;
+        }
     }
+};
 
-    return false;
+/**
+ * \brief Read the leading numeric arguments of a complex tag like `(1,2,\\tag)`
+ * \param p first character after the tag name
+ * \param end last character of the tag
+ * \return number of arguments read, up to `max`; stops at the first non-numeric one
+ */
+static int _tag_arguments(const char *p, const char *end, double *args, int max) {
+    while (p <= end && (*p == ' ' || *p == '\t')) p++;
+    if (p > end || *p != '(') return 0;
+    p++;
+    int count = 0;
+    while (count < max && p <= end) {
+        char *stop;
+        double value = strtod(p, &stop);
+        if (stop == p || stop > end + 1) break;
+        args[count++] = value;
+        p = stop;
+        while (p <= end && (*p == ' ' || *p == '\t')) p++;
+        if (p > end || *p != ',') break;
+        p++;
+    }
+    return count;
 }
 
 /**
- * \param event ASS event to be processed
- * \param drop_animations If true animation tags will be discarded
- * \return true if after processing the event may contain animations
-           (i.e. when dropping animations this is always false)
+ * \brief Add when an animated tag changes the output, following how libass interprets it
+ * \param begin first character of the tag name (after backslash)
+ * \param end last character of the tag
+ * \param karaoke start of the next karaoke syllable, advanced by \k tags
  */
-static bool _is_event_animated(ASS_Event *event, bool drop_animations) {
-    // Event is animated if it has an Effect or animated override tags
-    if (event->Effect && event->Effect[0] != '\0') {
-        if (!drop_animations) return 1;
-        event->Effect[0] = '\0';
+static void _add_tag_animation(const char *begin, const char *end, long long *karaoke, AnimationTimes& times) {
+    double args[7];
+    long long duration = times.duration;
+    switch (begin[0]) {
+        case 'k':
+        case 'K': {
+            // \k and \ko switch at the start of the syllable, \kf and \K sweep over it
+            bool sweep = begin[0] == 'K' || (begin + 1 <= end && begin[1] == 'f');
+            const char *p = begin + 1;
+            if (begin[0] == 'k' && p <= end && (*p == 'f' || *p == 'o' || *p == 't')) p++;
+            double value = strtod(p, NULL);
+            if (begin[0] == 'k' && begin + 1 <= end && begin[1] == 't') {
+                *karaoke = (long long)(value * 10);
+                return;
+            }
+            long long from = *karaoke, to = from + (long long)(value * 10);
+            *karaoke = to;
+            if (sweep) times.add(from, to);
+            else times.add(from, from);
+            return;
+        }
+        case 't': {
+            // \t([t1, t2, ][accel, ]tags); without times it spans the whole event
+            int count = _tag_arguments(begin + 1, end, args, 3);
+            long long t1 = 0, t2 = 0;
+            if (count >= 2) {
+                t1 = (long long)args[0];
+                t2 = (long long)args[1];
+            }
+            if (t2 == 0) t2 = duration;
+            times.add(t1, t2);
+            return;
+        }
+        case 'm': {
+            // \move(x1, y1, x2, y2[, t1, t2])
+            int count = _tag_arguments(begin + 4, end, args, 6);
+            long long t1 = 0, t2 = 0;
+            if (count == 6) {
+                t1 = (long long)MIN(args[4], args[5]);
+                t2 = (long long)MAX(args[4], args[5]);
+            }
+            if (t1 <= 0 && t2 <= 0) {
+                t1 = 0;
+                t2 = duration;
+            }
+            times.add(t1, t2);
+            return;
+        }
+        case 'f':
+            if (end - begin >= 3 && begin[3] == 'e') {
+                // \fade(a1, a2, a3, t1, t2, t3, t4)
+                if (_tag_arguments(begin + 4, end, args, 7) != 7) break;
+                times.add((long long)args[3], (long long)args[4]);
+                times.add((long long)args[5], (long long)args[6]);
+            } else {
+                // \fad(t1, t2)
+                if (_tag_arguments(begin + 3, end, args, 2) != 2) break;
+                times.add(0, (long long)args[0]);
+                times.add(duration - (long long)args[1], duration);
+            }
+            return;
     }
+    // arguments libass would not take as they are, assume the worst
+    times.add(0, duration);
+}
 
-    // Search for override blocks
-    // Only closed {...}-blocks are parsed by VSFilters and libass
-    char *block_start = NULL; // points to opening {
-    for (char *p = event->Text; *p != '\0'; p++) {
-        switch (*p) {
-            case '{':
-                // Escaping the opening curly bracket to not start an override block is
-                // a VSFilter-incompatible libass extension. But we only use libass, so...
-                if (!block_start && (p == event->Text || *(p-1) != '\\'))
-                    block_start = p;
-                break;
-            case '}':
-                if (block_start && p - block_start > 2
-                        && _is_block_animated(block_start + 1, p - 1, drop_animations))
-                    return true;
-                block_start = NULL;
-                break;
-            default:
-                break;
+/**
+ * \brief Collect when the animations of an event run
+ * Mirrors _is_event_animated, which decides whether there are any at all.
+ */
+static void _event_animation_times(const ASS_Event *event, AnimationTimes& times) {
+    if (event->Effect && event->Effect[0] != '\0') {
+        // banners and scrolling move for as long as the event lasts
+        times.add(0, times.duration);
+        return;
+    }
+    if (!event->Text) return;
+
+    long long karaoke = 0;
+    OverrideTagScanner scanner(event->Text);
+    OverrideTag tag;
+    while (scanner.next(&tag)) {
+        if (_is_animated_tag(tag.name, tag.end)) {
+            _add_tag_animation(tag.name, tag.end, &karaoke, times);
         }
     }
-
-    return false;
 }
 
 class SubtitleOctopus {
@@ -294,7 +747,18 @@ public:
 
     int status;
 
-    SubtitleOctopus(): ass_library(NULL), ass_renderer(NULL), track(NULL), canvas_w(0), canvas_h(0), status(0), m_is_event_animated(NULL), m_drop_animations(false) {
+    SubtitleOctopus(): ass_library(NULL), ass_renderer(NULL), track(NULL), canvas_w(0), canvas_h(0), status(0), m_blendParts(m_blendSlots[0]), m_is_event_animated(NULL), m_drop_animations(false), m_incremental_blend(false), m_premultiplied(false), m_ring_seq(0), m_ring_next(0), m_event_fonts_valid(false), m_stream_tail_size(0), m_streaming(false), m_dropped(NULL), m_dropped_size(0), m_live_window(0), m_live_next_evict(LLONG_MIN), m_warmed(false), m_shown_empty(true), m_owns_library(true) {
+        memset(&m_ring, 0, sizeof(m_ring));
+        memset(&m_stats, 0, sizeof(m_stats));
+        m_stats_reallocs = 0;
+        // blending buffers share one budget, see setBlendMemoryLimit
+        m_blend.setBudget(&m_blend_budget);
+#ifdef OCTP_THREADS
+        for (int i = 0; i < MAX_POOL_THREADS; i++) m_thread_blend[i].setBudget(&m_blend_budget);
+#endif
+        for (int slot = 0; slot < MAX_FRAME_SLOTS; slot++) {
+            for (int i = 0; i < MAX_BLEND_STORAGES; i++) m_blendSlots[slot][i].buf.setBudget(&m_blend_budget);
+        }
     }
 
     void setLogLevel(int level) {
@@ -304,6 +768,8 @@ public:
     void setDropAnimations(int value) {
         bool rescan = m_drop_animations != bool(value) && track != NULL;
         m_drop_animations = bool(value);
+        // animations dropped by dropAnimationsInRange are now gone for good
+        if (m_drop_animations) discardDroppedAnimations();
         if (rescan) rescanAllAnimations();
     }
 
@@ -311,26 +777,103 @@ public:
         return m_drop_animations;
     }
 
+    /**
+     * \brief Keep only events which finished less than `seconds` before the time rendered
+     * Meant for live tracks which only ever grow: older events are evicted by
+     * every render call, so memory and per-frame cost stay flat however long the
+     * stream runs. Seeking back further than the window shows nothing.
+     * \param seconds 0 keeps all events
+     */
+    void setLiveWindow(double seconds) {
+        m_live_window = seconds > 0 ? (long long)(seconds * 1000) : 0;
+        m_live_next_evict = LLONG_MIN;
+    }
+
+    double getLiveWindow() const {
+        return m_live_window / 1000.0;
+    }
+
+    /**
+     * \brief Remove all events which finished at or before `tm`
+     * \return number of events removed
+     */
+    int evictEventsBefore(double tm) {
+        if (!track) return 0;
+        return evictEvents((long long)(tm * 1000));
+    }
+
+    /**
+     * \brief Let renderBlend reuse parts whose images did not change since the previous frame
+     * Reused parts are flagged as unchanged and their image is left as it was,
+     * so the caller has to keep what it got for them last time.
+     */
+    void setIncrementalBlend(int value) {
+        m_incremental_blend = bool(value);
+        forgetBlendParts();
+    }
+
+    int getIncrementalBlend() const {
+        return m_incremental_blend;
+    }
+
+    /**
+     * \brief Make renderBlend produce premultiplied RGBA, as WebGL textures take it,
+     * instead of straight RGBA for canvas ImageData
+     */
+    void setPremultipliedAlpha(int value) {
+        m_premultiplied = bool(value);
+        forgetBlendParts();
+    }
+
+    int getPremultipliedAlpha() const {
+        return m_premultiplied;
+    }
+
+    /**
+     * \brief Make renderBlend publish frames into a ring of slots instead of a single result
+     * Parts of a published slot stay untouched until the reader frees the slot,
+     * so with a shared heap they can be read in place. Frames are skipped
+     * while no slot is free. Incremental blending is not used with the ring.
+     * \param slots number of slots, 0 to disable
+     */
+    void setFrameRing(int slots) {
+        if (slots > MAX_FRAME_SLOTS) slots = MAX_FRAME_SLOTS;
+        if (slots < 0) slots = 0;
+        memset(&m_ring, 0, sizeof(m_ring));
+        m_ring.slots = slots;
+        m_ring_seq = 0;
+        m_ring_next = 0;
+        m_blendParts = m_blendSlots[0];
+        forgetBlendParts();
+    }
+
+    FrameRing* getFrameRing() {
+        return &m_ring;
+    }
+
     void initLibrary(int frame_w, int frame_h) {
         ass_library = ass_library_init();
         if (!ass_library) {
             fprintf(stderr, "jso: ass_library_init failed!\n");
             exit(2);
         }
+        m_owns_library = true;
 
         ass_set_message_cb(ass_library, msg_callback, NULL);
 
-        ass_renderer = ass_renderer_init(ass_library);
-        if (!ass_renderer) {
-            fprintf(stderr, "jso: ass_renderer_init failed!\n");
-            exit(3);
-        }
-
-        resizeCanvas(frame_w, frame_h);
+        initRenderer(frame_w, frame_h);
+    }
 
-        reloadFonts();
-        m_blend.clear();
-        m_is_event_animated = NULL;
+    /**
+     * \brief Set up a renderer of its own on the library of `owner`
+     * Memory fonts added through either instance are seen by both once their
+     * fonts are reloaded; glyph and bitmap caches stay per renderer.
+     * The owner has to outlive this instance, quitLibrary leaves the library to it.
+     */
+    void initLibraryShared(SubtitleOctopus *owner, int frame_w, int frame_h) {
+        ass_library = owner->ass_library;
+        m_owns_library = false;
+        initRenderer(frame_w, frame_h);
     }
 
     /* TRACK */
@@ -342,6 +885,8 @@ public:
             exit(4);
         }
         rescanAllAnimations();
+        m_event_index.build(track);
+        m_live_next_evict = LLONG_MIN;
     }
 
     void createTrackMem(char *buf, unsigned long bufsize) {
@@ -352,15 +897,134 @@ public:
             exit(4);
         }
         rescanAllAnimations();
+        m_event_index.build(track);
+        m_live_next_evict = LLONG_MIN;
     }
 
     void removeTrack() {
+        stopTrackStream();
         if (track != NULL) {
             ass_free_track(track);
             track = NULL;
         }
         free(m_is_event_animated);
         m_is_event_animated = NULL;
+        m_event_fonts_valid = false;
+        m_event_index.build(NULL);
+        discardDroppedAnimations();
+    }
+
+    /**
+     * \brief Write the current track into a binary snapshot, see track_snapshot.h
+     * \return 1 on success, 0 otherwise
+     */
+    int saveTrackSnapshot(const char *path) {
+        if (!track) return 0;
+        if (!m_is_event_animated) rescanAllAnimations();
+
+        size_t count = track->n_events ? track->n_events : 1;
+        int *order = (int*)malloc(sizeof(int) * count);
+        int *animated = (int*)malloc(sizeof(int) * count);
+        if (!order || !animated) {
+            fprintf(stderr, "jso: cannot allocate track snapshot\n");
+            free(order);
+            free(animated);
+            return 0;
+        }
+        if (m_event_index.sortedEvents(order) != track->n_events) {
+            // index is not usable right now, the loader sorts on its own then
+            for (int i = 0; i < track->n_events; i++) order[i] = i;
+        }
+        memcpy(animated, m_is_event_animated, sizeof(int) * track->n_events);
+
+        // the snapshot keeps the track as it was loaded, animations dropped by
+        // dropAnimationsInRange stay dropped in the live track
+        swapDroppedAnimations(animated);
+        TrackSnapshotWriter out;
+        track_snapshot_write(out, track, animated, order,
+                             m_drop_animations ? TRACK_SNAPSHOT_DROPPED_ANIMATIONS : 0);
+        swapDroppedAnimations(NULL);
+        free(order);
+        free(animated);
+        return out.save(path);
+    }
+
+    /**
+     * \brief Replace the track by one loaded from a snapshot written by saveTrackSnapshot
+     * \return 1 on success, 0 if the snapshot cannot be used; the current track is kept then
+     */
+    int createTrackSnapshot(const char *path) {
+        TrackSnapshotReader in;
+        if (!in.load(path)) return 0;
+
+        int *animated, *order;
+        uint32_t flags;
+        ASS_Track *loaded = track_snapshot_read(in, ass_library, &animated, &order, &flags);
+        if (!loaded) return 0;
+
+        removeTrack();
+        track = loaded;
+        m_is_event_animated = animated;
+        if (bool(flags & TRACK_SNAPSHOT_DROPPED_ANIMATIONS) != m_drop_animations) {
+            rescanAllAnimations();
+        }
+        m_event_index.buildSorted(track, order);
+        m_live_next_evict = LLONG_MIN;
+        free(order);
+        return 1;
+    }
+
+    /**
+     * \brief Start an empty track which is filled piece by piece with appendTrackData
+     * Events can be rendered as soon as the piece holding them was appended.
+     */
+    void createTrackStream() {
+        removeTrack();
+        track = ass_new_track(ass_library);
+        if (!track) {
+            fprintf(stderr, "jso: Failed to start a track\n");
+            exit(4);
+        }
+        m_event_index.build(track);
+        m_live_next_evict = LLONG_MIN;
+        m_streaming = true;
+        // fonts of the events are gathered as they arrive
+        m_event_fonts.clear();
+        m_event_fonts_valid = true;
+    }
+
+    /**
+     * \brief Parse the next piece of a script started with createTrackStream
+     * Only complete lines are parsed, a trailing partial line waits for the next piece.
+     */
+    void appendTrackData(const char *data) {
+        if (!track || !m_streaming) return;
+
+        size_t size = strlen(data), total = m_stream_tail_size + size;
+        char *buf = (char*)m_stream_tail.take(total, true);
+        if (!buf) {
+            fprintf(stderr, "jso: cannot allocate track stream buffer\n");
+            return;
+        }
+        memcpy(buf + m_stream_tail_size, data, size);
+
+        size_t end = total;
+        while (end > 0 && buf[end - 1] != '\n') end--;
+        if (end > 0) parseTrackData(buf, end);
+        memmove(buf, buf + end, total - end);
+        m_stream_tail_size = total - end;
+    }
+
+    /**
+     * \brief Parse what is left of a streamed script and finalize the track
+     */
+    void finishTrackStream() {
+        if (!track || !m_streaming) return;
+        if (m_stream_tail_size > 0) {
+            parseTrackData((char*)m_stream_tail.take(m_stream_tail_size, true), m_stream_tail_size);
+        }
+        ass_process_force_style(track);
+        stopTrackStream();
     }
     /* TRACK */
 
@@ -369,51 +1033,131 @@ public:
         ass_set_frame_size(ass_renderer, frame_w, frame_h);
         canvas_h = frame_h;
         canvas_w = frame_w;
+        forgetBlendParts();
     }
 
     ASS_Image* renderImage(double time, int* changed) {
-        ASS_Image *img = ass_render_frame(ass_renderer, track, (int) (time * 1000), changed);
+        // images of the last blended frame may be released by this call
+        forgetBlendParts();
+        double start_time = emscripten_get_now();
+        ASS_Image *img = renderFrame(time, changed);
+        m_stats.addFrame(emscripten_get_now() - start_time, *changed, img);
         return img;
     }
     /* CANVAS */
 
     void quitLibrary() {
+        stopTrackStream();
         ass_free_track(track);
+        m_event_fonts_valid = false;
         ass_renderer_done(ass_renderer);
-        ass_library_done(ass_library);
+        if (m_owns_library) ass_library_done(ass_library);
         m_blend.clear();
+        forgetBlendParts();
+#ifdef OCTP_THREADS
+        m_pool.stop();
+        for (int i = 0; i < MAX_POOL_THREADS; i++) m_thread_blend[i].clear();
+#endif
         free(m_is_event_animated);
         m_is_event_animated = NULL;
+        m_event_index.build(NULL);
+        discardDroppedAnimations();
     }
 
     void reloadLibrary() {
         quitLibrary();
 
-        initLibrary(canvas_w, canvas_h);
+        if (m_owns_library) {
+            initLibrary(canvas_w, canvas_h);
+        } else {
+            initRenderer(canvas_w, canvas_h);
+        }
     }
 
     void reloadFonts() {
-        ass_set_fonts(ass_renderer, "/assets/default.woff2", NULL, ASS_FONTPROVIDER_FONTCONFIG, "/assets/fonts.conf", 1);
+#ifdef OCTP_NATIVE
+        // bundled default font, but the fontconfig setup of the host system
+        ass_set_fonts(ass_renderer, OCTP_ASSETS_DIR "/default.woff2", NULL, ASS_FONTPROVIDER_AUTODETECT, NULL, 1);
+#else
+        ass_set_fonts(ass_renderer, OCTP_ASSETS_DIR "/default.woff2", NULL, ASS_FONTPROVIDER_FONTCONFIG, OCTP_ASSETS_DIR "/fonts.conf", 1);
+#endif
+        // libass empties its caches and frees the images of the previous frame
+        forgetBlendParts();
     }
 
     void setMargin(int top, int bottom, int left, int right) {
         ass_set_margins(ass_renderer, top, bottom, left, right);
+        forgetBlendParts();
     }
 
     int getEventCount() const {
         return track->n_events;
     }
 
+    /**
+     * \brief Add an empty event; call updateEvent once it is filled in
+     */
     int allocEvent() {
-        free(m_is_event_animated);
-        m_is_event_animated = NULL;
-        return ass_alloc_event(track);
+        int eid = ass_alloc_event(track);
+        m_live_next_evict = LLONG_MIN;
+        scanNewAnimations(eid);
+        m_event_index.add(eid);
+        return eid;
     }
 
     void removeEvent(int eid) {
-        free(m_is_event_animated);
-        m_is_event_animated = NULL;
+        m_event_fonts_valid = false;
+        // everything tracked by event position moves up
+        if (eid < m_dropped_size) {
+            free(m_dropped[eid].text);
+            memmove(m_dropped + eid, m_dropped + eid + 1, sizeof(DroppedAnimation) * (m_dropped_size - eid - 1));
+            memset(m_dropped + m_dropped_size - 1, 0, sizeof(DroppedAnimation));
+        }
+        if (m_is_event_animated) {
+            memmove(m_is_event_animated + eid, m_is_event_animated + eid + 1, sizeof(int) * (track->n_events - eid - 1));
+        }
         ass_free_event(track, eid);
+        // ass_free_event only releases the contents, so close the gap ourselves
+        memmove(track->events + eid, track->events + eid + 1, sizeof(ASS_Event) * (track->n_events - eid - 1));
+        track->n_events--;
+        m_event_index.remove(eid);
+    }
+
+    /**
+     * \brief Let the event index and the animation flags know that an event was changed in place
+     */
+    void updateEvent(int eid) {
+        m_event_index.update(eid);
+        m_live_next_evict = LLONG_MIN;
+        m_event_fonts_valid = false;
+        if (eid < m_dropped_size && m_dropped[eid].text) {
+            // the caller may have replaced the text whose animations were dropped,
+            // so the original must not be restored over it
+            free(m_dropped[eid].text);
+            m_dropped[eid].text = NULL;
+        }
+        if (m_is_event_animated) {
+            m_is_event_animated[eid] = _is_event_animated(track->events + eid, m_drop_animations);
+        }
+    }
+
+    /**
+     * \brief Insert, update and delete events and styles as packed by the caller, see track_batch.h
+     * Only the animation flags of the events touched are updated; the event
+     * index notes the changes and catches up once, on the next query.
+     * \return number of records applied, fewer than in the batch if one was invalid
+     */
+    int applyTrackBatch(const void *data, int size) {
+        if (!track) return 0;
+        TrackBatchReader batch(data, size > 0 ? (size_t)size : 0);
+        int applied = 0;
+        for (; applied < batch.count() && batch.next(); applied++) {
+            if (!applyTrackBatchRecord(batch)) break;
+        }
+        if (applied < batch.count()) {
+            fprintf(stderr, "jso: invalid track batch record %d\n", applied);
+        }
+        return applied;
     }
 
     int getStyleCount() const {
@@ -440,142 +1184,229 @@ public:
         free(m_is_event_animated);
         m_is_event_animated = NULL;
         ass_flush_events(track);
+        m_event_index.clear();
+        discardDroppedAnimations();
+    }
+
+    /**
+     * \brief Register a font from memory; it is used once the fonts are reloaded
+     * \param data font file, copied by libass
+     */
+    void addFont(const char *name, void *data, int size) {
+        ass_add_font(ass_library, (char*)name, (char*)data, size);
+    }
+
+    /**
+     * \brief Forget all fonts registered with addFont; takes effect once the fonts are reloaded
+     * With a shared library every instance on it has to reload its fonts
+     * before rendering again, as their renderers refer to the fonts dropped.
+     */
+    void clearFonts() {
+        ass_clear_fonts(ass_library);
+    }
+
+    /**
+     * \brief Names of all fonts used by events displayed between `start` and `end`
+     * Style fonts and \\fn overrides are listed, separated by newlines, each name once.
+     */
+    const char *getFontsInRange(double start, double end) {
+        m_range_fonts.clear();
+        if (!track) return m_range_fonts.get();
+
+        FontCollector collector(this);
+        m_event_index.forEachInRange((long long)(start * 1000), (long long)(end * 1000), collector);
+        return m_range_fonts.get();
+    }
+
+    /**
+     * \brief Names of all fonts used by the styles and by the events from `first_event` on
+     * Listed like by getFontsInRange. Until the events change after a track
+     * was loaded, the names found by the scan for animations are taken
+     * instead of going through the events again.
+     */
+    const char *getTrackFonts(int first_event) {
+        m_range_fonts.clear();
+        if (!track) return m_range_fonts.get();
+
+        for (int i = 0; i < track->n_styles; i++) {
+            const char *font = track->styles[i].FontName;
+            if (font) m_range_fonts.add(font, strlen(font));
+        }
+        if (first_event <= 0 && m_event_fonts_valid) {
+            m_range_fonts.addAll(m_event_fonts);
+        } else {
+            for (int i = first_event > 0 ? first_event : 0; i < track->n_events; i++) {
+                collectOverrideFonts(track->events + i);
+            }
+        }
+        return m_range_fonts.get();
     }
 
     void setMemoryLimits(int glyph_limit, int bitmap_cache_limit) {
         printf("jso: setting total libass memory limits to: glyph=%d MiB, bitmap cache=%d MiB\n",
             glyph_limit, bitmap_cache_limit);
         ass_set_cache_limits(ass_renderer, glyph_limit, bitmap_cache_limit);
+        m_stats.glyph_limit = glyph_limit;
+        m_stats.bitmap_cache_limit = bitmap_cache_limit;
     }
 
-    RenderBlendResult* renderBlend(double tm, int force) {
-        m_blendResult.blend_time = 0.0;
-        m_blendResult.part = NULL;
+    /**
+     * \brief Limit the memory of all blending buffers together, regions and scratch
+     * Complements the libass cache limits of setMemoryLimits. Once three quarters
+     * of it are used, buffers which are not needed right now are freed after each
+     * frame; regions which do not fit even then are left out of the frame.
+     * \param megabytes 0 for no limit
+     */
+    void setBlendMemoryLimit(int megabytes) {
+        m_blend_budget.limit = (size_t)megabytes * 1024 * 1024;
+        m_stats.blend_memory_limit = megabytes;
+        if (m_blend_budget.limit != 0 && m_blend_budget.used > m_blend_budget.limit) trimBlendBuffers(false);
+    }
 
-        ASS_Image *img = ass_render_frame(ass_renderer, track, (int)(tm * 1000), &m_blendResult.changed);
-        if (img == NULL || (m_blendResult.changed == 0 && !force)) {
-            return &m_blendResult;
-        }
+    /**
+     * \brief Free all blending buffers no frame needs right now, e.g. on memory pressure
+     * Regions kept for incrementalBlend are blended again next time.
+     * The result of the last renderBlend must not be used afterwards.
+     * \return number of bytes freed
+     */
+    double trimMemory() {
+        return (double)trimBlendBuffers(true);
+    }
 
-        double start_blend_time = emscripten_get_now();
-        for (int i = 0; i < MAX_BLEND_STORAGES; i++) {
-            m_blendParts[i].taken = false;
-        }
+    /**
+     * \brief Statistics collected since the last resetStats
+     * libass does not expose its cache usage, only the limits set are reported.
+     */
+    RenderStats* getStats() {
+        m_stats.reallocations = (int)(blendReallocations() - m_stats_reallocs);
+        m_stats.blend_memory = (double)m_blend_budget.used;
+        m_stats.blend_memory_peak = (double)m_blend_budget.peak;
+        return &m_stats;
+    }
 
-        // split rendering region in 9 pieces (as on 3x3 grid)
-        int split_x_low = canvas_w / 3, split_x_high = 2 * canvas_w / 3;
-        int split_y_low = canvas_h / 3, split_y_high = 2 * canvas_h / 3;
-        BoundingBox boxes[MAX_BLEND_STORAGES];
-        for (ASS_Image *cur = img; cur != NULL; cur = cur->next) {
-            if (cur->w == 0 || cur->h == 0) continue; // skip empty images
-            int index = 0;
-            int middle_x = cur->dst_x + (cur->w >> 1), middle_y = cur->dst_y + (cur->h >> 1);
-            if (middle_y > split_y_high) {
-                index += 2 * 3;
-            } else if (middle_y > split_y_low) {
-                index += 1 * 3;
-            }
-            if (middle_x > split_x_high) {
-                index += 2;
-            } else if (middle_y > split_x_low) {
-                index += 1;
-            }
-            boxes[index].add(cur->dst_x, cur->dst_y, cur->w, cur->h);
-        }
-
-        // now merge regions as long as there are intersecting regions
-        for (;;) {
-            bool merged = false;
-            for (int box1 = 0; box1 < MAX_BLEND_STORAGES - 1; box1++) {
-                if (boxes[box1].empty()) continue;
-                for (int box2 = box1 + 1; box2 < MAX_BLEND_STORAGES; box2++) {
-                    if (boxes[box2].empty()) continue;
-                    if (boxes[box1].tryMerge(boxes[box2])) {
-                        boxes[box2].clear();
-                        merged = true;
-                    }
-                }
-            }
-            if (!merged) break;
-        }
+    void resetStats() {
+        m_stats.reset();
+        m_stats_reallocs = blendReallocations();
+        m_blend_budget.peak = m_blend_budget.used;
+    }
 
-        for (int box = 0; box < MAX_BLEND_STORAGES; box++) {
-            if (boxes[box].empty()) continue;
-            RenderBlendPart *part = renderBlendPart(boxes[box], img);
-            if (part == NULL) break; // memory allocation error
-            part->next = m_blendResult.part;
-            m_blendResult.part = part;
-        }
-        m_blendResult.blend_time = emscripten_get_now() - start_blend_time;
+    /**
+     * \brief Limit the size of the bitmaps renderAtlas has the main thread keep
+     */
+    void setAtlasLimit(int megabytes) {
+        m_atlas.setLimit((size_t)megabytes * 1024 * 1024);
+    }
 
-        return &m_blendResult;
+    /**
+     * \brief Render a frame as draw commands over bitmaps sent only once, see bitmap_atlas.h
+     * \param force build the commands even if libass reports no change
+     */
+    AtlasFrame* renderAtlas(double tm, int force) {
+        int changed;
+        double start_time = emscripten_get_now();
+        ASS_Image *img = renderFrame(tm, &changed);
+        m_stats.addFrame(emscripten_get_now() - start_time, changed, img);
+        if (changed == 0 && !force) return m_atlas.unchanged();
+
+        start_time = emscripten_get_now();
+        AtlasFrame *frame = m_atlas.build(img);
+        m_stats.pack.add(emscripten_get_now() - start_time);
+        return frame;
+    }
+
+    /**
+     * \brief Render the first event starting after `tm` into the caches of libass, without output
+     * Meant for idle time, so the first frame of the event does not pay for
+     * font loading, shaping and bitmaps. The next frame rendered for real is
+     * reported as changed, as libass compares it with this one instead of the
+     * frame which is shown, unless both the shown and the new frame are empty.
+     * \return start of the event warmed in seconds, -1 if there is none
+     */
+    double warmNextEvent(double tm) {
+        if (!track) return -1;
+        long long start = m_event_index.nextStart((long long)(tm * 1000));
+        if (start < 0) return -1;
+        // images of the last blended frame are released by this call
+        forgetBlendParts();
+        int changed;
+        ass_render_frame(ass_renderer, track, start, &changed);
+        m_warmed = true;
+        return start / 1000.0;
+    }
+
+    /**
+     * \brief Encode a part of the last blended frame as spans, see span_codec.h
+     * \return the encoded part, valid until the next call; NULL if out of memory
+     */
+    SpanPart* encodeBlendPart(RenderBlendPart *part) {
+        double start_time = emscripten_get_now();
+        SpanPart *encoded = m_span_encoder.encode(part->image, part->dest_width, part->dest_height);
+        m_stats.pack.add(emscripten_get_now() - start_time);
+        return encoded;
     }
 
-    double findNextEventStart(double tm) const {
+    RenderBlendResult* renderBlend(double tm, int force) {
+        if (m_ring.slots == 0) return blendFrame(tm, force);
+
+        int slot = acquireFrameSlot();
+        if (slot < 0) {
+            // reader is behind, libass will still report the change next time
+            m_blendResult.changed = 0;
+            m_blendResult.blend_time = 0.0;
+            m_blendResult.part = NULL;
+            return &m_blendResult;
+        }
+        m_blendParts = m_blendSlots[slot];
+        RenderBlendResult *result = blendFrame(tm, force);
+        if (result->changed || force) publishFrameSlot(slot);
+        return result;
+    }
+
+    double findNextEventStart(double tm) {
         if (!track || track->n_events == 0) return -1;
 
-        ASS_Event *cur = track->events;
         long long now = (long long)(tm * 1000);
-        long long closest = -1;
-
-        for (int i = 0; i < track->n_events; i++, cur++) {
-            long long start = cur->Start;
-            if (start <= now) {
-                if (now < start + cur->Duration) {
-                    // there's currently an event being displayed, we should render it
-                    closest = now;
-                    break;
-                }
-            } else if (start < closest || closest == -1) {
-                closest = start;
-            }
+        ActiveEventFinder finder;
+        m_event_index.forEachActive(now, finder);
+        if (finder.found) {
+            // there's currently an event being displayed, we should render it
+            return now / 1000.0;
         }
 
-        return closest / 1000.0;
+        return m_event_index.nextStart(now) / 1000.0;
     }
 
-    EventStopTimesResult* findEventStopTimes(double tm) const {
-        static EventStopTimesResult result;
+    EventStopTimesResult* findEventStopTimes(double tm) {
+        EventStopTimesResult& result = m_stop_times;
         if (!track || track->n_events == 0) {
             result.eventFinish = result.emptyFinish = -1;
             return &result;
         }
 
-        ASS_Event *cur = track->events;
         long long now = (long long)(tm * 1000);
 
-        long long minFinish = -1, maxFinish = -1, minStart = -1;
-        int current_animated = 0;
-
-        for (int i = 0; i < track->n_events; i++, cur++) {
-            long long start = cur->Start;
-            long long finish = start + cur->Duration;
-            if (start <= now) {
-                if (finish > now) {
-                    if (finish < minFinish || minFinish == -1) {
-                        minFinish = finish;
-                    }
-                    if (finish > maxFinish) {
-                        maxFinish = finish;
-                    }
-                    if (!current_animated && m_is_event_animated) current_animated = m_is_event_animated[i];
-                }
-            } else if (start < minStart || minStart == -1) {
-                minStart = start;
-            }
-        }
-        result.is_animated = current_animated;
+        ActiveEventStats stats(now, track, m_is_event_animated);
+        m_event_index.forEachActive(now, stats);
+        long long minFinish = stats.minFinish, maxFinish = stats.maxFinish;
+        long long minStart = m_event_index.nextStart(now);
+        result.is_animated = stats.animated;
 
+        bool animationNext = false;
         if (minFinish != -1) {
-            // some event is going on, so we need to re-draw either when it stops
-            // or when some other event starts
-            result.eventFinish = ((minStart == -1 || minFinish < minStart) ? minFinish : minStart) / 1000.0;
+            // some event is going on, so we need to re-draw either when it stops,
+            // when some other event starts or when one of its animations starts
+            long long finish = (minStart == -1 || minFinish < minStart) ? minFinish : minStart;
+            if (stats.nextChange != -1 && stats.nextChange < finish) {
+                finish = stats.nextChange;
+                animationNext = true;
+            }
+            result.eventFinish = finish / 1000.0;
         } else {
             // there's no current event, so no need to draw anything
             result.eventFinish = -1;
         }
 
-        if (minFinish == maxFinish && (minStart == -1 || minStart > maxFinish)) {
+        if (!animationNext && minFinish == maxFinish && (minStart == -1 || minStart > maxFinish)) {
             // there's empty space after this event ends
             result.emptyFinish = minStart / 1000.0;
         } else {
@@ -594,65 +1425,517 @@ public:
             exit(5);
         }
 
+        // fonts are looked for in the same pass, see getTrackFonts
+        m_event_fonts.clear();
         ASS_Event *cur = track->events;
         int *animated = m_is_event_animated;
         for (int i = 0; i < track->n_events; i++, cur++, animated++) {
-            *animated = _is_event_animated(cur, m_drop_animations);
+            *animated = _is_event_animated(cur, m_drop_animations, &m_event_fonts);
+        }
+        m_event_fonts_valid = true;
+    }
+
+    /**
+     * \brief Remove animations of the events displayed between `start` and `end`
+     * Unlike setDropAnimations this only touches the given events and keeps
+     * their original text, so restoreAnimations can bring the animations back.
+     * \return number of events whose animations were dropped
+     */
+    int dropAnimationsInRange(double start, double end) {
+        if (!track || m_drop_animations) return 0;
+        if (!m_is_event_animated) rescanAllAnimations();
+        if (m_dropped_size < track->n_events) {
+            DroppedAnimation *dropped = (DroppedAnimation*)realloc(m_dropped, sizeof(DroppedAnimation) * track->n_events);
+            if (!dropped) {
+                fprintf(stderr, "jso: cannot allocate dropped animations\n");
+                return 0;
+            }
+            memset(dropped + m_dropped_size, 0, sizeof(DroppedAnimation) * (track->n_events - m_dropped_size));
+            m_dropped = dropped;
+            m_dropped_size = track->n_events;
+        }
+
+        AnimationDropper dropper(this);
+        m_event_index.forEachInRange((long long)(start * 1000), (long long)(end * 1000), dropper);
+        return dropper.count;
+    }
+
+    /**
+     * \brief Bring back all animations removed by dropAnimationsInRange
+     */
+    void restoreAnimations() {
+        for (int eid = 0; eid < m_dropped_size; eid++) {
+            DroppedAnimation *dropped = m_dropped + eid;
+            if (!dropped->text) continue;
+            ASS_Event *event = track->events + eid;
+            free(event->Text);
+            event->Text = dropped->text;
+            dropped->text = NULL;
+            if (event->Effect) event->Effect[0] = dropped->effect;
+            if (m_is_event_animated) m_is_event_animated[eid] = 1;
         }
     }
 
 private:
-    RenderBlendPart* renderBlendPart(const BoundingBox& rect, ASS_Image* img) {
-        int width = rect.max_x - rect.min_x + 1, height = rect.max_y - rect.min_y + 1;
+    struct DroppedAnimation {
+        char *text;  // original text, NULL if the event keeps its animations
+        char effect; // first character of the original effect
+    };
+
+    struct AnimationDropper {
+        SubtitleOctopus *octopus;
+        int count;
+        AnimationDropper(SubtitleOctopus *self): octopus(self), count(0) {}
+        bool operator()(int event, long long start, long long finish) {
+            if (octopus->dropEventAnimations(event)) count++;
+            return true;
+        }
+    };
 
-        // make float buffer for blending
-        const size_t buffer_size = width * height * 4 * sizeof(float);
-        float* buf = (float*)m_blend.take(buffer_size, 0);
-        if (buf == NULL) {
-            fprintf(stderr, "jso: cannot allocate buffer for blending\n");
-            return NULL;
+    void initRenderer(int frame_w, int frame_h) {
+        ass_renderer = ass_renderer_init(ass_library);
+        if (!ass_renderer) {
+            fprintf(stderr, "jso: ass_renderer_init failed!\n");
+            exit(3);
         }
-        memset(buf, 0, buffer_size);
 
-        // blend things in
-        for (ASS_Image *cur = img; cur != NULL; cur = cur->next) {
-            if (cur->dst_x < rect.min_x || cur->dst_y < rect.min_y) continue; // skip images not fully within render region
-            int curw = cur->w, curh = cur->h;
-            if (curw == 0 || curh == 0 || cur->dst_x + curw - 1 > rect.max_x || cur->dst_y + curh - 1 > rect.max_y) continue; // skip empty images or images outside render region
-            int a = (255 - (cur->color & 0xFF));
-            if (a == 0) continue; // skip transparent images
+        resizeCanvas(frame_w, frame_h);
 
-            int curs = (cur->stride >= curw) ? cur->stride : curw;
-            int curx = cur->dst_x - rect.min_x, cury = cur->dst_y - rect.min_y;
+        reloadFonts();
+        m_blend.clear();
+        m_is_event_animated = NULL;
+#ifdef OCTP_THREADS
+        m_pool.start(blendThreadCount());
+#endif
+    }
+
+    bool dropEventAnimations(int eid) {
+        if (!m_is_event_animated[eid] || m_dropped[eid].text) return false;
+        ASS_Event *event = track->events + eid;
+        char *text = strdup(event->Text);
+        if (!text) return false;
+        m_dropped[eid].text = text;
+        m_dropped[eid].effect = event->Effect ? event->Effect[0] : '\0';
+        m_is_event_animated[eid] = _is_event_animated(event, true);
+        return true;
+    }
 
-            unsigned char *bitmap = cur->bitmap;
-            float normalized_a = a / 255.0;
-            float r = ((cur->color >> 24) & 0xFF) / 255.0;
-            float g = ((cur->color >> 16) & 0xFF) / 255.0;
-            float b = ((cur->color >> 8) & 0xFF) / 255.0;
-
-            int buf_line_coord = cury * width;
-            for (int y = 0, bitmap_offset = 0; y < curh; y++, bitmap_offset += curs, buf_line_coord += width)
-            {
-                for (int x = 0; x < curw; x++)
-                {
-                    float pix_alpha = bitmap[bitmap_offset + x] * normalized_a / 255.0;
-                    float inv_alpha = 1.0 - pix_alpha;
-
-                    int buf_coord = (buf_line_coord + curx + x) << 2;
-                    float *buf_r = buf + buf_coord;
-                    float *buf_g = buf + buf_coord + 1;
-                    float *buf_b = buf + buf_coord + 2;
-                    float *buf_a = buf + buf_coord + 3;
-
-                    // do the compositing, pre-multiply image RGB with alpha for current pixel
-                    *buf_a = pix_alpha + *buf_a * inv_alpha;
-                    *buf_r = r * pix_alpha + *buf_r * inv_alpha;
-                    *buf_g = g * pix_alpha + *buf_g * inv_alpha;
-                    *buf_b = b * pix_alpha + *buf_b * inv_alpha;
+    /**
+     * \brief Exchange the text and effect of every event whose animations were
+     * dropped with the original ones; calling it again swaps them back
+     * \param animated if not NULL, receives the animation flags of the originals
+     */
+    void swapDroppedAnimations(int *animated) {
+        for (int eid = 0; eid < m_dropped_size; eid++) {
+            DroppedAnimation *dropped = m_dropped + eid;
+            if (!dropped->text) continue;
+            ASS_Event *event = track->events + eid;
+            char *text = event->Text;
+            event->Text = dropped->text;
+            dropped->text = text;
+            if (event->Effect) {
+                char effect = event->Effect[0];
+                event->Effect[0] = dropped->effect;
+                dropped->effect = effect;
+            }
+            if (animated) animated[eid] = 1;
+        }
+    }
+
+    bool applyTrackBatchRecord(TrackBatchReader& batch) {
+        switch (batch.op) {
+            case TRACK_BATCH_EVENT_INSERT: {
+                int eid = allocEvent();
+                if (eid < 0) return false;
+                if (!batch.apply(track->events + eid)) {
+                    removeEvent(eid);
+                    return false;
+                }
+                updateEvent(eid);
+                return true;
+            }
+            case TRACK_BATCH_EVENT_UPDATE:
+                if (batch.index < 0 || batch.index >= track->n_events) return false;
+                if (!batch.apply(track->events + batch.index)) return false;
+                updateEvent(batch.index);
+                return true;
+            case TRACK_BATCH_EVENT_DELETE:
+                if (batch.index < 0 || batch.index >= track->n_events) return false;
+                removeEvent(batch.index);
+                return true;
+            case TRACK_BATCH_STYLE_INSERT: {
+                int sid = ass_alloc_style(track);
+                if (sid < 0) return false;
+                if (!batch.apply(track->styles + sid)) {
+                    ass_free_style(track, sid);
+                    track->n_styles--;
+                    return false;
                 }
+                return true;
             }
+            case TRACK_BATCH_STYLE_UPDATE:
+                if (batch.index < 0 || batch.index >= track->n_styles) return false;
+                return batch.apply(track->styles + batch.index);
         }
+        return false;
+    }
+
+    /**
+     * \brief Render with libass, shared by renderImage, renderAtlas and blendFrame
+     * Evicts the events which left the live window first.
+     */
+    ASS_Image* renderFrame(double tm, int *changed) {
+        if (m_live_window && track && (long long)(tm * 1000) - m_live_window >= m_live_next_evict) {
+            evictEvents((long long)(tm * 1000) - m_live_window);
+        }
+        ASS_Image *img = ass_render_frame(ass_renderer, track, (int)(tm * 1000), changed);
+        if (m_warmed) {
+            // compared with a frame which was never shown; an empty one stays
+            // unchanged, so gaps warmed while playing are not posted again
+            *changed = img || !m_shown_empty ? 2 : 0;
+            m_warmed = false;
+        }
+        m_shown_empty = img == NULL;
+        return img;
+    }
+
+    void discardDroppedAnimations() {
+        for (int eid = 0; eid < m_dropped_size; eid++) {
+            free(m_dropped[eid].text);
+        }
+        free(m_dropped);
+        m_dropped = NULL;
+        m_dropped_size = 0;
+    }
+
+    void stopTrackStream() {
+        m_streaming = false;
+        m_stream_tail.clear();
+        m_stream_tail_size = 0;
+    }
+
+    /**
+     * \brief Feed complete lines to libass and index the events they added
+     */
+    void parseTrackData(char *data, size_t size) {
+        int first = track->n_events;
+        ass_process_data(track, data, (int)size);
+        for (int eid = first; eid < track->n_events; eid++) {
+            // events of a script are ordered as they appear in it, like ass_read_file does
+            track->events[eid].ReadOrder = eid;
+            m_event_index.add(eid);
+        }
+        m_live_next_evict = LLONG_MIN;
+        scanNewAnimations(first);
+    }
+
+    /**
+     * \brief Remove the events finished at or before `before` in one pass over the track
+     * Remembers when the earliest finish of the events kept expires, so
+     * renderFrame only comes back once there is something to evict.
+     */
+    int evictEvents(long long before) {
+        m_event_fonts_valid = false;
+        int count = track->n_events;
+        int *remap = (int*)malloc(sizeof(int) * (count ? count : 1));
+        if (!remap) {
+            fprintf(stderr, "jso: cannot evict events\n");
+            return 0;
+        }
+
+        long long next = LLONG_MAX;
+        int kept = 0;
+        for (int eid = 0; eid < count; eid++) {
+            ASS_Event *event = track->events + eid;
+            long long finish = event->Start + event->Duration;
+            if (finish <= before) {
+                ass_free_event(track, eid);
+                if (eid < m_dropped_size) {
+                    free(m_dropped[eid].text);
+                    memset(m_dropped + eid, 0, sizeof(DroppedAnimation));
+                }
+                remap[eid] = -1;
+                continue;
+            }
+            if (finish < next) next = finish;
+            remap[eid] = kept;
+            if (kept != eid) {
+                track->events[kept] = track->events[eid];
+                if (m_is_event_animated) m_is_event_animated[kept] = m_is_event_animated[eid];
+                if (kept < m_dropped_size) {
+                    if (eid < m_dropped_size) m_dropped[kept] = m_dropped[eid];
+                    else memset(m_dropped + kept, 0, sizeof(DroppedAnimation));
+                }
+            }
+            kept++;
+        }
+        // entries past the kept events were moved down or freed above
+        for (int eid = kept; eid < m_dropped_size; eid++) {
+            memset(m_dropped + eid, 0, sizeof(DroppedAnimation));
+        }
+
+        track->n_events = kept;
+        if (kept != count) m_event_index.compact(remap);
+        free(remap);
+        m_live_next_evict = next;
+        return count - kept;
+    }
+
+    /**
+     * \brief Extend the animation flags by the events from `first` on
+     */
+    void scanNewAnimations(int first) {
+        if (first > 0 && !m_is_event_animated) {
+            // flags were never built or dropped, scan everything
+            rescanAllAnimations();
+            return;
+        }
+        int *animated = (int*)realloc(m_is_event_animated, sizeof(int) * (track->n_events ? track->n_events : 1));
+        if (animated == NULL) {
+            printf("cannot parse animated events\n");
+            exit(5);
+        }
+        m_is_event_animated = animated;
+        FontNames *fonts = m_event_fonts_valid ? &m_event_fonts : NULL;
+        for (int i = first; i < track->n_events; i++) {
+            animated[i] = _is_event_animated(track->events + i, m_drop_animations, fonts);
+        }
+    }
+
+    struct FontCollector {
+        SubtitleOctopus *octopus;
+        FontCollector(SubtitleOctopus *self): octopus(self) {}
+        bool operator()(int event, long long start, long long finish) {
+            octopus->collectEventFonts(octopus->track->events + event);
+            return true;
+        }
+    };
+
+    void collectEventFonts(const ASS_Event *event) {
+        if (event->Style >= 0 && event->Style < track->n_styles) {
+            const char *font = track->styles[event->Style].FontName;
+            if (font) m_range_fonts.add(font, strlen(font));
+        }
+        collectOverrideFonts(event);
+    }
+
+    void collectOverrideFonts(const ASS_Event *event) {
+        OverrideTagScanner scanner(event->Text);
+        OverrideTag tag;
+        while (scanner.next(&tag)) {
+            _add_font_tag(tag, &m_range_fonts);
+        }
+    }
+
+    struct ActiveEventFinder {
+        bool found;
+        ActiveEventFinder(): found(false) {}
+        bool operator()(int event, long long start, long long finish) {
+            found = true;
+            return false;
+        }
+    };
+
+    struct ActiveEventStats {
+        long long now, minFinish, maxFinish;
+        long long nextChange; // earliest start of an animation of an active event, -1 if none
+        int animated;
+        const ASS_Track *track;
+        const int *is_event_animated;
+        ActiveEventStats(long long now, const ASS_Track *track, const int *is_animated):
+            now(now), minFinish(-1), maxFinish(-1), nextChange(-1), animated(0), track(track), is_event_animated(is_animated) {}
+        bool operator()(int event, long long start, long long finish) {
+            if (finish < minFinish || minFinish == -1) minFinish = finish;
+            if (finish > maxFinish) maxFinish = finish;
+            if (is_event_animated && is_event_animated[event]) {
+                // only parse the few events flagged as animated to see whether they are right now
+                AnimationTimes times(now - start, finish - start);
+                _event_animation_times(track->events + event, times);
+                if (times.active) animated = 1;
+                if (times.next != -1 && (nextChange == -1 || start + times.next < nextChange)) {
+                    nextChange = start + times.next;
+                }
+            }
+            return true;
+        }
+    };
+
+    RenderBlendResult* blendFrame(double tm, int force) {
+        m_blendResult.blend_time = 0.0;
+        m_blendResult.part = NULL;
+
+        double start_render_time = emscripten_get_now();
+        ASS_Image *img = renderFrame(tm, &m_blendResult.changed);
+        m_stats.addFrame(emscripten_get_now() - start_render_time, m_blendResult.changed, img);
+        if (m_blendResult.changed == 0 && !force) {
+            return &m_blendResult;
+        }
+        if (img == NULL) {
+            forgetBlendParts();
+            return &m_blendResult;
+        }
+
+        double start_blend_time = emscripten_get_now();
+        // libass keeps the images of the previous frame referenced until this
+        // frame is done, so an unchanged bitmap pointer means unchanged pixels
+        bool reuse = m_incremental_blend && !force && m_ring.slots == 0;
+        int previous_parts = 0;
+        for (int i = 0; i < MAX_BLEND_STORAGES; i++) {
+            m_blendParts[i].taken = false;
+            if (!reuse) m_blendParts[i].reusable = false;
+            if (m_blendParts[i].reusable) previous_parts++;
+        }
+
+        BoundingBox boxes[MAX_BLEND_STORAGES];
+        int box_count = m_partitioner.partition(img, boxes, MAX_BLEND_STORAGES);
+
+        // first claim the regions which are the same as last time,
+        // then blend the rest into whatever storages are left
+        uint64_t hashes[MAX_BLEND_STORAGES];
+        bool done[MAX_BLEND_STORAGES] = {false};
+        int parts = 0, reused = 0;
+        for (int box = 0; box < box_count; box++) {
+            parts++;
+            hashes[box] = m_incremental_blend ? hashBlendPart(boxes[box], img) : 0;
+            RenderBlendPart *part = reuse ? reuseBlendPart(boxes[box], hashes[box]) : NULL;
+            if (part == NULL) continue;
+            reused++;
+            done[box] = true;
+            part->next = m_blendResult.part;
+            m_blendResult.part = part;
+        }
+        for (int i = 0; i < MAX_BLEND_STORAGES; i++) {
+            m_blendParts[i].reusable = false;
+        }
+        double start_parts_time = emscripten_get_now();
+        m_stats.split.add(start_parts_time - start_blend_time);
+        m_stats.parts += parts;
+        m_stats.reused_parts += reused;
+
+        BlendJobs jobs;
+        jobs.octopus = this;
+        jobs.img = img;
+        int job_count = 0;
+        for (int box = 0; box < box_count; box++) {
+            if (done[box]) continue;
+            RenderBlendStorage *storage = takeBlendStorage(boxes[box], hashes[box]);
+            if (storage == NULL) break; // memory allocation error
+            jobs.storages[job_count++] = storage;
+        }
+        blendParts(jobs, job_count);
+        m_stats.blend.add(emscripten_get_now() - start_parts_time);
+        double pack_time = 0.0;
+        for (int i = 0; i < job_count; i++) {
+            if (!jobs.ok[i]) {
+                jobs.storages[i]->taken = false;
+                continue;
+            }
+            RenderBlendPart *part = &jobs.storages[i]->part;
+            pack_time += jobs.pack_time[i];
+            m_stats.bytes += 4.0 * part->dest_width * part->dest_height;
+            part->next = m_blendResult.part;
+            m_blendResult.part = part;
+        }
+
+        for (int i = 0; i < MAX_BLEND_STORAGES; i++) {
+            m_blendParts[i].reusable = m_incremental_blend && m_blendParts[i].taken;
+        }
+        if (job_count > 0) m_stats.pack.add(pack_time);
+        if (m_blend_budget.limit != 0 && m_blend_budget.used > m_blend_budget.limit / 4 * 3) {
+            trimBlendBuffers(false);
+        }
+        if (reuse && reused == parts && reused == previous_parts) {
+            // libass saw a change, but every region came out the same
+            m_blendResult.changed = 0;
+        }
+        m_blendResult.blend_time = emscripten_get_now() - start_blend_time;
+
+        return &m_blendResult;
+    }
+
+    void forgetBlendParts() {
+        // bitmap pointers are not to be trusted either
+        m_atlas.forgetPointers();
+        for (int slot = 0; slot < MAX_FRAME_SLOTS; slot++) {
+            for (int i = 0; i < MAX_BLEND_STORAGES; i++) {
+                m_blendSlots[slot][i].reusable = false;
+            }
+        }
+    }
+
+    int acquireFrameSlot() {
+        for (int i = 0; i < m_ring.slots; i++) {
+            int slot = (m_ring_next + i) % m_ring.slots;
+            if (__atomic_load_n(&m_ring.slot[slot].state, __ATOMIC_ACQUIRE) == FRAME_SLOT_FREE) {
+                return slot;
+            }
+        }
+        return -1;
+    }
+
+    void publishFrameSlot(int slot) {
+        FrameSlot *frame = m_ring.slot + slot;
+        frame->count = 0;
+        for (RenderBlendPart *part = m_blendResult.part; part != NULL; part = part->next) {
+            FrameSlotPart *out = frame->parts + frame->count++;
+            out->x = part->dest_x;
+            out->y = part->dest_y;
+            out->w = part->dest_width;
+            out->h = part->dest_height;
+            out->image = (uint32_t)(uintptr_t)part->image;
+        }
+        frame->seq = ++m_ring_seq;
+        __atomic_store_n(&frame->state, FRAME_SLOT_READY, __ATOMIC_RELEASE);
+        __atomic_store_n(&m_ring.published, frame->seq, __ATOMIC_RELEASE);
+        m_ring_next = (slot + 1) % m_ring.slots;
+    }
+
+    /**
+     * \brief Hash everything that determines the pixels of a region:
+     * bitmap, position, size and colour of each image within it
+     */
+    static uint64_t hashBlendPart(const BoundingBox& rect, ASS_Image* img) {
+        // FNV-1a over whole fields instead of bytes
+        uint64_t hash = 14695981039346656037ULL;
+        #define HASH_FIELD(value) hash = (hash ^ (uint64_t)(value)) * 1099511628211ULL
+        for (ASS_Image *cur = img; cur != NULL; cur = cur->next) {
+            if (cur->w == 0 || cur->h == 0 || !rect.contains(cur)) continue;
+            HASH_FIELD((uintptr_t)cur->bitmap);
+            HASH_FIELD(cur->stride);
+            HASH_FIELD(((uint64_t)(unsigned)cur->w << 32) | (unsigned)cur->h);
+            HASH_FIELD(((uint64_t)(unsigned)cur->dst_x << 32) | (unsigned)cur->dst_y);
+            HASH_FIELD(cur->color);
+        }
+        #undef HASH_FIELD
+        return hash;
+    }
+
+    /**
+     * \brief Take over the part of the previous frame covering the same region with the same images
+     */
+    RenderBlendPart* reuseBlendPart(const BoundingBox& rect, uint64_t hash) {
+        for (int i = 0; i < MAX_BLEND_STORAGES; i++) {
+            RenderBlendStorage *storage = m_blendParts + i;
+            if (!storage->reusable || storage->taken || storage->hash != hash) continue;
+            BoundingBox prev;
+            prev.min_x = storage->part.dest_x;
+            prev.min_y = storage->part.dest_y;
+            prev.max_x = storage->part.dest_x + storage->part.dest_width - 1;
+            prev.max_y = storage->part.dest_y + storage->part.dest_height - 1;
+            if (!prev.equals(rect)) continue;
+
+            storage->taken = true;
+            storage->part.unchanged = 1;
+            return &storage->part;
+        }
+        return NULL;
+    }
+
+    /**
+     * \brief Pick the storage whose buffer fits the region best and size it
+     */
+    RenderBlendStorage* takeBlendStorage(const BoundingBox& rect, uint64_t hash) {
+        int width = rect.max_x - rect.min_x + 1, height = rect.max_y - rect.min_y + 1;
 
         // find closest free buffer
         size_t needed = sizeof(unsigned int) * width * height;
@@ -676,50 +1959,220 @@ private:
         }
 
         unsigned int *result = (unsigned int*)storage->buf.take(needed, false);
+        if (result == NULL && m_blend_budget.limit != 0 && trimBlendBuffers(false) > 0) {
+            result = (unsigned int*)storage->buf.take(needed, false);
+        }
         if (result == NULL) {
             printf("jso: cannot make a buffer for rendering part!\n");
             return NULL;
         }
         storage->taken = true;
 
-        // now build the result;
-        for (int y = 0, buf_line_coord = 0; y < height; y++, buf_line_coord += width) {
-            for (int x = 0; x < width; x++) {
-                unsigned int pixel = 0;
-                int buf_coord = (buf_line_coord + x) << 2;
-                float alpha = buf[buf_coord + 3];
-                if (alpha > MIN_UINT8_CAST) {
-                    // need to un-multiply the result
-                    float value = buf[buf_coord] / alpha;
-                    pixel |= CLAMP_UINT8(value); // R
-                    value = buf[buf_coord + 1] / alpha;
-                    pixel |= CLAMP_UINT8(value) << 8; // G
-                    value = buf[buf_coord + 2] / alpha;
-                    pixel |= CLAMP_UINT8(value) << 16; // B
-                    pixel |= CLAMP_UINT8(alpha) << 24; // A
-                }
-                result[buf_line_coord + x] = pixel;
-            }
-        }
-
-        // return the thing
         storage->part.dest_x = rect.min_x;
         storage->part.dest_y = rect.min_y;
         storage->part.dest_width = width;
         storage->part.dest_height = height;
         storage->part.image = (unsigned char*)result;
-        return &storage->part;
+        storage->part.unchanged = 0;
+        storage->hash = hash;
+        return storage;
     }
 
+    /**
+     * \brief Blend all images within the region of a part into its image
+     * Touches nothing but the part and the scratch buffer, so different
+     * parts can be blended concurrently.
+     */
+    static bool blendPart(RenderBlendPart *part, ASS_Image* img, bool premultiplied, ReusableBuffer& scratch, double& pack_time) {
+        BoundingBox rect;
+        rect.min_x = part->dest_x;
+        rect.min_y = part->dest_y;
+        rect.max_x = part->dest_x + part->dest_width - 1;
+        rect.max_y = part->dest_y + part->dest_height - 1;
+        int width = part->dest_width, height = part->dest_height;
+
+        // make planar Q15 buffer for blending
+        const size_t plane_size = width * height;
+        const size_t buffer_size = plane_size * 4 * sizeof(int16_t);
+        int16_t* buf = (int16_t*)scratch.take(buffer_size, 0);
+        if (buf == NULL) {
+            fprintf(stderr, "jso: cannot allocate buffer for blending\n");
+            return false;
+        }
+        memset(buf, 0, buffer_size);
+        int16_t *plane_r = buf, *plane_g = buf + plane_size;
+        int16_t *plane_b = buf + 2 * plane_size, *plane_a = buf + 3 * plane_size;
+
+        // blend things in
+        for (ASS_Image *cur = img; cur != NULL; cur = cur->next) {
+            if (cur->dst_x < rect.min_x || cur->dst_y < rect.min_y) continue; // skip images not fully within render region
+            int curw = cur->w, curh = cur->h;
+            if (curw == 0 || curh == 0 || cur->dst_x + curw - 1 > rect.max_x || cur->dst_y + curh - 1 > rect.max_y) continue; // skip empty images or images outside render region
+            int a = (255 - (cur->color & 0xFF));
+            if (a == 0) continue; // skip transparent images
+
+            int curs = (cur->stride >= curw) ? cur->stride : curw;
+            int curx = cur->dst_x - rect.min_x, cury = cur->dst_y - rect.min_y;
+
+            int16_t a15 = u8_to_q15(a);
+            int16_t r15 = u8_to_q15((cur->color >> 24) & 0xFF);
+            int16_t g15 = u8_to_q15((cur->color >> 16) & 0xFF);
+            int16_t b15 = u8_to_q15((cur->color >> 8) & 0xFF);
+
+            const unsigned char *bitmap = cur->bitmap;
+            size_t buf_line_coord = cury * width + curx;
+            for (int y = 0; y < curh; y++, bitmap += curs, buf_line_coord += width) {
+                blend_row_q15(plane_r + buf_line_coord, plane_g + buf_line_coord,
+                              plane_b + buf_line_coord, plane_a + buf_line_coord,
+                              bitmap, curw, r15, g15, b15, a15);
+            }
+        }
+
+        // now build the result, un-multiplying the colours unless asked not to
+        double start_pack_time = emscripten_get_now();
+        unsigned int *result = (unsigned int*)part->image;
+        for (int y = 0, buf_line_coord = 0; y < height; y++, buf_line_coord += width) {
+            if (premultiplied) {
+                pack_row_rgba_premultiplied(plane_r + buf_line_coord, plane_g + buf_line_coord,
+                                            plane_b + buf_line_coord, plane_a + buf_line_coord,
+                                            result + buf_line_coord, width);
+            } else {
+                pack_row_rgba(plane_r + buf_line_coord, plane_g + buf_line_coord,
+                              plane_b + buf_line_coord, plane_a + buf_line_coord,
+                              result + buf_line_coord, width);
+            }
+        }
+        pack_time = emscripten_get_now() - start_pack_time;
+        return true;
+    }
+
+    /**
+     * \brief Free the blending buffers which are not in use; only call it while not blending
+     * Skipped are regions of the frame being built, regions of published frame
+     * slots the main thread may be reading and, unless `everything`, regions
+     * kept for incremental blending.
+     * \return number of bytes freed
+     */
+    size_t trimBlendBuffers(bool everything) {
+        size_t before = m_blend_budget.used;
+        m_blend.clear();
+#ifdef OCTP_THREADS
+        for (int i = 0; i < MAX_POOL_THREADS; i++) m_thread_blend[i].clear();
+#endif
+        for (int slot = 0; slot < MAX_FRAME_SLOTS; slot++) {
+            if (slot < m_ring.slots &&
+                    __atomic_load_n(&m_ring.slot[slot].state, __ATOMIC_ACQUIRE) != FRAME_SLOT_FREE) {
+                continue;
+            }
+            for (int i = 0; i < MAX_BLEND_STORAGES; i++) {
+                RenderBlendStorage *storage = m_blendSlots[slot] + i;
+                if (storage->reusable && !everything) continue;
+                if (storage->taken && !everything) continue;
+                storage->buf.clear();
+                storage->taken = storage->reusable = false;
+            }
+        }
+        if (everything) m_blendResult.part = NULL;
+        return before - m_blend_budget.used;
+    }
+
+    struct BlendJobs {
+        SubtitleOctopus *octopus;
+        ASS_Image *img;
+        RenderBlendStorage *storages[MAX_BLEND_STORAGES];
+        bool ok[MAX_BLEND_STORAGES];
+        double pack_time[MAX_BLEND_STORAGES];
+    };
+
+    static void runBlendJob(void *ctx, int job, int worker) {
+        BlendJobs *jobs = (BlendJobs*)ctx;
+        jobs->pack_time[job] = 0.0;
+        jobs->ok[job] = blendPart(&jobs->storages[job]->part, jobs->img, jobs->octopus->m_premultiplied,
+                                  jobs->octopus->blendScratch(worker), jobs->pack_time[job]);
+    }
+
+    size_t blendReallocations() const {
+        size_t reallocs = m_blend.reallocations();
+#ifdef OCTP_THREADS
+        for (int i = 0; i < MAX_POOL_THREADS; i++) reallocs += m_thread_blend[i].reallocations();
+#endif
+        for (int slot = 0; slot < MAX_FRAME_SLOTS; slot++) {
+            for (int i = 0; i < MAX_BLEND_STORAGES; i++) reallocs += m_blendSlots[slot][i].buf.reallocations();
+        }
+        return reallocs;
+    }
+
+    ReusableBuffer& blendScratch(int worker) {
+#ifdef OCTP_THREADS
+        if (worker > 0) return m_thread_blend[worker - 1];
+#endif
+        return m_blend;
+    }
+
+    /**
+     * \brief Blend the parts in the given storages, spread over the thread pool if there is one
+     */
+    void blendParts(BlendJobs& jobs, int count) {
+#ifdef OCTP_THREADS
+        m_pool.run(runBlendJob, &jobs, count);
+#else
+        for (int i = 0; i < count; i++) runBlendJob(&jobs, i, 0);
+#endif
+    }
+
+#ifdef OCTP_THREADS
+    static int blendThreadCount() {
+#if defined(__EMSCRIPTEN__)
+        int cores = emscripten_num_logical_cores();
+#else
+        int cores = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+        // the calling thread blends as well
+        int threads = cores - 1;
+        if (threads > OCTP_BLEND_THREADS) threads = OCTP_BLEND_THREADS;
+        return threads > 0 ? threads : 0;
+    }
+#endif
+
+    BufferBudget m_blend_budget; // of m_blend, m_thread_blend and the storages
     ReusableBuffer m_blend;
+#ifdef OCTP_THREADS
+    ThreadPool m_pool;
+    ReusableBuffer m_thread_blend[MAX_POOL_THREADS];
+#endif
     RenderBlendResult m_blendResult;
-    RenderBlendStorage m_blendParts[MAX_BLEND_STORAGES];
+    EventStopTimesResult m_stop_times; // result of findEventStopTimes
+    RegionPartitioner m_partitioner;
+    BitmapAtlas m_atlas;
+    SpanEncoder m_span_encoder;
+    RenderBlendStorage m_blendSlots[MAX_FRAME_SLOTS][MAX_BLEND_STORAGES];
+    RenderBlendStorage *m_blendParts; // storages of the frame slot being blended
     int *m_is_event_animated;
     bool m_drop_animations;
+    bool m_incremental_blend;
+    bool m_premultiplied;
+    FrameRing m_ring;
+    int m_ring_seq, m_ring_next;
+    EventIndex m_event_index;
+    RenderStats m_stats;
+    size_t m_stats_reallocs; // blendReallocations() at the last resetStats
+    FontNames m_range_fonts; // result of getFontsInRange and getTrackFonts
+    FontNames m_event_fonts; // \\fn fonts of all events, gathered while scanning them for animations
+    bool m_event_fonts_valid; // m_event_fonts still matches the events
+    ReusableBuffer m_stream_tail; // partial line of a streamed script
+    size_t m_stream_tail_size;
+    bool m_streaming;
+    DroppedAnimation *m_dropped; // originals of events with animations dropped, by event
+    int m_dropped_size;
+    long long m_live_window; // in ms, 0 keeps all events
+    long long m_live_next_evict; // earliest finish of the events kept, nothing expires before it
+    bool m_warmed; // libass rendered a frame for warmNextEvent since the last real one
+    bool m_shown_empty; // the last frame rendered for real had no images
+    bool m_owns_library; // false if the library belongs to another instance, see initLibraryShared
 };
 
+#ifdef __EMSCRIPTEN__
 int main(int argc, char *argv[]) { return 0; }
 
-#ifdef __EMSCRIPTEN__
 #include "./SubOctpInterface.cpp"
 #endif
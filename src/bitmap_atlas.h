@@ -0,0 +1,363 @@
+/*
+    SubtitleOctopus.js - bitmap atlas
+
+    Hands the bitmaps of libass to the main thread once and refers to them
+    by id afterwards, so a frame boils down to a list of draw commands plus
+    the bitmaps which were not sent before. A bitmap is recognized by its
+    pointer while libass keeps it from one frame to the next and by a hash
+    of its contents otherwise. Once the bitmaps held by the main thread
+    exceed a size limit, the least recently drawn ones are released.
+*/
+
+#ifndef SUBTITLESOCTOPUS_BITMAP_ATLAS_H
+#define SUBTITLESOCTOPUS_BITMAP_ATLAS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// words per draw command: id, x, y, colour
+#define ATLAS_COMMAND_WORDS 4
+// words per new bitmap: id, width, height, offset of its coverage in the pixels
+#define ATLAS_BITMAP_WORDS 4
+// bytes per pixel the main thread holds, an RGBA canvas with the coverage as alpha
+#define ATLAS_HELD_BYTES 4
+
+struct AtlasFrame {
+    int changed;
+    int reset;          // forget all bitmaps received so far before taking this frame
+    int command_count;
+    int32_t *commands;  // draw in order: bitmap id at x, y in libass colour
+    int bitmap_count;
+    int32_t *bitmaps;   // bitmaps sent for the first time
+    unsigned char *pixels; // coverage of the new bitmaps, width * height bytes each
+    int pixels_size;
+    int release_count;
+    int32_t *releases;  // ids not drawn any more, which may be reused by later frames
+};
+
+class BitmapAtlas {
+public:
+    BitmapAtlas(): m_entries(NULL), m_entry_count(0), m_entry_capacity(0),
+                   m_free(NULL), m_free_count(0), m_free_capacity(0), m_hash_slots(NULL), m_hash_capacity(0),
+                   m_pixel_capacity(0), m_command_capacity(0), m_bitmap_capacity(0), m_release_capacity(0),
+                   m_frame_no(0), m_bytes(0), m_limit(32 * 1024 * 1024), m_reset(true) {
+        memset(&m_frame, 0, sizeof(m_frame));
+        memset(m_pointers, 0, sizeof(m_pointers));
+    }
+
+    ~BitmapAtlas() {
+        free(m_entries);
+        free(m_free);
+        free(m_hash_slots);
+        free(m_pointers[0].keys);
+        free(m_pointers[0].values);
+        free(m_pointers[1].keys);
+        free(m_pointers[1].values);
+        free(m_frame.commands);
+        free(m_frame.bitmaps);
+        free(m_frame.pixels);
+        free(m_frame.releases);
+    }
+
+    /**
+     * \brief Limit the size of the bitmaps kept by the main thread
+     */
+    void setLimit(size_t bytes) {
+        m_limit = bytes;
+    }
+
+    /**
+     * \brief Forget every bitmap sent; the next frame tells the main thread to do the same
+     */
+    void reset() {
+        m_entry_count = m_free_count = 0;
+        m_bytes = 0;
+        forgetPointers();
+        if (m_hash_slots) memset(m_hash_slots, 0xff, sizeof(int) * m_hash_capacity);
+        m_reset = true;
+    }
+
+    /**
+     * \brief Stop matching bitmaps by pointer, as libass may have released them
+     */
+    void forgetPointers() {
+        m_pointers[0].count = m_pointers[1].count = 0;
+    }
+
+    /**
+     * \brief Frame telling that nothing changed
+     */
+    AtlasFrame* unchanged() {
+        m_frame.changed = m_frame.reset = 0;
+        m_frame.command_count = m_frame.bitmap_count = m_frame.release_count = 0;
+        m_frame.pixels_size = 0;
+        return &m_frame;
+    }
+
+    /**
+     * \brief Turn the images of a frame into draw commands and the bitmaps not sent yet
+     * \return frame valid until the next call; if memory ran out, an empty one
+     *         which resets the main thread
+     */
+    AtlasFrame* build(ASS_Image *img) {
+        m_frame_no++;
+        m_frame.changed = 1;
+        m_frame.reset = m_reset;
+        m_frame.command_count = m_frame.bitmap_count = m_frame.release_count = 0;
+        m_frame.pixels_size = 0;
+
+        int images = 0;
+        for (ASS_Image *cur = img; cur != NULL; cur = cur->next) images++;
+        // images of the previous frame are still alive, so their pointers can be trusted
+        PointerTable& prev = m_pointers[m_frame_no & 1];
+        PointerTable& now = m_pointers[(m_frame_no + 1) & 1];
+        if (!now.prepare(images) || !reserve((void**)&m_frame.commands, &m_command_capacity,
+                                             sizeof(int32_t) * ATLAS_COMMAND_WORDS * images)) {
+            return fail();
+        }
+
+        for (ASS_Image *cur = img; cur != NULL; cur = cur->next) {
+            if (cur->w == 0 || cur->h == 0) continue;
+            int entry = prev.find(cur->bitmap);
+            if (entry < 0 || !m_entries[entry].live || m_entries[entry].w != cur->w || m_entries[entry].h != cur->h) {
+                uint64_t hash = hashBitmap(cur);
+                entry = findHash(hash, cur->w, cur->h);
+                if (entry < 0) {
+                    entry = addBitmap(cur, hash);
+                    if (entry < 0) return fail();
+                }
+            }
+            m_entries[entry].last_used = m_frame_no;
+            now.insert(cur->bitmap, entry);
+
+            int32_t *command = m_frame.commands + ATLAS_COMMAND_WORDS * m_frame.command_count++;
+            command[0] = entry;
+            command[1] = cur->dst_x;
+            command[2] = cur->dst_y;
+            command[3] = (int32_t)cur->color;
+        }
+        prev.count = 0;
+
+        if (m_bytes > m_limit && !releaseOld()) return fail();
+        m_reset = false;
+        return &m_frame;
+    }
+
+private:
+    struct Entry {
+        uint64_t hash;
+        int w, h;
+        int last_used; // frame number
+        bool live;
+    };
+
+    /**
+     * Bitmap pointers of one frame, open addressing
+     */
+    struct PointerTable {
+        const unsigned char **keys;
+        int *values;
+        int capacity, count;
+
+        bool prepare(int images) {
+            count = 0;
+            int needed = 16;
+            while (needed < 2 * images) needed *= 2;
+            if (needed > capacity) {
+                free(keys);
+                free(values);
+                keys = (const unsigned char**)malloc(sizeof(*keys) * needed);
+                values = (int*)malloc(sizeof(int) * needed);
+                capacity = keys && values ? needed : 0;
+                if (!capacity) return false;
+            }
+            memset(keys, 0, sizeof(*keys) * capacity);
+            return true;
+        }
+
+        static size_t slot(const unsigned char *key) {
+            return (size_t)(((uintptr_t)key * 0x9E3779B97F4A7C15ULL) >> 32);
+        }
+
+        int find(const unsigned char *key) const {
+            if (count == 0) return -1;
+            for (size_t i = slot(key) & (capacity - 1);; i = (i + 1) & (capacity - 1)) {
+                if (keys[i] == NULL) return -1;
+                if (keys[i] == key) return values[i];
+            }
+        }
+
+        void insert(const unsigned char *key, int value) {
+            size_t i = slot(key) & (capacity - 1);
+            while (keys[i] != NULL && keys[i] != key) i = (i + 1) & (capacity - 1);
+            if (keys[i] == NULL) count++;
+            keys[i] = key;
+            values[i] = value;
+        }
+    };
+
+    static bool reserve(void **buffer, size_t *capacity, size_t size) {
+        if (size <= *capacity) return true;
+        size_t grown = *capacity * 2 > size ? *capacity * 2 : size;
+        void *resized = realloc(*buffer, grown);
+        if (!resized) return false;
+        *buffer = resized;
+        *capacity = grown;
+        return true;
+    }
+
+    AtlasFrame* fail() {
+        fprintf(stderr, "jso: cannot build bitmap atlas frame\n");
+        reset();
+        unchanged();
+        m_frame.changed = m_frame.reset = 1;
+        return &m_frame;
+    }
+
+    static uint64_t hashBitmap(const ASS_Image *img) {
+        // FNV-1a, 64-bit
+        uint64_t hash = 14695981039346656037ULL;
+        hash = (hash ^ (uint64_t)img->w) * 1099511628211ULL;
+        hash = (hash ^ (uint64_t)img->h) * 1099511628211ULL;
+        const unsigned char *row = img->bitmap;
+        for (int y = 0; y < img->h; y++, row += img->stride) {
+            for (int x = 0; x < img->w; x++) {
+                hash = (hash ^ row[x]) * 1099511628211ULL;
+            }
+        }
+        return hash;
+    }
+
+    int findHash(uint64_t hash, int w, int h) const {
+        if (m_hash_capacity == 0) return -1;
+        for (size_t i = (size_t)hash & (m_hash_capacity - 1);; i = (i + 1) & (m_hash_capacity - 1)) {
+            int entry = m_hash_slots[i];
+            if (entry < 0) return -1;
+            const Entry& e = m_entries[entry];
+            if (e.hash == hash && e.w == w && e.h == h) return entry;
+        }
+    }
+
+    void insertHash(int entry) {
+        size_t i = (size_t)m_entries[entry].hash & (m_hash_capacity - 1);
+        while (m_hash_slots[i] >= 0) i = (i + 1) & (m_hash_capacity - 1);
+        m_hash_slots[i] = entry;
+    }
+
+    /**
+     * \brief Rebuild the hash slots from the live entries, at least twice their number
+     */
+    bool rehash(int live) {
+        int capacity = 64;
+        while (capacity < 2 * live) capacity *= 2;
+        if (capacity != m_hash_capacity) {
+            int *slots = (int*)malloc(sizeof(int) * capacity);
+            if (!slots) return false;
+            free(m_hash_slots);
+            m_hash_slots = slots;
+            m_hash_capacity = capacity;
+        }
+        memset(m_hash_slots, 0xff, sizeof(int) * m_hash_capacity);
+        for (int i = 0; i < m_entry_count; i++) {
+            if (m_entries[i].live) insertHash(i);
+        }
+        return true;
+    }
+
+    int addBitmap(const ASS_Image *img, uint64_t hash) {
+        int live = m_entry_count - m_free_count + 1;
+        if (2 * live > m_hash_capacity && !rehash(live)) return -1;
+
+        int entry;
+        if (m_free_count > 0) {
+            entry = m_free[--m_free_count];
+        } else {
+            size_t capacity = m_entry_capacity * sizeof(Entry);
+            if (!reserve((void**)&m_entries, &capacity, sizeof(Entry) * (m_entry_count + 1))) return -1;
+            m_entry_capacity = (int)(capacity / sizeof(Entry));
+            entry = m_entry_count++;
+        }
+        size_t size = (size_t)img->w * img->h;
+        size_t offset = m_frame.pixels_size;
+        if (!reserve((void**)&m_frame.pixels, &m_pixel_capacity, offset + size) ||
+                !reserve((void**)&m_frame.bitmaps, &m_bitmap_capacity,
+                         sizeof(int32_t) * ATLAS_BITMAP_WORDS * (m_frame.bitmap_count + 1))) {
+            return -1;
+        }
+
+        Entry& e = m_entries[entry];
+        e.hash = hash;
+        e.w = img->w;
+        e.h = img->h;
+        e.live = true;
+        insertHash(entry);
+        m_bytes += size * ATLAS_HELD_BYTES;
+
+        // rows without stride padding
+        const unsigned char *row = img->bitmap;
+        for (int y = 0; y < img->h; y++, row += img->stride) {
+            memcpy(m_frame.pixels + offset + (size_t)y * img->w, row, img->w);
+        }
+        m_frame.pixels_size += (int)size;
+        int32_t *bitmap = m_frame.bitmaps + ATLAS_BITMAP_WORDS * m_frame.bitmap_count++;
+        bitmap[0] = entry;
+        bitmap[1] = img->w;
+        bitmap[2] = img->h;
+        bitmap[3] = (int32_t)offset;
+        return entry;
+    }
+
+    static int compareLastUsed(const void *a, const void *b) {
+        const int *x = (const int*)a, *y = (const int*)b;
+        return x[0] - y[0];
+    }
+
+    /**
+     * \brief Release the least recently drawn bitmaps until the limit is kept,
+     * except for the ones drawn in the current frame
+     */
+    bool releaseOld() {
+        int *order = (int*)malloc(sizeof(int) * 2 * (m_entry_count ? m_entry_count : 1));
+        if (!order) return false;
+        int candidates = 0;
+        for (int i = 0; i < m_entry_count; i++) {
+            if (!m_entries[i].live || m_entries[i].last_used == m_frame_no) continue;
+            order[2 * candidates] = m_entries[i].last_used;
+            order[2 * candidates + 1] = i;
+            candidates++;
+        }
+        qsort(order, candidates, 2 * sizeof(int), compareLastUsed);
+
+        bool ok = reserve((void**)&m_free, &m_free_capacity, sizeof(int) * m_entry_capacity) &&
+                  reserve((void**)&m_frame.releases, &m_release_capacity, sizeof(int32_t) * (candidates ? candidates : 1));
+        for (int i = 0; ok && i < candidates && m_bytes > m_limit; i++) {
+            Entry& e = m_entries[order[2 * i + 1]];
+            e.live = false;
+            m_bytes -= (size_t)e.w * e.h * ATLAS_HELD_BYTES;
+            m_free[m_free_count++] = order[2 * i + 1];
+            m_frame.releases[m_frame.release_count++] = order[2 * i + 1];
+        }
+        free(order);
+        // a released bitmap may still be in the pointer table of this frame
+        return ok && rehash(m_entry_count - m_free_count);
+    }
+
+    Entry *m_entries;
+    int m_entry_count, m_entry_capacity;
+    int *m_free; // released entries, their ids are given out again
+    int m_free_count;
+    size_t m_free_capacity; // in bytes, like the other capacities given to reserve
+    int *m_hash_slots; // entries by content hash, open addressing, -1 - empty
+    int m_hash_capacity;
+    PointerTable m_pointers[2]; // bitmap pointers of the previous and the current frame
+    size_t m_pixel_capacity, m_command_capacity, m_bitmap_capacity, m_release_capacity;
+    AtlasFrame m_frame;
+    int m_frame_no;
+    size_t m_bytes; // size of the bitmaps the main thread holds
+    size_t m_limit;
+    bool m_reset;
+};
+
+#endif // SUBTITLESOCTOPUS_BITMAP_ATLAS_H
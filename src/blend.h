@@ -0,0 +1,203 @@
+/*
+    SubtitleOctopus.js - integer compositing kernels
+
+    Blending happens in a planar scratch buffer holding premultiplied
+    R, G, B and A planes as Q15 fixed point values (0..32767 ~ 0.0..1.0).
+    All images from libass are single coloured alpha masks, so compositing
+    one image row boils down to a handful of 16-bit multiply-high operations
+    which map directly onto SIMD instructions:
+      - wasm SIMD128 (build with -msimd128)
+      - SSSE3 on x86 (needs -mssse3 or better)
+      - NEON on ARM
+    Without any of those a scalar implementation of the very same math is
+    used, so all variants produce bit-identical results.
+    Define OCTP_BLEND_NO_SIMD to force the scalar implementation.
+*/
+
+#ifndef SUBTITLESOCTOPUS_BLEND_H
+#define SUBTITLESOCTOPUS_BLEND_H
+
+#include <stdint.h>
+
+#if !defined(OCTP_BLEND_NO_SIMD) && defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#define OCTP_BLEND_WASM_SIMD 1
+#elif !defined(OCTP_BLEND_NO_SIMD) && defined(__SSSE3__)
+#include <tmmintrin.h>
+#define OCTP_BLEND_SSSE3 1
+#elif !defined(OCTP_BLEND_NO_SIMD) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define OCTP_BLEND_NEON 1
+#endif
+
+#define Q15_ONE 32767
+
+// alpha below this (0.9 / 255 in Q15) is treated as fully transparent
+#define Q15_MIN_ALPHA 116
+
+/**
+ * \brief Name of the compositing implementation chosen at build time
+ */
+static inline const char *blend_kernel_name() {
+#if defined(OCTP_BLEND_WASM_SIMD)
+    return "wasm-simd128";
+#elif defined(OCTP_BLEND_SSSE3)
+    return "ssse3";
+#elif defined(OCTP_BLEND_NEON)
+    return "neon";
+#else
+    return "scalar";
+#endif
+}
+
+/**
+ * \brief Convert 8-bit value to Q15, 255 maps to Q15_ONE
+ */
+static inline int16_t u8_to_q15(int value) {
+    return (int16_t)((value * Q15_ONE + 127) / 255);
+}
+
+/**
+ * \brief Rounding Q15 multiplication, same as pmulhrsw / q15mulr / vqrdmulh
+ * for the non-negative values used here
+ */
+static inline int16_t q15_mul(int16_t x, int16_t y) {
+    return (int16_t)(((int32_t)x * y + 0x4000) >> 15);
+}
+
+/**
+ * \brief Fast 8-bit to Q15 conversion of bitmap coverage: v * 128.5
+ */
+static inline int16_t coverage_to_q15(unsigned char v) {
+    return (int16_t)((v << 7) + (v >> 1));
+}
+
+static inline void blend_pixel_q15(int16_t *dst_r, int16_t *dst_g, int16_t *dst_b, int16_t *dst_a,
+                                   unsigned char coverage, int16_t r, int16_t g, int16_t b, int16_t a) {
+    int16_t pix_alpha = q15_mul(coverage_to_q15(coverage), a);
+    *dst_a += q15_mul(Q15_ONE - *dst_a, pix_alpha);
+    *dst_r += q15_mul(r - *dst_r, pix_alpha);
+    *dst_g += q15_mul(g - *dst_g, pix_alpha);
+    *dst_b += q15_mul(b - *dst_b, pix_alpha);
+}
+
+/**
+ * \brief Composite one row of an alpha mask over premultiplied Q15 planes
+ *
+ * The "over" operator is evaluated as a lerp, dst += (src - dst) * alpha,
+ * which needs one multiplication per channel and keeps dst untouched
+ * wherever the mask is empty.
+ * \param dst_r, dst_g, dst_b, dst_a destination plane rows
+ * \param src   coverage row of the libass bitmap
+ * \param width number of pixels in the row
+ * \param r, g, b, a colour and opacity of the image in Q15
+ */
+static void blend_row_q15(int16_t *dst_r, int16_t *dst_g, int16_t *dst_b, int16_t *dst_a,
+                          const unsigned char *src, int width,
+                          int16_t r, int16_t g, int16_t b, int16_t a) {
+    int x = 0;
+#if defined(OCTP_BLEND_WASM_SIMD)
+    const v128_t v_one = wasm_i16x8_splat(Q15_ONE);
+    const v128_t v_a = wasm_i16x8_splat(a), v_r = wasm_i16x8_splat(r);
+    const v128_t v_g = wasm_i16x8_splat(g), v_b = wasm_i16x8_splat(b);
+    #define BLEND_CHANNEL(dst, value) do { \
+        v128_t d = wasm_v128_load((dst) + x); \
+        d = wasm_i16x8_add(d, wasm_i16x8_q15mulr_sat(wasm_i16x8_sub((value), d), pix_alpha)); \
+        wasm_v128_store((dst) + x, d); \
+    } while (0)
+    for (; x + 8 <= width; x += 8) {
+        v128_t m = wasm_u16x8_load8x8(src + x);
+        m = wasm_i16x8_add(wasm_i16x8_shl(m, 7), wasm_u16x8_shr(m, 1));
+        v128_t pix_alpha = wasm_i16x8_q15mulr_sat(m, v_a);
+        BLEND_CHANNEL(dst_a, v_one);
+        BLEND_CHANNEL(dst_r, v_r);
+        BLEND_CHANNEL(dst_g, v_g);
+        BLEND_CHANNEL(dst_b, v_b);
+    }
+    #undef BLEND_CHANNEL
+#elif defined(OCTP_BLEND_SSSE3)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i v_one = _mm_set1_epi16(Q15_ONE);
+    const __m128i v_a = _mm_set1_epi16(a), v_r = _mm_set1_epi16(r);
+    const __m128i v_g = _mm_set1_epi16(g), v_b = _mm_set1_epi16(b);
+    #define BLEND_CHANNEL(dst, value) do { \
+        __m128i d = _mm_loadu_si128((const __m128i*)((dst) + x)); \
+        d = _mm_add_epi16(d, _mm_mulhrs_epi16(_mm_sub_epi16((value), d), pix_alpha)); \
+        _mm_storeu_si128((__m128i*)((dst) + x), d); \
+    } while (0)
+    for (; x + 8 <= width; x += 8) {
+        __m128i m = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(src + x)), zero);
+        m = _mm_add_epi16(_mm_slli_epi16(m, 7), _mm_srli_epi16(m, 1));
+        __m128i pix_alpha = _mm_mulhrs_epi16(m, v_a);
+        BLEND_CHANNEL(dst_a, v_one);
+        BLEND_CHANNEL(dst_r, v_r);
+        BLEND_CHANNEL(dst_g, v_g);
+        BLEND_CHANNEL(dst_b, v_b);
+    }
+    #undef BLEND_CHANNEL
+#elif defined(OCTP_BLEND_NEON)
+    const int16x8_t v_one = vdupq_n_s16(Q15_ONE);
+    const int16x8_t v_a = vdupq_n_s16(a), v_r = vdupq_n_s16(r);
+    const int16x8_t v_g = vdupq_n_s16(g), v_b = vdupq_n_s16(b);
+    #define BLEND_CHANNEL(dst, value) do { \
+        int16x8_t d = vld1q_s16((dst) + x); \
+        vst1q_s16((dst) + x, vaddq_s16(d, vqrdmulhq_s16(vsubq_s16((value), d), pix_alpha))); \
+    } while (0)
+    for (; x + 8 <= width; x += 8) {
+        uint16x8_t m16 = vmovl_u8(vld1_u8(src + x));
+        int16x8_t m = vreinterpretq_s16_u16(vaddq_u16(vshlq_n_u16(m16, 7), vshrq_n_u16(m16, 1)));
+        int16x8_t pix_alpha = vqrdmulhq_s16(m, v_a);
+        BLEND_CHANNEL(dst_a, v_one);
+        BLEND_CHANNEL(dst_r, v_r);
+        BLEND_CHANNEL(dst_g, v_g);
+        BLEND_CHANNEL(dst_b, v_b);
+    }
+    #undef BLEND_CHANNEL
+#endif
+    for (; x < width; x++) {
+        if (src[x] == 0) continue;
+        blend_pixel_q15(dst_r + x, dst_g + x, dst_b + x, dst_a + x, src[x], r, g, b, a);
+    }
+}
+
+/**
+ * \brief Un-premultiply one row of Q15 planes into packed 8-bit RGBA
+ */
+static void pack_row_rgba(const int16_t *src_r, const int16_t *src_g, const int16_t *src_b,
+                          const int16_t *src_a, unsigned int *dst, int width) {
+    for (int x = 0; x < width; x++) {
+        int alpha = src_a[x];
+        if (alpha < Q15_MIN_ALPHA) {
+            dst[x] = 0;
+            continue;
+        }
+        // a single division per pixel, the rest is a multiply and shift;
+        // premultiplied colour can never exceed alpha, which keeps results <= 255
+        unsigned int scale = (255u << 16) / (unsigned int)alpha;
+        unsigned int r = ((src_r[x] < alpha ? src_r[x] : alpha) * scale) >> 16;
+        unsigned int g = ((src_g[x] < alpha ? src_g[x] : alpha) * scale) >> 16;
+        unsigned int b = ((src_b[x] < alpha ? src_b[x] : alpha) * scale) >> 16;
+        unsigned int a = (alpha * 255) / Q15_ONE;
+        dst[x] = r | (g << 8) | (b << 16) | (a << 24);
+    }
+}
+
+/**
+ * \brief Convert one row of Q15 planes into packed premultiplied 8-bit RGBA
+ * Ready for WebGL textures, no division involved, so compilers vectorize it.
+ */
+static void pack_row_rgba_premultiplied(const int16_t *src_r, const int16_t *src_g, const int16_t *src_b,
+                                        const int16_t *src_a, unsigned int *dst, int width) {
+    for (int x = 0; x < width; x++) {
+        int alpha = src_a[x];
+        if (alpha < Q15_MIN_ALPHA) alpha = 0;
+        // colour must not exceed alpha, same as in pack_row_rgba
+        unsigned int r = ((src_r[x] < alpha ? src_r[x] : alpha) * 255u + (Q15_ONE >> 1)) >> 15;
+        unsigned int g = ((src_g[x] < alpha ? src_g[x] : alpha) * 255u + (Q15_ONE >> 1)) >> 15;
+        unsigned int b = ((src_b[x] < alpha ? src_b[x] : alpha) * 255u + (Q15_ONE >> 1)) >> 15;
+        unsigned int a = ((unsigned int)alpha * 255u + (Q15_ONE >> 1)) >> 15;
+        dst[x] = r | (g << 8) | (b << 16) | (a << 24);
+    }
+}
+
+#endif // SUBTITLESOCTOPUS_BLEND_H
@@ -0,0 +1,380 @@
+/*
+    SubtitleOctopus.js - event interval index
+
+    Events are kept in an array sorted by start time which doubles as an
+    implicit balanced binary tree: the node of a range [lo, hi) is its middle
+    element and every node stores the latest finish time of its subtree.
+    This answers "what is displayed at time t" in O(log n + k) and
+    "what starts next after t" in O(log n), instead of scanning the track.
+
+    New events are allocated before JS fills in their timing, so they are
+    only queued on add() and merged into the index on the next query.
+    Changes are noted the same way: an updated event is marked stale and
+    queued again, and a removal shifts the ids of the events after it, so
+    it has the index rebuilt. Any number of changes between two queries,
+    like a track batch, costs a single pass over the index.
+*/
+
+#ifndef SUBTITLESOCTOPUS_EVENT_INDEX_H
+#define SUBTITLESOCTOPUS_EVENT_INDEX_H
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct EventIndexEntry {
+    long long start, finish;
+    long long max_finish; // latest finish in the implicit subtree
+    int event;
+};
+
+class EventIndex {
+public:
+    EventIndex(): m_track(NULL), m_entries(NULL), m_count(0), m_capacity(0),
+                  m_pending(NULL), m_pending_count(0), m_pending_capacity(0),
+                  m_stale(NULL), m_stale_count(0), m_stale_capacity(0), m_dirty(false) {}
+
+    ~EventIndex() {
+        free(m_entries);
+        free(m_pending);
+        free(m_stale);
+    }
+
+    void clear() {
+        m_count = 0;
+        m_pending_count = 0;
+        m_stale_count = 0;
+        m_dirty = false;
+    }
+
+    /**
+     * \brief Index all events of the track from scratch
+     */
+    void build(ASS_Track *track) {
+        clear();
+        m_track = track;
+        if (!track) return;
+        if (!reserve(track->n_events)) {
+            m_dirty = true; // retry on the next query
+            return;
+        }
+
+        for (int i = 0; i < track->n_events; i++) {
+            fillEntry(m_entries + i, i);
+        }
+        m_count = track->n_events;
+        if (m_count > 1) qsort(m_entries, m_count, sizeof(EventIndexEntry), compareEntries);
+        updateMaxFinish(0, m_count);
+    }
+
+    /**
+     * \brief Index all events of the track in an order known to be sorted by start time
+     * Falls back to build() if `order` does not match the track.
+     * \param order event ids sorted by start time, one for every event
+     */
+    void buildSorted(ASS_Track *track, const int *order) {
+        clear();
+        m_track = track;
+        if (!track) return;
+        if (!reserve(track->n_events)) {
+            m_dirty = true;
+            return;
+        }
+
+        for (int i = 0; i < track->n_events; i++) {
+            if (order[i] < 0 || order[i] >= track->n_events) {
+                build(track);
+                return;
+            }
+            fillEntry(m_entries + i, order[i]);
+            // ties are ordered by id, so this also rejects duplicates
+            if (i > 0 && compareEntries(m_entries + i - 1, m_entries + i) >= 0) {
+                build(track);
+                return;
+            }
+        }
+        m_count = track->n_events;
+        updateMaxFinish(0, m_count);
+    }
+
+    /**
+     * \brief Store the ids of all indexed events sorted by start time
+     * \param order room for one id per event of the track
+     * \return number of ids stored
+     */
+    int sortedEvents(int *order) {
+        sync();
+        for (int i = 0; i < m_count; i++) {
+            order[i] = m_entries[i].event;
+        }
+        return m_count;
+    }
+
+    /**
+     * \brief Queue a freshly allocated event, its timing is read on the next query
+     */
+    void add(int eid) {
+        // if it cannot be queued, fall back to a full rebuild on the next query
+        if (!queue(&m_pending, &m_pending_count, &m_pending_capacity, eid)) m_dirty = true;
+    }
+
+    /**
+     * \brief Forget an event; events after it are expected to move down by one
+     * That renumbers most entries, so they are rebuilt on the next query.
+     */
+    void remove(int eid) {
+        (void)eid;
+        m_dirty = true;
+    }
+
+    /**
+     * \brief Forget many events at once
+     * \param remap new id of every event of the track, -1 for removed ones; ids
+     *              have to keep their order, so the entries stay sorted
+     */
+    void compact(const int *remap) {
+        if (m_dirty) return; // rebuilt from the track anyway
+        int kept = 0;
+        for (int i = 0; i < m_count; i++) {
+            int eid = remap[m_entries[i].event];
+            if (eid < 0) continue;
+            m_entries[kept] = m_entries[i];
+            m_entries[kept++].event = eid;
+        }
+        bool removed = kept != m_count;
+        m_count = kept;
+
+        kept = 0;
+        for (int i = 0; i < m_pending_count; i++) {
+            if (remap[m_pending[i]] >= 0) m_pending[kept++] = remap[m_pending[i]];
+        }
+        m_pending_count = kept;
+
+        kept = 0;
+        for (int i = 0; i < m_stale_count; i++) {
+            if (remap[m_stale[i]] >= 0) m_stale[kept++] = remap[m_stale[i]];
+        }
+        m_stale_count = kept;
+
+        if (removed) updateMaxFinish(0, m_count);
+    }
+
+    /**
+     * \brief Re-read timing of an event which was modified in place, on the next query
+     */
+    void update(int eid) {
+        if (m_dirty) return;
+        if (!queue(&m_stale, &m_stale_count, &m_stale_capacity, eid)) {
+            m_dirty = true;
+            return;
+        }
+        add(eid);
+    }
+
+    /**
+     * \brief Start time of the first event starting strictly after `now`, -1 if none
+     */
+    long long nextStart(long long now) {
+        sync();
+        int lo = 0, hi = m_count;
+        while (lo < hi) {
+            int mid = lo + (hi - lo) / 2;
+            if (m_entries[mid].start <= now) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo < m_count ? m_entries[lo].start : -1;
+    }
+
+    /**
+     * \brief Call visitor(event, start, finish) for each event displayed at `now`,
+     * i.e. start <= now < finish; stops early when the visitor returns false
+     */
+    template <class Visitor>
+    void forEachActive(long long now, Visitor& visitor) {
+        sync();
+        visitActive(0, m_count, now, visitor);
+    }
+
+    /**
+     * \brief Call visitor(event, start, finish) for each event displayed at some
+     * point of [from, to), i.e. start < to && finish > from; stops early when
+     * the visitor returns false
+     */
+    template <class Visitor>
+    void forEachInRange(long long from, long long to, Visitor& visitor) {
+        sync();
+        visitRange(0, m_count, from, to, visitor);
+    }
+
+private:
+    static int compareEntries(const void *a, const void *b) {
+        const EventIndexEntry *ea = (const EventIndexEntry*)a, *eb = (const EventIndexEntry*)b;
+        if (ea->start != eb->start) return ea->start < eb->start ? -1 : 1;
+        return ea->event - eb->event;
+    }
+
+    bool reserve(int count) {
+        if (count <= m_capacity) return true;
+        int capacity = m_capacity ? m_capacity : 64;
+        while (capacity < count) capacity *= 2;
+        EventIndexEntry *entries = (EventIndexEntry*)realloc(m_entries, sizeof(EventIndexEntry) * capacity);
+        if (!entries) {
+            fprintf(stderr, "jso: cannot allocate event index\n");
+            return false;
+        }
+        m_entries = entries;
+        m_capacity = capacity;
+        return true;
+    }
+
+    static bool queue(int **list, int *count, int *capacity, int eid) {
+        if (*count == *capacity) {
+            int grown = *capacity ? *capacity * 2 : 16;
+            int *resized = (int*)realloc(*list, sizeof(int) * grown);
+            if (!resized) return false;
+            *list = resized;
+            *capacity = grown;
+        }
+        (*list)[(*count)++] = eid;
+        return true;
+    }
+
+    void fillEntry(EventIndexEntry *entry, int eid) const {
+        ASS_Event *event = m_track->events + eid;
+        entry->start = event->Start;
+        entry->finish = event->Start + event->Duration;
+        entry->event = eid;
+    }
+
+    /**
+     * \brief Take the entries of stale events out and queue each of them once
+     * \return false if out of memory
+     */
+    bool dropStale() {
+        // bit 1: stale, bit 2: already queued
+        unsigned char *marks = (unsigned char*)calloc(m_track->n_events ? m_track->n_events : 1, 1);
+        if (!marks) return false;
+        for (int i = 0; i < m_stale_count; i++) {
+            marks[m_stale[i]] |= 1;
+        }
+        m_stale_count = 0;
+
+        int kept = 0;
+        for (int i = 0; i < m_count; i++) {
+            if (!(marks[m_entries[i].event] & 1)) m_entries[kept++] = m_entries[i];
+        }
+        m_count = kept;
+
+        kept = 0;
+        for (int i = 0; i < m_pending_count; i++) {
+            if (marks[m_pending[i]] & 2) continue;
+            marks[m_pending[i]] |= 2;
+            m_pending[kept++] = m_pending[i];
+        }
+        m_pending_count = kept;
+        free(marks);
+        return true;
+    }
+
+    /**
+     * \brief Merge queued events into the sorted array
+     */
+    void sync() {
+        if (m_stale_count && !m_dirty && !dropStale()) m_dirty = true;
+        if (m_dirty) {
+            build(m_track);
+            return;
+        }
+        if (m_pending_count == 0) return;
+        if (!reserve(m_count + m_pending_count)) {
+            m_dirty = true;
+            return;
+        }
+
+        // sort the new entries and merge them in from the back
+        EventIndexEntry *added = m_entries + m_count;
+        for (int i = 0; i < m_pending_count; i++) {
+            fillEntry(added + i, m_pending[i]);
+        }
+        qsort(added, m_pending_count, sizeof(EventIndexEntry), compareEntries);
+
+        if (m_pending_count == 1) {
+            EventIndexEntry entry = *added;
+            int pos = m_count;
+            while (pos > 0 && compareEntries(m_entries + pos - 1, &entry) > 0) pos--;
+            memmove(m_entries + pos + 1, m_entries + pos, sizeof(EventIndexEntry) * (m_count - pos));
+            m_entries[pos] = entry;
+        } else {
+            EventIndexEntry *tmp = (EventIndexEntry*)malloc(sizeof(EventIndexEntry) * m_pending_count);
+            if (!tmp) {
+                m_dirty = true;
+                sync();
+                return;
+            }
+            memcpy(tmp, added, sizeof(EventIndexEntry) * m_pending_count);
+            int i = m_count - 1, j = m_pending_count - 1, out = m_count + m_pending_count - 1;
+            while (j >= 0) {
+                if (i >= 0 && compareEntries(m_entries + i, tmp + j) > 0) {
+                    m_entries[out--] = m_entries[i--];
+                } else {
+                    m_entries[out--] = tmp[j--];
+                }
+            }
+            free(tmp);
+        }
+
+        m_count += m_pending_count;
+        m_pending_count = 0;
+        updateMaxFinish(0, m_count);
+    }
+
+    long long updateMaxFinish(int lo, int hi) {
+        if (lo >= hi) return LLONG_MIN;
+        int mid = lo + (hi - lo) / 2;
+        long long max_finish = m_entries[mid].finish;
+        long long left = updateMaxFinish(lo, mid), right = updateMaxFinish(mid + 1, hi);
+        if (left > max_finish) max_finish = left;
+        if (right > max_finish) max_finish = right;
+        m_entries[mid].max_finish = max_finish;
+        return max_finish;
+    }
+
+    template <class Visitor>
+    bool visitActive(int lo, int hi, long long now, Visitor& visitor) {
+        while (lo < hi) {
+            int mid = lo + (hi - lo) / 2;
+            const EventIndexEntry& entry = m_entries[mid];
+            if (entry.max_finish <= now) return true; // everything below is already over
+            if (!visitActive(lo, mid, now, visitor)) return false;
+            if (entry.start > now) return true; // everything to the right starts later
+            if (entry.finish > now && !visitor(entry.event, entry.start, entry.finish)) return false;
+            lo = mid + 1;
+        }
+        return true;
+    }
+
+    template <class Visitor>
+    bool visitRange(int lo, int hi, long long from, long long to, Visitor& visitor) {
+        while (lo < hi) {
+            int mid = lo + (hi - lo) / 2;
+            const EventIndexEntry& entry = m_entries[mid];
+            if (entry.max_finish <= from) return true;
+            if (!visitRange(lo, mid, from, to, visitor)) return false;
+            if (entry.start >= to) return true;
+            if (entry.finish > from && !visitor(entry.event, entry.start, entry.finish)) return false;
+            lo = mid + 1;
+        }
+        return true;
+    }
+
+    ASS_Track *m_track;
+    EventIndexEntry *m_entries;
+    int m_count, m_capacity;
+    int *m_pending;
+    int m_pending_count, m_pending_capacity;
+    int *m_stale; // events whose entries are out of date, queued again in m_pending
+    int m_stale_count, m_stale_capacity;
+    bool m_dirty;
+};
+
+#endif // SUBTITLESOCTOPUS_EVENT_INDEX_H
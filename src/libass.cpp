@@ -2,7 +2,11 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
+#ifdef OCTP_NATIVE
+#include <ass/ass.h>
+#else
 #include "../lib/libass/libass/ass.h"
+#endif
 
 /**
  * This class is a wrapper for Emscripten WebIDL for interface with Javascript
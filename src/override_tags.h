@@ -0,0 +1,79 @@
+/*
+    SubtitleOctopus.js - override tag scanner
+
+    Hands out the tags of the closed override blocks {...} of an event text
+    in one pass, as libass reads them: a block opens at the first { not
+    escaped by a backslash and closes at the next }. A tag runs from its
+    backslash to the next backslash or the end of the block, so the tags
+    nested in \t(...) come out on their own after the \t itself.
+
+    Text outside of blocks is skipped with memchr instead of being looked
+    at one character at a time; libc searches several bytes per step.
+*/
+
+#ifndef SUBTITLESOCTOPUS_OVERRIDE_TAGS_H
+#define SUBTITLESOCTOPUS_OVERRIDE_TAGS_H
+
+#include <string.h>
+
+struct OverrideTag {
+    char *name; // first character after the backslash
+    char *end;  // last character of the tag, before name if it is empty
+};
+
+class OverrideTagScanner {
+public:
+    /**
+     * \param text event text; tags may be overwritten in place while scanning,
+     *             as long as no {, } or backslash is written
+     */
+    OverrideTagScanner(char *text):
+        m_text(text), m_end(text ? text + strlen(text) : NULL), m_pos(text), m_block_end(NULL), m_tag(NULL) {}
+
+    /**
+     * \brief Step to the next tag
+     * \return false once there are no more
+     */
+    bool next(OverrideTag *tag) {
+        while (m_block_end || nextBlock()) {
+            if (m_tag) {
+                char *following = (char*)memchr(m_tag + 1, '\\', m_block_end - m_tag - 1);
+                tag->name = m_tag + 1;
+                tag->end = (following ? following : m_block_end) - 1;
+                m_tag = following;
+                return true;
+            }
+            m_pos = m_block_end + 1;
+            m_block_end = NULL;
+        }
+        return false;
+    }
+
+private:
+    bool nextBlock() {
+        while (m_pos && m_pos < m_end) {
+            char *open = (char*)memchr(m_pos, '{', m_end - m_pos);
+            if (!open) break;
+            m_pos = open + 1;
+            // escaping { is a libass extension, VSFilter would open a block
+            if (open != m_text && open[-1] == '\\') continue;
+            char *close = (char*)memchr(open + 1, '}', m_end - open - 1);
+            if (!close) break;
+            m_pos = close + 1;
+            if (close - open <= 2) continue; // too short for a tag
+            m_block_end = close;
+            m_tag = (char*)memchr(open + 1, '\\', close - open - 1);
+            return true;
+        }
+        m_pos = m_end;
+        return false;
+    }
+
+    char *m_text;
+    char *m_end;
+    char *m_pos;       // where to look for the next block
+    char *m_block_end; // closing } of the current block, NULL between blocks
+    char *m_tag;       // backslash of the next tag in the block, NULL if none is left
+};
+
+#endif // SUBTITLESOCTOPUS_OVERRIDE_TAGS_H
@@ -8,8 +8,31 @@ self.nextIsRaf = false;
 self.lastCurrentTimeReceivedAt = Date.now();
 self.targetFps = 24;
 self.libassMemoryLimit = 0; // in MiB
+self.blendMemoryLimit = 0; // in MiB, for all blending buffers together; 0 - no limit
 self.renderOnDemand = false; // determines if only rendering on demand
 self.dropAllAnimations = false; // set to true to enable "lite mode" with all animations disabled for speed
+self.incrementalBlend = false; // set to true to only send regions which changed since the previous frame
+self.sharedFrames = false; // set to true to let the main thread read frames from the shared heap
+self.premultipliedAlpha = false; // set to true to blend into premultiplied RGBA, as the WebGL compositor of the main thread takes it
+self.atlasLimit = 0; // in MiB, size of the bitmaps the main thread keeps in 'atlas' renderMode; 0 - default
+self.liveWindow = 0; // in seconds, events which finished longer ago are evicted; 0 - keep all events
+self.compactFrames = false; // set to true to send render ahead frames span encoded, see src/span_codec.h
+self.warmAhead = 0; // how many upcoming events are rendered into the caches of libass while idle; 0 - none
+self.warmState = {timer: 0, from: -1, until: -1, count: 0}; // (internal) progress of warmEvents
+self.frameRing = 0; // (internal) address of the frame ring when frames are shared
+self.frameRingBuffer = null; // (internal) heap buffer last sent to the main thread
+self.oneshotChunk = null; // (internal) part of the timeline being rendered ahead, see oneshotRenderChunk
+self.trackStream = null; // (internal) track download in progress, see setTrackStream
+self.lazyFonts = false; // load fonts from availableFonts only shortly before an event uses them
+self.lazyFontsLookahead = 10; // how many seconds ahead fonts are loaded with lazyFonts
+self.lazyFontsLimit = 0; // in MiB, unused lazily loaded fonts are dropped above it; 0 - no limit
+self.lazyFontsWindow = null; // (internal) [start, end) of the timeline whose fonts are loaded
+self.lazyFontsLoaded = {}; // (internal) size of every lazily loaded font by its key
+self.lazyFontsSize = 0; // (internal) total size of lazily loaded fonts
+self.qualityLevel = 0; // (internal) degradation level set by the quality governor of the main thread
+self.qualityLookahead = 10; // how many seconds ahead animations are dropped at quality level 3
+self.qualityWindow = null; // (internal) [start, end) of the timeline whose animations are dropped
+self.tracks = {}; // (internal) tracks rendered for other SubtitlesOctopus instances by their id, see TrackPlayer
 
 self.width = 0;
 self.height = 0;
@@ -18,50 +41,142 @@ self.fontMap_ = {};
 self.fontId = 0;
 
 /**
- * Make the font accessible by libass by writing it to the virtual FS.
+ * Key of a font name in availableFonts.
  * @param {!string} font the font name.
+ * @returns {string} the key.
  */
-self.writeFontToFS = function(font) {
+self.fontKey = function (font) {
     font = font.trim().toLowerCase();
 
     if (font.startsWith("@")) {
         font = font.substr(1);
     }
+    return font;
+};
 
-    if (self.fontMap_.hasOwnProperty(font)) return;
-
-    self.fontMap_[font] = true;
+/**
+ * Make sure that the fonts of all events from `time` to lazyFontsLookahead
+ * seconds later are registered with libass when lazyFonts is enabled.
+ * @param {number} time the time about to be rendered.
+ */
+self.ensureFonts = function (time) {
+    if (!self.lazyFonts || !self.octObj.track.ptr) return;
+
+    var range = self.lazyFontsWindow;
+    // look further ahead again once half of the window has passed
+    if (range && time >= range[0] && time < (range[0] + range[1]) / 2) return;
+    self.lazyFontsWindow = range = [time, time + self.lazyFontsLookahead];
+
+    var names = self.octObj.getFontsInRange(range[0], range[1]);
+    var needed = {};
+    var missing = [];
+    names.split('\n').forEach(function (name) {
+        var font = self.fontKey(name);
+        if (!font || needed.hasOwnProperty(font) || !self.availableFonts.hasOwnProperty(font)) return;
+        needed[font] = true;
+        if (!self.lazyFontsLoaded.hasOwnProperty(font)) missing.push(font);
+    });
+    if (missing.length === 0) return;
 
-    if (!self.availableFonts.hasOwnProperty(font)) return;
-    var content = readBinary(self.availableFonts[font]);
+    var fonts = missing.map(function (font) {
+        return {key: font, data: readBinary(self.availableFonts[font])};
+    });
+    var size = fonts.reduce(function (size, font) {
+        return size + font.data.length;
+    }, 0);
+    if (self.lazyFontsLimit > 0 && self.lazyFontsSize + size > self.lazyFontsLimit * 1024 * 1024) {
+        // libass can only drop all memory fonts at once, so keep the ones needed now
+        console.info('dropping lazily loaded fonts');
+        self.octObj.clearFonts();
+        var kept = Object.keys(self.lazyFontsLoaded).filter(function (font) {
+            return needed.hasOwnProperty(font);
+        });
+        self.lazyFontsLoaded = {};
+        self.lazyFontsSize = 0;
+        fonts = fonts.concat(kept.map(function (font) {
+            return {key: font, data: readBinary(self.availableFonts[font])};
+        }));
+    }
 
-    Module["FS"].writeFile('/fonts/font' + (self.fontId++) + '-' + self.availableFonts[font].split('/').pop(), content, {
-        encoding: 'binary'
+    fonts.forEach(function (font) {
+        var data = new Uint8Array(font.data);
+        var ptr = Module._malloc(data.length);
+        HEAPU8.set(data, ptr);
+        self.octObj.addFont(font.key, ptr, data.length);
+        Module._free(ptr);
+        self.lazyFontsLoaded[font.key] = data.length;
+        self.lazyFontsSize += data.length;
     });
+    // memory fonts are only picked up when the fonts are set up
+    self.reloadFonts();
 };
 
 /**
- * Write all font's mentioned in the .ass file to the virtual FS.
- * @param {!string} content the file content.
+ * Set up the fonts of all renderers again. They share one library, whose
+ * memory fonts every renderer refers to, and one font directory.
  */
-self.writeAvailableFontsToFS = function(content) {
-    if (!self.availableFonts) return;
+self.reloadFonts = function () {
+    self.octObj.reloadFonts();
+    for (var id in self.tracks) {
+        self.tracks[id].octObj.reloadFonts();
+    }
+};
 
-    var sections = parseAss(content);
+/**
+ * Frame rate animated events are rendered at; halved from quality level 2 on.
+ */
+self.animationFps = function () {
+    return self.qualityLevel >= 2 ? self.targetFps / 2 : self.targetFps;
+};
 
-    for (var i = 0; i < sections.length; i++) {
-        for (var j = 0; j < sections[i].body.length; j++) {
-            if (sections[i].body[j].key === 'Style') {
-                self.writeFontToFS(sections[i].body[j].value['Fontname']);
-            }
-        }
-    }
+/**
+ * Drop animations of the events from `time` to qualityLookahead seconds
+ * later when the quality governor reached level 3.
+ * @param {number} time the time about to be rendered.
+ */
+self.ensureQuality = function (time) {
+    if (self.qualityLevel < 3 || !self.octObj.track.ptr) return;
+
+    var range = self.qualityWindow;
+    if (range && time >= range[0] && time < (range[0] + range[1]) / 2) return;
+    self.qualityWindow = range = [time, time + self.qualityLookahead];
+    self.octObj.dropAnimationsInRange(range[0], range[1]);
+};
 
-    var regex = /\\fn([^\\}]*?)[\\}]/g;
-    var matches;
-    while (matches = regex.exec(self.subContent)) {
-        self.writeFontToFS(matches[1]);
+/**
+ * Apply a degradation level chosen by the quality governor of the main thread:
+ * 0 - full quality, 1 - lower resolution (done by the main thread),
+ * 2 - animated events at half the frame rate, 3 - animations dropped.
+ * @param {number} level the level.
+ */
+self.setQualityLevel = function (level) {
+    self.qualityLevel = level;
+    if (level < 3) {
+        self.octObj.restoreAnimations();
     }
+    self.qualityWindow = null;
+};
+
+/**
+ * Make the font accessible by libass by writing it to the virtual FS.
+ * @param {!string} font the font name.
+ * @param {boolean=} eager write it even with lazyFonts, for tracks which do not load fonts lazily.
+ */
+self.writeFontToFS = function(font, eager) {
+    if (self.lazyFonts && !eager) return; // see ensureFonts
+
+    font = self.fontKey(font);
+
+    if (self.fontMap_.hasOwnProperty(font)) return;
+
+    self.fontMap_[font] = true;
+
+    if (!self.availableFonts.hasOwnProperty(font)) return;
+    var content = readBinary(self.availableFonts[font]);
+
+    Module["FS"].writeFile('/fonts/font' + (self.fontId++) + '-' + self.availableFonts[font].split('/').pop(), content, {
+        encoding: 'binary'
+    });
 };
 
 self.getRenderMethod = function () {
@@ -70,6 +185,8 @@ self.getRenderMethod = function () {
             return self.lossyRender;
         case 'js-blend':
             return self.render;
+        case 'atlas':
+            return self.atlasRender;
         default:
             console.error('Unrecognised renderMode, falling back to default!');
             self.renderMode = 'wasm-blend';
@@ -84,30 +201,258 @@ self.getRenderMethod = function () {
  * @param {!string} content the content of the subtitle file.
  */
 self.setTrack = function (content) {
-    // Make sure that the fonts are loaded
-    self.writeAvailableFontsToFS(content);
-
     // Write the subtitle file to the virtual FS.
     Module["FS"].writeFile("/sub.ass", content);
 
     // Tell libass to render the new track
+    self.trackStream = null;
+    self.lazyFontsWindow = null;
+    self.qualityWindow = null;
+    self.resetWarming();
     self.octObj.createTrack("/sub.ass");
     self.ass_track = self.octObj.track;
+    // Make sure that the fonts are loaded
+    self.writeTrackFontsToFS();
+    if (!self.renderOnDemand) {
+        self.getRenderMethod()();
+    }
+};
+
+/**
+ * Apply changes packed by the main thread in one call, see src/track_batch.h.
+ * @param {!ArrayBuffer} batch the packed changes.
+ */
+self.applyTrackBatch = function (batch) {
+    _applyTrackBatch(self.octObj, batch);
+    self.lazyFontsWindow = null;
+    self.qualityWindow = null;
+    self.resetWarming();
+};
+
+function _applyTrackBatch(octObj, batch) {
+    var data = new Uint8Array(batch);
+    var ptr = Module._malloc(data.length);
+    HEAPU8.set(data, ptr);
+    octObj.applyTrackBatch(ptr, data.length);
+    Module._free(ptr);
+}
+
+/**
+ * Set the subtitle track from a snapshot made by getTrackSnapshot.
+ * @param {!ArrayBuffer} snapshot the snapshot.
+ */
+self.setTrackSnapshot = function (snapshot) {
+    self.trackStream = null;
+    self.lazyFontsWindow = null;
+    self.qualityWindow = null;
+    self.resetWarming();
+    Module["FS"].writeFile("/sub.snapshot", new Uint8Array(snapshot));
+    self.loadTrackSnapshot("/sub.snapshot");
+    self.ass_track = self.octObj.track;
     if (!self.renderOnDemand) {
         self.getRenderMethod()();
     }
 };
 
+/**
+ * Replace the track by a snapshot in the virtual FS and load the fonts it uses.
+ * @param {!string} path the snapshot file, removed afterwards.
+ */
+self.loadTrackSnapshot = function (path) {
+    if (!self.octObj.createTrackSnapshot(path)) {
+        console.error('Cannot load the track snapshot');
+    }
+    Module["FS"].unlink(path);
+    self.writeTrackFontsToFS();
+};
+
+/**
+ * Write all fonts used by the loaded track to the virtual FS. The names come
+ * from libass' side, found while the track was scanned for animations.
+ * @param {number=} firstEvent only look at events from this one on.
+ * @param {Object=} octObj renderer of another track than the one of this worker, see TrackPlayer.
+ * @param {boolean=} eager see writeFontToFS.
+ */
+self.writeTrackFontsToFS = function (firstEvent, octObj, eager) {
+    octObj = octObj || self.octObj;
+    if (!self.availableFonts || !octObj.track.ptr) return;
+
+    var fontId = self.fontId;
+    octObj.getTrackFonts(firstEvent || 0).split('\n').forEach(function (name) {
+        if (name) self.writeFontToFS(name, eager);
+    });
+
+    if (self.fontId !== fontId) {
+        // font files are only picked up when the fonts are set up
+        self.reloadFonts();
+    }
+};
+
+/**
+ * Serialize the current track into a snapshot for setTrackSnapshot.
+ * @returns {ArrayBuffer} the snapshot or null if there is no track.
+ */
+self.getTrackSnapshot = function () {
+    var path = "/track.snapshot";
+    if (!self.octObj.saveTrackSnapshot(path)) return null;
+    var snapshot = Module["FS"].readFile(path);
+    Module["FS"].unlink(path);
+    return snapshot.buffer;
+};
+
+function _timingStats(timing) {
+    var buckets = [];
+    for (var i = 0; i < 16; i++) {
+        buckets.push(timing.get_buckets(i));
+    }
+    return {
+        count: timing.get_count(),
+        total: timing.get_total(),
+        max: timing.get_max(),
+        buckets: buckets
+    };
+}
+
+/**
+ * Collect rendering statistics gathered since the last reset.
+ * Timings are in ms, bucket i of a histogram counts durations below 2^(i-3) ms.
+ * @param {boolean} reset start collecting anew afterwards.
+ * @param {Object=} octObj renderer of another track than the one of this worker, see TrackPlayer.
+ */
+self.getStats = function (reset, octObj) {
+    octObj = octObj || self.octObj;
+    var stats = octObj.getStats();
+    var result = {
+        render: _timingStats(stats.get_render()),
+        split: _timingStats(stats.get_split()),
+        blend: _timingStats(stats.get_blend()),
+        pack: _timingStats(stats.get_pack()),
+        frames: stats.get_frames(),
+        changedFrames: stats.get_changed_frames(),
+        movedFrames: stats.get_moved_frames(),
+        images: stats.get_images(),
+        parts: stats.get_parts(),
+        reusedParts: stats.get_reused_parts(),
+        bytes: stats.get_bytes(),
+        reallocations: stats.get_reallocations(),
+        glyphLimit: stats.get_glyph_limit(),
+        bitmapCacheLimit: stats.get_bitmap_cache_limit(),
+        blendMemory: stats.get_blend_memory(),
+        blendMemoryPeak: stats.get_blend_memory_peak(),
+        blendMemoryLimit: stats.get_blend_memory_limit()
+    };
+    if (reset) {
+        octObj.resetStats();
+    }
+    return result;
+};
+
+/**
+ * Give back what memory can be rebuilt later: blending buffers not in use
+ * and, with lazyFonts, the fonts loaded lazily. The wasm heap itself does
+ * not shrink, but libass and later frames reuse the freed memory.
+ */
+self.reclaimMemory = function () {
+    var freed = self.octObj.trimMemory();
+    if (self.lazyFonts && self.lazyFontsSize > 0) {
+        freed += self.lazyFontsSize;
+        self.octObj.clearFonts();
+        self.reloadFonts();
+        self.lazyFontsLoaded = {};
+        self.lazyFontsSize = 0;
+        // the fonts needed right now come back with the next frame
+        self.lazyFontsWindow = null;
+    }
+    if (self.debug) {
+        console.info('memory pressure: freed ' + Math.round(freed / 1024) + ' KiB');
+    }
+};
+
 /**
  * Remove subtitle track.
  */
 self.freeTrack = function () {
+    self.trackStream = null;
     self.octObj.removeTrack();
     if (!self.renderOnDemand) {
         self.getRenderMethod()();
     }
 };
 
+/**
+ * Set the subtitle track and load it progressively while it is downloaded;
+ * events are shown as soon as the part of the file holding them arrived.
+ * @param {!string} url the URL of the subtitle file.
+ */
+self.setTrackStream = function (url) {
+    if (isBrotliFile(url) || typeof fetch === 'undefined' || typeof TextDecoder === 'undefined') {
+        // the brotli decoder needs the whole file at once
+        self.setTrackByUrl(url);
+        postMessage({
+            target: 'track-stream-done',
+            url: url
+        });
+        return;
+    }
+
+    var stream = {events: 0};
+    self.trackStream = stream;
+    self.octObj.createTrackStream();
+    self.ass_track = self.octObj.track;
+
+    var decoder = new TextDecoder();
+    var append = function (text, done) {
+        if (self.trackStream !== stream) return false;
+        if (text) {
+            self.octObj.appendTrackData(text);
+            self.lazyFontsWindow = null;
+            self.qualityWindow = null;
+        }
+        if (done) {
+            self.octObj.finishTrackStream();
+            self.trackStream = null;
+        }
+        self.writeTrackFontsToFS(stream.events);
+        stream.events = self.octObj.getEventCount();
+        if (!self.renderOnDemand && self._isPaused) {
+            // a running render loop picks the new events up by itself
+            self.getRenderMethod()();
+        }
+        if (done) {
+            postMessage({
+                target: 'track-stream-done',
+                url: url
+            });
+        }
+        return true;
+    };
+
+    fetch(url).then(function (response) {
+        if (!response.ok) throw new Error(response.status + ' ' + response.statusText);
+        if (!response.body) {
+            return response.text().then(function (text) {
+                append(text, true);
+            });
+        }
+        var reader = response.body.getReader();
+        var pump = function (result) {
+            var done = result.done;
+            if (!append(decoder.decode(result.value || new Uint8Array(0), {stream: !done}), done)) {
+                // replaced by another track
+                reader.cancel();
+                return;
+            }
+            if (!done) return reader.read().then(pump);
+        };
+        return reader.read().then(pump);
+    }).catch(function (error) {
+        if (self.trackStream !== stream) return;
+        console.error('Cannot load subtitles from ' + url + ': ' + error);
+        self.octObj.finishTrackStream();
+        self.trackStream = null;
+    });
+};
+
 /**
  * Set the subtitle track.
  * @param {!string} url the URL of the subtitle file.
@@ -161,6 +506,44 @@ self.setCurrentTime = function (currentTime) {
             }, 20);
         }
     }
+    if (self._isPaused) {
+        self.warmEvents();
+    }
+};
+
+/**
+ * Warm the caches of libass for the next warmAhead events in idle time: while
+ * paused, or between events while playing. One event is warmed per task, so
+ * requests to render for real are taken between them.
+ */
+self.warmEvents = function () {
+    var state = self.warmState;
+    if (!self.warmAhead || self.renderOnDemand || state.timer || !self.octObj) return;
+    state.timer = setTimeout(function () {
+        state.timer = 0;
+        var time = self.getCurrentTime() + self.delay;
+        if (time < state.from || time > state.until) {
+            // seeked or played past what was warmed
+            state.from = state.until = time;
+            state.count = 0;
+        }
+        if (state.count >= self.warmAhead) return;
+        if (!self._isPaused && self.octObj.findEventStopTimes(time).eventFinish >= 0) return; // not idle
+        var start = self.octObj.warmNextEvent(state.until);
+        if (start < 0) return;
+        state.until = start;
+        state.count++;
+        self.warmEvents();
+    }, 0);
+};
+
+/**
+ * Start warming over again, e.g. after the track changed.
+ */
+self.resetWarming = function () {
+    var state = self.warmState;
+    state.from = state.until = -1;
+    state.count = 0;
 };
 
 self._isPaused = true;
@@ -175,6 +558,7 @@ self.setIsPaused = function (isPaused) {
                 clearTimeout(self.rafId);
                 self.rafId = null;
             }
+            self.warmEvents();
         }
         else {
             self.lastCurrentTimeReceivedAt = Date.now();
@@ -189,7 +573,10 @@ self.render = function (force) {
     self.rafId = 0;
     self.renderPending = false;
     var startTime = performance.now();
-    var renderResult = self.octObj.renderImage(self.getCurrentTime() + self.delay, self.changed);
+    var time = self.getCurrentTime() + self.delay;
+    self.ensureFonts(time);
+    self.ensureQuality(time);
+    var renderResult = self.octObj.renderImage(time, self.changed);
     var changed = Module.getValue(self.changed, 'i32');
     if (changed != 0 || force) {
         var result = self.buildResult(renderResult);
@@ -208,16 +595,77 @@ self.render = function (force) {
     }
 };
 
-self.blendRenderTiming = function (timing, force) {
+/**
+ * Render as draw commands over bitmaps the main thread got before; only
+ * bitmaps it does not have yet are sent along, see bitmap_atlas.h.
+ */
+self.atlasRender = function (force) {
+    self.rafId = 0;
+    self.renderPending = false;
+    var startTime = performance.now();
+    var time = self.getCurrentTime() + self.delay;
+    self.ensureFonts(time);
+    self.ensureQuality(time);
+    var frame = self.octObj.renderAtlas(time, force);
+    if (frame.changed) {
+        // copies, as the next frame reuses the memory
+        var commands = new Int32Array(HEAP32.subarray(frame.commands >> 2, (frame.commands >> 2) + frame.command_count * 4));
+        var bitmaps = new Int32Array(HEAP32.subarray(frame.bitmaps >> 2, (frame.bitmaps >> 2) + frame.bitmap_count * 4));
+        var pixels = new Uint8Array(HEAPU8.subarray(frame.pixels, frame.pixels + frame.pixels_size));
+        var releases = new Int32Array(HEAP32.subarray(frame.releases >> 2, (frame.releases >> 2) + frame.release_count));
+        postMessage({
+            target: 'canvas',
+            op: 'renderAtlas',
+            time: Date.now(),
+            spentTime: performance.now() - startTime,
+            reset: frame.reset != 0,
+            commands: commands,
+            bitmaps: bitmaps,
+            pixels: pixels,
+            releases: releases
+        }, [commands.buffer, bitmaps.buffer, pixels.buffer, releases.buffer]);
+    }
+
+    if (!self._isPaused) {
+        self.rafId = self.requestAnimationFrame(self.atlasRender);
+    }
+};
+
+/**
+ * Render and blend the frame at `timing`, copying the changed parts out of the heap.
+ * @param {boolean} compact send parts span encoded where that is smaller.
+ * @param {Object=} octObj renderer of another track than the one of this worker, see TrackPlayer;
+ *     lazy fonts and quality levels only apply to the own track.
+ */
+self.blendRenderTiming = function (timing, force, compact, octObj) {
     var startTime = performance.now();
 
-    var renderResult = self.octObj.renderBlend(timing, force);
+    if (!octObj) {
+        octObj = self.octObj;
+        self.ensureFonts(timing);
+        self.ensureQuality(timing);
+    }
+    var renderResult = octObj.renderBlend(timing, force);
 
     var canvases = [];
     var buffers = [];
 
     // make a copy, as we should free the memory so subsequent calls can utilize it
     for (var part = renderResult.part; part.ptr != 0; part = part.next) {
+        if (part.unchanged) {
+            // the main thread still has it from the previous frame
+            canvases.push({w: part.dest_width, h: part.dest_height, x: part.dest_x, y: part.dest_y, unchanged: true});
+            continue;
+        }
+        if (compact) {
+            var encoded = octObj.encodeBlendPart(part);
+            if (encoded.ptr != 0 && encoded.size < part.dest_width * part.dest_height * 4) {
+                var spans = new Uint8Array(HEAPU8.subarray(encoded.data, encoded.data + encoded.size));
+                canvases.push({w: part.dest_width, h: part.dest_height, x: part.dest_x, y: part.dest_y, spans: spans.buffer});
+                buffers.push(spans.buffer);
+                continue;
+            }
+        }
         var result = new Uint8Array(HEAPU8.subarray(part.image, part.image + part.dest_width * part.dest_height * 4));
         canvases.push({w: part.dest_width, h: part.dest_height, x: part.dest_x, y: part.dest_y, buffer: result.buffer});
         buffers.push(result.buffer);
@@ -237,16 +685,20 @@ self.blendRender = function (force) {
     self.rafId = 0;
     self.renderPending = false;
 
-    var rendered = self.blendRenderTiming(self.getCurrentTime() + self.delay, force);
-    if (rendered.changed) {
-        postMessage({
-            target: 'canvas',
-            op: 'renderCanvas',
-            time: rendered.time,
-            spentTime: rendered.spentTime,
-            blendTime: rendered.blendTime,
-            canvases: rendered.canvases
-        }, rendered.buffers);
+    if (self.frameRing) {
+        self.sharedBlendRender(force);
+    } else {
+        var rendered = self.blendRenderTiming(self.getCurrentTime() + self.delay, force);
+        if (rendered.changed) {
+            postMessage({
+                target: 'canvas',
+                op: 'renderCanvas',
+                time: rendered.time,
+                spentTime: rendered.spentTime,
+                blendTime: rendered.blendTime,
+                canvases: rendered.canvases
+            }, rendered.buffers);
+        }
     }
 
     if (!self._isPaused) {
@@ -254,17 +706,50 @@ self.blendRender = function (force) {
     }
 };
 
+/**
+ * Blend into the frame ring; the main thread only gets notified and reads
+ * the parts straight from the shared heap.
+ */
+self.sharedBlendRender = function (force) {
+    var startTime = performance.now();
+    var time = self.getCurrentTime() + self.delay;
+    self.ensureFonts(time);
+    self.ensureQuality(time);
+    var renderResult = self.octObj.renderBlend(time, force);
+    if (!renderResult.changed && !force) return;
+
+    if (HEAPU8.buffer !== self.frameRingBuffer) {
+        // the heap grew (or was never sent), views on the main thread have to be renewed
+        self.frameRingBuffer = HEAPU8.buffer;
+        postMessage({
+            target: 'canvas',
+            op: 'frameRing',
+            buffer: self.frameRingBuffer,
+            ring: self.frameRing
+        });
+    }
+    postMessage({
+        target: 'canvas',
+        op: 'renderSharedCanvas',
+        time: Date.now(),
+        spentTime: performance.now() - startTime,
+        blendTime: renderResult.blend_time
+    });
+};
+
 self.oneshotRender = function (lastRenderedTime, renderNow, iteration) {
     var eventStart = renderNow ? lastRenderedTime : self.octObj.findNextEventStart(lastRenderedTime);
     var eventFinish = -1.0, emptyFinish = -1.0, animated = false;
     var rendered = {};
     if (eventStart >= 0) {
+        // animations may get dropped, which changes the stop times
+        self.ensureQuality(eventStart);
         eventTimes = self.octObj.findEventStopTimes(eventStart);
         eventFinish = eventTimes.eventFinish;
         emptyFinish = eventTimes.emptyFinish;
         animated = eventTimes.is_animated;
 
-        rendered = self.blendRenderTiming(eventStart, true);
+        rendered = self.blendRenderTiming(eventStart, true, self.compactFrames);
     }
 
     postMessage({
@@ -284,13 +769,82 @@ self.oneshotRender = function (lastRenderedTime, renderNow, iteration) {
         blendTime: rendered.blendTime || 0,
         canvases: rendered.canvases || []
     }, rendered.buffers || []);
+
+    return {
+        eventStart: eventStart,
+        emptyFinish: emptyFinish,
+        animated: animated
+    };
 }
 
+/**
+ * The time a oneshot frame rendered at `time` is shown until, like the main
+ * thread splits events: the next presentation time of the video on the grid
+ * `origin + k * duration` if it sent one, otherwise 1/targetFps
+ * (1/animationFps if animated) later.
+ */
+self.nextFrameTime = function (time, animated, duration, origin) {
+    if (!duration) {
+        return time + 1.0 / (animated ? self.animationFps() : self.targetFps);
+    }
+    var step = animated && self.qualityLevel >= 2 ? duration * 2 : duration;
+    return origin + (Math.floor((time - origin + 0.001) / step) + 1) * step;
+};
+
+/**
+ * Render the oneshot frames from `start` up to `until` one after another,
+ * picking the next time like the main thread does when it chains requests.
+ * Yields between frames, so a newer request can replace the chunk.
+ */
+self.oneshotRenderChunk = function (start, until, id, iteration, frameDuration, frameOrigin) {
+    var chunk = {
+        time: start,
+        until: until,
+        id: id,
+        iteration: iteration,
+        frameDuration: frameDuration || 0,
+        frameOrigin: frameOrigin || 0
+    };
+    self.oneshotChunk = chunk;
+
+    var step = function () {
+        if (self.oneshotChunk !== chunk) return;
+
+        var result = self.oneshotRender(chunk.time, true, chunk.iteration);
+        var next = -1;
+        if (result.eventStart >= 0 && ((result.emptyFinish > 0 && result.emptyFinish - result.eventStart < 1.0 / self.targetFps) || result.animated)) {
+            // the main thread splits such events into frames
+            next = self.nextFrameTime(result.eventStart, result.animated, chunk.frameDuration, chunk.frameOrigin);
+        } else if (result.emptyFinish >= 0) {
+            // where the output changes next, possibly in the middle of an event
+            next = result.emptyFinish;
+        }
+
+        if (next < 0 || next >= chunk.until) {
+            self.oneshotChunk = null;
+            postMessage({
+                target: 'canvas',
+                op: 'oneshot-chunk-done',
+                chunk: chunk.id,
+                iteration: chunk.iteration,
+                ended: next < 0
+            });
+            return;
+        }
+        chunk.time = next;
+        setTimeout(step, 0);
+    };
+    step();
+};
+
 self.lossyRender = function (force) {
     self.rafId = 0;
     self.renderPending = false;
     var startTime = performance.now();
-    var renderResult = self.octObj.renderImage(self.getCurrentTime() + self.delay, self.changed);
+    var time = self.getCurrentTime() + self.delay;
+    self.ensureFonts(time);
+    self.ensureQuality(time);
+    var renderResult = self.octObj.renderImage(time, self.changed);
     var changed = Module.getValue(self.changed, "i32");
     if (changed != 0 || force) {
         var result = self.buildResult(renderResult);
@@ -381,6 +935,273 @@ self.buildResultItem = function (ptr) {
     return {w: w, h: h, x: x, y: y, buffer: result.buffer};
 };
 
+/**
+ * A track rendered for another SubtitlesOctopus instance which joined this
+ * worker with its `worker` option. Both share the wasm instance, the library
+ * of libass with its memory fonts and the font files, while the track gets a
+ * renderer of its own, with its own canvas size and clock. Frames are blended
+ * in wasm and sent with the id of the track; render ahead, lazy fonts and
+ * the quality governor stay with the own track of the worker.
+ * @param {number} id the id the main thread addresses the track by.
+ * @param {!Object} data the 'worker-init' message of the instance.
+ */
+function TrackPlayer(id, data) {
+    this.id = id;
+    this.targetFps = data.targetFps || self.targetFps;
+    this.lastCurrentTime = 0;
+    this.lastCurrentTimeReceivedAt = Date.now();
+    this.rate = 1;
+    this.isPaused = true;
+    this.timer = 0;
+
+    this.octObj = new Module.SubtitleOctopus();
+    this.octObj.initLibraryShared(self.octObj, data.width, data.height);
+    this.octObj.setDropAnimations(!!data.dropAllAnimations);
+    this.octObj.setIncrementalBlend(!!data.incrementalBlend);
+    if (data.libassMemoryLimit > 0 || data.libassGlyphLimit > 0) {
+        this.octObj.setMemoryLimits(data.libassGlyphLimit || 0, data.libassMemoryLimit || 0);
+    }
+    if (data.blendMemoryLimit > 0) {
+        this.octObj.setBlendMemoryLimit(data.blendMemoryLimit);
+    }
+    // from here on font reloads include this renderer
+    self.tracks[id] = this;
+
+    this.addFonts(data.fonts || [], data.availableFonts || {});
+    if (data.subContent) {
+        this.setTrack(data.subContent);
+    } else if (data.subUrl) {
+        this.setTrackByUrl(data.subUrl);
+    }
+}
+
+/**
+ * Write font files the worker does not have yet to the virtual FS and make
+ * available fonts known, for the own track of the worker as well.
+ * @param {!Array<string>} fonts URLs of font files.
+ * @param {!Object} availableFonts URLs of fonts by their name in lower case.
+ */
+TrackPlayer.prototype.addFonts = function (fonts, availableFonts) {
+    var fontId = self.fontId;
+    self.fontFiles = self.fontFiles || [];
+    fonts.forEach(function (url) {
+        if (self.fontFiles.indexOf(url) >= 0) return;
+        self.fontFiles.push(url);
+        Module["FS"].writeFile('/fonts/font' + (self.fontId++) + '-' + url.split('/').pop(), readBinary(url), {
+            encoding: 'binary'
+        });
+    });
+
+    self.availableFonts = self.availableFonts || {};
+    Object.keys(availableFonts).forEach(function (font) {
+        if (self.availableFonts.hasOwnProperty(font)) return;
+        self.availableFonts[font] = availableFonts[font];
+        // it was looked up in vain before
+        delete self.fontMap_[font];
+    });
+
+    if (self.fontId !== fontId) {
+        self.reloadFonts();
+    }
+};
+
+/**
+ * Set the subtitle track.
+ * @param {!string} content the content of the subtitle file.
+ */
+TrackPlayer.prototype.setTrack = function (content) {
+    var path = '/track' + this.id + '.ass';
+    Module["FS"].writeFile(path, content);
+    this.octObj.createTrack(path);
+    Module["FS"].unlink(path);
+    self.writeTrackFontsToFS(0, this.octObj, true);
+    this.render(true);
+};
+
+TrackPlayer.prototype.setTrackByUrl = function (url) {
+    this.setTrack(isBrotliFile(url) ? Module["BrotliDecode"](readBinary(url)) : read_(url));
+};
+
+TrackPlayer.prototype.getCurrentTime = function () {
+    var diff = (Date.now() - this.lastCurrentTimeReceivedAt) / 1000;
+    if (this.isPaused) {
+        return this.lastCurrentTime;
+    }
+    if (diff > 5) {
+        console.error('Didn\'t received currentTime > 5 seconds. Assuming video was paused.');
+        this.setIsPaused(true);
+    }
+    return this.lastCurrentTime + (diff * this.rate);
+};
+
+TrackPlayer.prototype.setCurrentTime = function (currentTime) {
+    this.lastCurrentTime = currentTime;
+    this.lastCurrentTimeReceivedAt = Date.now();
+    if (!this.timer) {
+        this.render(false);
+    }
+};
+
+TrackPlayer.prototype.setIsPaused = function (isPaused) {
+    if (isPaused == this.isPaused) return;
+    this.isPaused = isPaused;
+    if (isPaused) {
+        clearTimeout(this.timer);
+        this.timer = 0;
+    } else {
+        this.lastCurrentTimeReceivedAt = Date.now();
+        this.schedule();
+    }
+};
+
+/**
+ * Render the next frame after 1/targetFps seconds while playing.
+ */
+TrackPlayer.prototype.schedule = function () {
+    var player = this;
+    if (player.timer || player.isPaused) return;
+    player.timer = setTimeout(function () {
+        player.timer = 0;
+        player.render(false);
+        player.schedule();
+    }, 1000 / player.targetFps);
+};
+
+TrackPlayer.prototype.render = function (force) {
+    var rendered = self.blendRenderTiming(this.getCurrentTime() + self.delay, force, false, this.octObj);
+    if (rendered.changed) {
+        postMessage({
+            target: 'canvas',
+            op: 'renderCanvas',
+            track: this.id,
+            time: rendered.time,
+            spentTime: rendered.spentTime,
+            blendTime: rendered.blendTime,
+            canvases: rendered.canvases
+        }, rendered.buffers);
+    }
+};
+
+TrackPlayer.prototype.destroy = function () {
+    clearTimeout(this.timer);
+    this.timer = 0;
+    delete self.tracks[this.id];
+    this.octObj.quitLibrary();
+    Module.destroy(this.octObj);
+    this.octObj = null;
+};
+
+/**
+ * Handle a message of the instance, as onMessageFromMainEmscriptenThread
+ * does for the own track of the worker.
+ */
+TrackPlayer.prototype.onMessage = function (data) {
+    var octObj = this.octObj;
+    switch (data.target) {
+        case 'canvas':
+            if (data.width) {
+                octObj.resizeCanvas(data.width, data.height);
+                this.render(true);
+            }
+            break;
+        case 'video':
+            if (data.currentTime !== undefined) {
+                this.setCurrentTime(data.currentTime);
+            }
+            if (data.isPaused !== undefined) {
+                this.setIsPaused(data.isPaused);
+            }
+            if (data.rate) {
+                this.rate = data.rate;
+            }
+            break;
+        case 'destroy':
+            this.destroy();
+            break;
+        case 'free-track':
+            octObj.removeTrack();
+            this.render(true);
+            break;
+        case 'set-track':
+            this.setTrack(data.content);
+            break;
+        case 'set-track-by-url':
+            this.setTrackByUrl(data.url);
+            break;
+        case 'memory-pressure':
+            octObj.trimMemory();
+            break;
+        case 'get-stats':
+            postMessage({
+                target: 'get-stats',
+                track: this.id,
+                time: Date.now(),
+                stats: self.getStats(data.reset, octObj)
+            });
+            break;
+        case 'create-event':
+            var i = octObj.allocEvent();
+            _applyKeys(data.event, octObj.track.get_events(i));
+            octObj.updateEvent(i);
+            break;
+        case 'track-batch':
+            _applyTrackBatch(octObj, data.batch);
+            break;
+        case 'get-events':
+            postMessage({
+                target: 'get-events',
+                track: this.id,
+                time: Date.now(),
+                events: _getEvents(octObj)
+            });
+            break;
+        case 'set-event':
+            _applyKeys(data.event, octObj.track.get_events(data.index));
+            octObj.updateEvent(data.index);
+            break;
+        case 'remove-event':
+            octObj.removeEvent(data.index);
+            break;
+        case 'create-style':
+            var i = octObj.allocStyle();
+            _applyKeys(data.style, octObj.track.get_styles(i));
+            break;
+        case 'get-styles':
+            postMessage({
+                target: 'get-styles',
+                track: this.id,
+                time: Date.now(),
+                styles: _getStyles(octObj)
+            });
+            break;
+        case 'set-style':
+            _applyKeys(data.style, octObj.track.get_styles(data.index));
+            break;
+        case 'remove-style':
+            octObj.removeStyle(data.index);
+            break;
+        default:
+            console.warn('Not supported for tracks sharing a worker: ' + data.target);
+    }
+};
+
+/**
+ * Pass a message of another instance on to its track, see TrackPlayer.
+ */
+self.trackMessage = function (data) {
+    var player = self.tracks[data.track];
+    if (data.target === 'worker-init') {
+        if (player) player.destroy();
+        new TrackPlayer(data.track, data);
+        postMessage({
+            target: 'ready',
+            track: data.track
+        });
+    } else if (player) {
+        player.onMessage(data);
+    }
+};
+
 if (typeof SDL !== 'undefined') {
     SDL.defaults.copyOnLock = false;
     SDL.defaults.discardOnLock = false;
@@ -405,81 +1226,26 @@ function FPSTracker(text) {
     }
 }
 
-/**
- * Parse the content of an .ass file.
- * @param {!string} content the content of the file
- */
-function parseAss(content) {
-    var m, format, lastPart, parts, key, value, tmp, i, j, body;
-    var sections = [];
-    var lines = content.split(/[\r\n]+/g);
-    for (i = 0; i < lines.length; i++) {
-        m = lines[i].match(/^\[(.*)\]$/);
-        if (m) {
-            format = null;
-            sections.push({
-                name: m[1],
-                body: []
-            });
-        } else {
-            if (/^\s*$/.test(lines[i])) continue;
-            if (sections.length === 0) continue;
-            body = sections[sections.length - 1].body;
-            if (lines[i][0] === ';') {
-                body.push({
-                    type: 'comment',
-                    value: lines[i].substring(1)
-                });
-            } else {
-                parts = lines[i].split(":");
-                key = parts[0];
-                value = parts.slice(1).join(':').trim();
-                if (format || key === 'Format') {
-                    value = value.split(',');
-                    if (format && value.length > format.length) {
-                        lastPart = value.slice(format.length - 1).join(',');
-                        value = value.slice(0, format.length - 1);
-                        value.push(lastPart);
-                    }
-                    value = value.map(function(s) {
-                        return s.trim();
-                    });
-                    if (format) {
-                        tmp = {};
-                        for (j = 0; j < value.length; j++) {
-                            tmp[format[j]] = value[j];
-                        }
-                        value = tmp;
-                    }
-                }
-                if (key === 'Format') {
-                    format = value;
-                }
-                body.push({
-                    key: key,
-                    value: value
-                });
-            }
-        }
-    }
-
-    return sections;
-};
-
 self.requestAnimationFrame = (function () {
     // similar to Browser.requestAnimationFrame
     var nextRAF = 0;
     return function (func) {
         // try to keep target fps (30fps) between calls to here
         var now = Date.now();
+        var fps = self.targetFps;
+        if (self.qualityLevel >= 2 && self.octObj.findEventStopTimes(self.getCurrentTime() + self.delay).is_animated) {
+            fps = self.animationFps();
+        }
         if (nextRAF === 0) {
-            nextRAF = now + 1000 / self.targetFps;
+            nextRAF = now + 1000 / fps;
         } else {
             while (now + 2 >= nextRAF) { // fudge a little, to avoid timer jitter causing us to do lots of delay:0
-                nextRAF += 1000 / self.targetFps;
+                nextRAF += 1000 / fps;
             }
         }
         var delay = Math.max(nextRAF - now, 0);
+        // the time until the next frame is idle
+        self.warmEvents();
         return setTimeout(func, delay);
         //return setTimeout(func, 1);
     };
@@ -543,8 +1309,77 @@ function _applyKeys(input, output) {
     }
 }
 
+/**
+ * All events of a track, as sent for 'get-events'.
+ */
+function _getEvents(octObj) {
+    var events = [];
+    for (var i = 0; i < octObj.getEventCount(); i++) {
+        var evnt_ptr = octObj.track.get_events(i);
+        var event = {
+            _index: i,
+            Start: evnt_ptr.get_Start(),
+            Duration: evnt_ptr.get_Duration(),
+            ReadOrder: evnt_ptr.get_ReadOrder(),
+            Layer: evnt_ptr.get_Layer(),
+            Style: evnt_ptr.get_Style(),
+            Name: evnt_ptr.get_Name(),
+            MarginL: evnt_ptr.get_MarginL(),
+            MarginR: evnt_ptr.get_MarginR(),
+            MarginV: evnt_ptr.get_MarginV(),
+            Effect: evnt_ptr.get_Effect(),
+            Text: evnt_ptr.get_Text()
+        };
+
+        events.push(event);
+    }
+    return events;
+}
+
+/**
+ * All styles of a track, as sent for 'get-styles'.
+ */
+function _getStyles(octObj) {
+    var styles = [];
+    for (var i = 0; i < octObj.getStyleCount(); i++) {
+        var styl_ptr = octObj.track.get_styles(i);
+        var style = {
+            _index: i,
+            Name: styl_ptr.get_Name(),
+            FontName: styl_ptr.get_FontName(),
+            FontSize: styl_ptr.get_FontSize(),
+            PrimaryColour: styl_ptr.get_PrimaryColour(),
+            SecondaryColour: styl_ptr.get_SecondaryColour(),
+            OutlineColour: styl_ptr.get_OutlineColour(),
+            BackColour: styl_ptr.get_BackColour(),
+            Bold: styl_ptr.get_Bold(),
+            Italic: styl_ptr.get_Italic(),
+            Underline: styl_ptr.get_Underline(),
+            StrikeOut: styl_ptr.get_StrikeOut(),
+            ScaleX: styl_ptr.get_ScaleX(),
+            ScaleY: styl_ptr.get_ScaleY(),
+            Spacing: styl_ptr.get_Spacing(),
+            Angle: styl_ptr.get_Angle(),
+            BorderStyle: styl_ptr.get_BorderStyle(),
+            Outline: styl_ptr.get_Outline(),
+            Shadow: styl_ptr.get_Shadow(),
+            Alignment: styl_ptr.get_Alignment(),
+            MarginL: styl_ptr.get_MarginL(),
+            MarginR: styl_ptr.get_MarginR(),
+            MarginV: styl_ptr.get_MarginV(),
+            Encoding: styl_ptr.get_Encoding(),
+            treat_fontname_as_pattern: styl_ptr.get_treat_fontname_as_pattern(),
+            Blur: styl_ptr.get_Blur(),
+            Justify: styl_ptr.get_Justify()
+        };
+        styles.push(style);
+    }
+    return styles;
+}
+
 function onMessageFromMainEmscriptenThread(message) {
-    if (!calledMain && !message.data.preMain) {
+    // tracks of other instances are set up on the own track of the worker, so they wait for it
+    if (!calledMain && (!message.data.preMain || message.data.track)) {
         if (!messageBuffer) {
             messageBuffer = [];
             messageResenderTimeout = setTimeout(messageResender, 50);
@@ -556,6 +1391,10 @@ function onMessageFromMainEmscriptenThread(message) {
         clearTimeout(messageResenderTimeout);
         messageResender();
     }
+    if (message.data.track) {
+        self.trackMessage(message.data);
+        return;
+    }
     //console.log('worker got ' + JSON.stringify(message.data).substr(0, 150) + '\n');
     switch (message.data.target) {
         case 'window': {
@@ -598,6 +1437,9 @@ function onMessageFromMainEmscriptenThread(message) {
             screen.height = self.height = message.data.height;
             self.subUrl = message.data.subUrl;
             self.subContent = message.data.subContent;
+            self.subSnapshotUrl = message.data.subSnapshotUrl;
+            self.subSnapshot = message.data.subSnapshot;
+            self.streamTrack = message.data.streamTrack || false;
             self.fontFiles = message.data.fonts;
             self.renderMode = message.data.renderMode;
             // Force fallback if engine does not support 'lossy' mode.
@@ -609,6 +1451,8 @@ function onMessageFromMainEmscriptenThread(message) {
             }
 
             self.availableFonts = message.data.availableFonts;
+            self.lazyFonts = message.data.lazyFonts || false;
+            self.lazyFontsLimit = message.data.lazyFontsLimit || 0;
             self.debug = message.data.debug;
             if (!hasNativeConsole && self.debug) {
                 console = makeCustomConsole();
@@ -624,8 +1468,16 @@ function onMessageFromMainEmscriptenThread(message) {
             self.targetFps = message.data.targetFps || self.targetFps;
             self.libassMemoryLimit = message.data.libassMemoryLimit || self.libassMemoryLimit;
             self.libassGlyphLimit = message.data.libassGlyphLimit || 0;
+            self.blendMemoryLimit = message.data.blendMemoryLimit || 0;
             self.renderOnDemand = message.data.renderOnDemand || false;
             self.dropAllAnimations = message.data.dropAllAnimations || false;
+            self.incrementalBlend = message.data.incrementalBlend || false;
+            self.sharedFrames = message.data.sharedFrames || false;
+            self.premultipliedAlpha = message.data.premultipliedAlpha || false;
+            self.atlasLimit = message.data.atlasLimit || 0;
+            self.liveWindow = message.data.liveWindow || 0;
+            self.compactFrames = message.data.compactFrames || false;
+            self.warmAhead = message.data.warmAhead || 0;
             removeRunDependency('worker-init');
             postMessage({
                 target: "ready",
@@ -633,49 +1485,77 @@ function onMessageFromMainEmscriptenThread(message) {
             break;
         }
         case 'oneshot-render':
-            self.oneshotRender(message.data.lastRendered,
-                    message.data.renderNow || false,
-                    message.data.iteration);
+            if (typeof message.data.until !== 'undefined') {
+                self.oneshotRenderChunk(message.data.lastRendered,
+                        message.data.until,
+                        message.data.chunk,
+                        message.data.iteration,
+                        message.data.frameDuration,
+                        message.data.frameOrigin);
+            } else {
+                self.oneshotChunk = null;
+                self.oneshotRender(message.data.lastRendered,
+                        message.data.renderNow || false,
+                        message.data.iteration);
+            }
             break;
         case 'destroy':
+            for (var id in self.tracks) {
+                self.tracks[id].destroy();
+            }
             self.octObj.quitLibrary();
             break;
         case 'free-track':
             self.freeTrack();
             break;
+        case 'set-track-snapshot':
+            self.setTrackSnapshot(message.data.snapshot);
+            break;
+        case 'get-track-snapshot': {
+            var snapshot = self.getTrackSnapshot();
+            postMessage({
+                target: "get-track-snapshot",
+                time: Date.now(),
+                snapshot: snapshot
+            }, snapshot ? [snapshot] : []);
+            break;
+        }
+        case 'set-quality-level':
+            self.setQualityLevel(message.data.level);
+            break;
+        case 'memory-pressure':
+            self.reclaimMemory();
+            break;
+        case 'get-stats':
+            postMessage({
+                target: "get-stats",
+                time: Date.now(),
+                stats: self.getStats(message.data.reset)
+            });
+            break;
         case 'set-track':
             self.setTrack(message.data.content);
             break;
         case 'set-track-by-url':
             self.setTrackByUrl(message.data.url);
             break;
+        case 'set-track-stream':
+            self.setTrackStream(message.data.url);
+            break;
         case 'create-event':
             var event = message.data.event;
             var i = self.octObj.allocEvent();
             var evnt_ptr = self.octObj.track.get_events(i);
             _applyKeys(event, evnt_ptr);
+            self.octObj.updateEvent(i);
+            self.lazyFontsWindow = null;
+            self.qualityWindow = null;
+            break;
+        case 'track-batch':
+            self.applyTrackBatch(message.data.batch);
             break;
         case 'get-events':
-            var events = [];
-            for (var i = 0; i < self.octObj.getEventCount(); i++) {
-                var evnt_ptr = self.octObj.track.get_events(i);
-                var event = {
-                    _index: i,
-                    Start: evnt_ptr.get_Start(),
-                    Duration: evnt_ptr.get_Duration(),
-                    ReadOrder: evnt_ptr.get_ReadOrder(),
-                    Layer: evnt_ptr.get_Layer(),
-                    Style: evnt_ptr.get_Style(),
-                    Name: evnt_ptr.get_Name(),
-                    MarginL: evnt_ptr.get_MarginL(),
-                    MarginR: evnt_ptr.get_MarginR(),
-                    MarginV: evnt_ptr.get_MarginV(),
-                    Effect: evnt_ptr.get_Effect(),
-                    Text: evnt_ptr.get_Text()
-                };
-
-                events.push(event);
-            }
+            var events = _getEvents(self.octObj);
             postMessage({
                 target: "get-events",
                 time: Date.now(),
@@ -687,6 +1567,9 @@ function onMessageFromMainEmscriptenThread(message) {
             var i = message.data.index;
             var evnt_ptr = self.octObj.track.get_events(i);
             _applyKeys(event, evnt_ptr);
+            self.octObj.updateEvent(i);
+            self.lazyFontsWindow = null;
+            self.qualityWindow = null;
             break;
         case 'remove-event':
             var i = message.data.index;
@@ -699,40 +1582,7 @@ function onMessageFromMainEmscriptenThread(message) {
             _applyKeys(style, styl_ptr);
             break;
         case 'get-styles':
-            var styles = [];
-            for (var i = 0; i < self.octObj.getStyleCount(); i++) {
-                var styl_ptr = self.octObj.track.get_styles(i);
-                var style = {
-                    _index: i,
-                    Name: styl_ptr.get_Name(),
-                    FontName: styl_ptr.get_FontName(),
-                    FontSize: styl_ptr.get_FontSize(),
-                    PrimaryColour: styl_ptr.get_PrimaryColour(),
-                    SecondaryColour: styl_ptr.get_SecondaryColour(),
-                    OutlineColour: styl_ptr.get_OutlineColour(),
-                    BackColour: styl_ptr.get_BackColour(),
-                    Bold: styl_ptr.get_Bold(),
-                    Italic: styl_ptr.get_Italic(),
-                    Underline: styl_ptr.get_Underline(),
-                    StrikeOut: styl_ptr.get_StrikeOut(),
-                    ScaleX: styl_ptr.get_ScaleX(),
-                    ScaleY: styl_ptr.get_ScaleY(),
-                    Spacing: styl_ptr.get_Spacing(),
-                    Angle: styl_ptr.get_Angle(),
-                    BorderStyle: styl_ptr.get_BorderStyle(),
-                    Outline: styl_ptr.get_Outline(),
-                    Shadow: styl_ptr.get_Shadow(),
-                    Alignment: styl_ptr.get_Alignment(),
-                    MarginL: styl_ptr.get_MarginL(),
-                    MarginR: styl_ptr.get_MarginR(),
-                    MarginV: styl_ptr.get_MarginV(),
-                    Encoding: styl_ptr.get_Encoding(),
-                    treat_fontname_as_pattern: styl_ptr.get_treat_fontname_as_pattern(),
-                    Blur: styl_ptr.get_Blur(),
-                    Justify: styl_ptr.get_Justify()
-                };
-                styles.push(style);
-            }
+            var styles = _getStyles(self.octObj);
             postMessage({
                 target: "get-styles",
                 time: Date.now(),
@@ -770,7 +1620,11 @@ function onMessageFromMainEmscriptenThread(message) {
     }
 };
 
-onmessage = onMessageFromMainEmscriptenThread;
+// blend threads of the multi-threaded build load this script as well
+// and must keep their own message handler
+if (typeof ENVIRONMENT_IS_PTHREAD === 'undefined' || !ENVIRONMENT_IS_PTHREAD) {
+    onmessage = onMessageFromMainEmscriptenThread;
+}
 
 function postCustomMessage(data) {
     postMessage({target: 'custom', userData: data});
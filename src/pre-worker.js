@@ -58,34 +58,24 @@ Module["preRun"].push(function () {
     Module["FS_createPath"]("/", "fonts", true, true);
     Module["FS_createPath"]("/", "fontconfig", true, true);
 
-    if (!self.subContent) {
-        // We can use sync xhr cause we're inside Web Worker
-        if (isBrotliFile(self.subUrl)) {
-            self.subContent = Module["BrotliDecode"](readBinary(self.subUrl))
-        } else {
-            self.subContent = read_(self.subUrl);
-        }
-    }
-
-    if (self.availableFonts && self.availableFonts.length !== 0) {
-        var sections = parseAss(self.subContent);
-            for (var i = 0; i < sections.length; i++) {
-                for (var j = 0; j < sections[i].body.length; j++) {
-                    if (sections[i].body[j].key === 'Style') {
-                        self.writeFontToFS(sections[i].body[j].value['Fontname']);
-                    }
-                }
-            }
-
-            var regex = /\\fn([^\\}]*?)[\\}]/g;
-            var matches;
-            while (matches = regex.exec(self.subContent)) {
-                self.writeFontToFS(matches[1]);
+    if (self.subSnapshot || self.subSnapshotUrl) {
+        // a pre-parsed track, its fonts are looked up once it is loaded
+        Module["FS"].writeFile("/sub.snapshot", new Uint8Array(self.subSnapshot || readBinary(self.subSnapshotUrl)));
+    } else if (!self.streamTrack || self.subContent) {
+        // otherwise subUrl is downloaded progressively once the runtime is up, see setTrackStream
+        if (!self.subContent) {
+            // We can use sync xhr cause we're inside Web Worker
+            if (isBrotliFile(self.subUrl)) {
+                self.subContent = Module["BrotliDecode"](readBinary(self.subUrl))
+            } else {
+                self.subContent = read_(self.subUrl);
             }
         }
 
-    if (self.subContent) {
-        Module["FS"].writeFile("/sub.ass", self.subContent);
+        // its fonts are looked up while libass loads it, see writeTrackFontsToFS
+        if (self.subContent) {
+            Module["FS"].writeFile("/sub.ass", self.subContent);
+        }
     }
 
     self.subContent = null;
@@ -104,7 +94,30 @@ Module['onRuntimeInitialized'] = function () {
 
     self.octObj.initLibrary(screen.width, screen.height);
     self.octObj.setDropAnimations(!!self.dropAllAnimations);
-    self.octObj.createTrack("/sub.ass");
+    // oneshot frames are cached on their own, they cannot refer to a previous one
+    self.octObj.setIncrementalBlend(!!self.incrementalBlend && !self.renderOnDemand);
+    self.octObj.setPremultipliedAlpha(!!self.premultipliedAlpha);
+    if (self.atlasLimit > 0) {
+        self.octObj.setAtlasLimit(self.atlasLimit);
+    }
+    if (self.liveWindow > 0) {
+        self.octObj.setLiveWindow(self.liveWindow);
+    }
+    if (self.sharedFrames && !self.renderOnDemand && typeof SharedArrayBuffer !== 'undefined' &&
+            HEAPU8.buffer instanceof SharedArrayBuffer) {
+        // the heap itself is shared with the main thread, so it can read frames in place
+        self.octObj.setFrameRing(3);
+        self.frameRing = self.octObj.getFrameRing().ptr;
+    }
+    if (self.subSnapshot || self.subSnapshotUrl) {
+        self.loadTrackSnapshot("/sub.snapshot");
+        self.subSnapshot = null;
+    } else if (self.streamTrack && !Module["FS"].analyzePath("/sub.ass").exists) {
+        self.setTrackStream(self.subUrl);
+    } else {
+        self.octObj.createTrack("/sub.ass");
+        self.writeTrackFontsToFS();
+    }
     self.ass_track = self.octObj.track;
     self.ass_library = self.octObj.ass_library;
     self.ass_renderer = self.octObj.ass_renderer;
@@ -112,6 +125,9 @@ Module['onRuntimeInitialized'] = function () {
     if (self.libassMemoryLimit > 0 || self.libassGlyphLimit > 0) {
         self.octObj.setMemoryLimits(self.libassGlyphLimit, self.libassMemoryLimit);
     }
+    if (self.blendMemoryLimit > 0) {
+        self.octObj.setBlendMemoryLimit(self.blendMemoryLimit);
+    }
 };
 
 Module["print"] = function (text) {
@@ -0,0 +1,78 @@
+/*
+    SubtitleOctopus.js - rendering statistics
+
+    Counters and duration histograms of the rendering hot path, collected
+    until they are reset; reading and resetting them periodically gives
+    rolling statistics.
+*/
+
+#ifndef SUBTITLESOCTOPUS_RENDER_STATS_H
+#define SUBTITLESOCTOPUS_RENDER_STATS_H
+
+#include <string.h>
+
+#define RENDER_STATS_BUCKETS 16
+
+/**
+ * Durations in ms on a log2 scale: bucket 0 counts samples below 1/8 ms,
+ * bucket i samples in [2^(i-4), 2^(i-3)) ms and the last bucket the rest.
+ */
+struct RenderStatsTiming {
+    int count;
+    double total, max;
+    int buckets[RENDER_STATS_BUCKETS];
+
+    void add(double ms) {
+        count++;
+        total += ms;
+        if (ms > max) max = ms;
+        int bucket = 0;
+        for (double limit = 0.125; bucket < RENDER_STATS_BUCKETS - 1 && ms >= limit; limit *= 2) {
+            bucket++;
+        }
+        buckets[bucket]++;
+    }
+};
+
+struct RenderStats {
+    RenderStatsTiming render; // ass_render_frame
+    RenderStatsTiming split;  // splitting a frame into regions and matching reusable ones
+    RenderStatsTiming blend;  // compositing all regions of a frame, packing included
+    RenderStatsTiming pack;   // converting the regions of a frame to RGBA, summed up
+
+    int frames;          // frames rendered by libass
+    int changed_frames;  // frames libass reported different contents for
+    int moved_frames;    // frames libass reported different positions only for
+    int images;          // images libass produced for those frames
+    int parts;           // regions blended or reused
+    int reused_parts;    // regions reused from the previous frame
+    double bytes;        // size of the region images blended
+    int reallocations;   // reallocations of blending buffers
+    int glyph_limit, bitmap_cache_limit; // libass cache limits as set, 0 - libass default
+    double blend_memory;      // bytes taken by blending buffers now
+    double blend_memory_peak; // and at most since the last reset
+    int blend_memory_limit;   // in MiB as set, 0 - no limit
+
+    void reset() {
+        int glyphs = glyph_limit, bitmaps = bitmap_cache_limit, blend = blend_memory_limit;
+        memset(this, 0, sizeof(*this));
+        glyph_limit = glyphs;
+        bitmap_cache_limit = bitmaps;
+        blend_memory_limit = blend;
+    }
+
+    /**
+     * \brief Account for a frame from ass_render_frame
+     * \param changed detect_change result of libass
+     */
+    void addFrame(double ms, int changed, ASS_Image *img) {
+        render.add(ms);
+        frames++;
+        if (changed == 2) changed_frames++;
+        else if (changed == 1) moved_frames++;
+        if (changed == 0) return;
+        for (ASS_Image *cur = img; cur != NULL; cur = cur->next) images++;
+    }
+};
+
+#endif // SUBTITLESOCTOPUS_RENDER_STATS_H
@@ -0,0 +1,147 @@
+/*
+    SubtitleOctopus.js - span encoded frame parts
+
+    Blended parts are mostly transparent, with text in few colours whose
+    edges only vary in alpha. A part is stored as the runs of its pixels in
+    row order, so it takes a fraction of width * height * 4 bytes until it
+    is decoded for display.
+
+    Layout: records until all non-transparent pixels are covered, each
+      varint   number of transparent pixels before the run
+      varint   count << 2 | kind
+      kind 0   SPAN_SOLID:   count pixels of one RGBA, 4 bytes
+      kind 1   SPAN_TINT:    count pixels of one RGB, 3 bytes, then an alpha byte per pixel
+      kind 2   SPAN_LITERAL: 4 bytes RGBA per pixel
+    Varints are little-endian base 128. Pixels after the last run are transparent.
+*/
+
+#ifndef SUBTITLESOCTOPUS_SPAN_CODEC_H
+#define SUBTITLESOCTOPUS_SPAN_CODEC_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SPAN_SOLID 0
+#define SPAN_TINT 1
+#define SPAN_LITERAL 2
+
+// runs of equal pixels at least this long are not folded into tint or literal runs
+#define SPAN_MIN_SOLID 4
+
+struct SpanPart {
+    unsigned char *data;
+    int size;
+};
+
+class SpanEncoder {
+public:
+    SpanEncoder(): m_data(NULL), m_capacity(0) {
+        m_part.data = NULL;
+        m_part.size = 0;
+    }
+
+    ~SpanEncoder() {
+        free(m_data);
+    }
+
+    /**
+     * \brief Encode an RGBA image, straight or premultiplied alike
+     * \return the encoded part, valid until the next call; NULL if out of memory
+     */
+    SpanPart* encode(const unsigned char *image, int width, int height) {
+        size_t n = (size_t)width * height, pos = 0, i = 0;
+        while (i < n) {
+            size_t skip = i;
+            while (i < n && image[i * 4 + 3] == 0) i++;
+            if (i == n) break;
+            skip = i - skip;
+
+            int kind;
+            size_t j = i + 1;
+            while (j < n && samePixel(image, i, j)) j++;
+            if (j - i >= 2) {
+                kind = SPAN_SOLID;
+            } else {
+                j = i + 1;
+                while (j < n && image[j * 4 + 3] && sameColour(image, i, j) && !solidAt(image, j, n)) j++;
+                if (j - i >= 3) {
+                    kind = SPAN_TINT;
+                } else {
+                    // up to the next transparent pixel or the next run worth its own record
+                    j = i + 1;
+                    while (j < n && image[j * 4 + 3] && !solidAt(image, j, n) &&
+                           !(j + 2 < n && image[(j + 2) * 4 + 3] && image[(j + 1) * 4 + 3] &&
+                             sameColour(image, j, j + 1) && sameColour(image, j, j + 2))) j++;
+                    kind = SPAN_LITERAL;
+                }
+            }
+
+            size_t count = j - i;
+            size_t payload = kind == SPAN_SOLID ? 4 : kind == SPAN_TINT ? 3 + count : count * 4;
+            if (!reserve(pos + 20 + payload)) {
+                fprintf(stderr, "jso: cannot allocate span encoded part\n");
+                return NULL;
+            }
+            pos = putVarint(pos, skip);
+            pos = putVarint(pos, (uint64_t)count << 2 | kind);
+            if (kind == SPAN_SOLID) {
+                memcpy(m_data + pos, image + i * 4, 4);
+            } else if (kind == SPAN_TINT) {
+                memcpy(m_data + pos, image + i * 4, 3);
+                for (size_t k = 0; k < count; k++) m_data[pos + 3 + k] = image[(i + k) * 4 + 3];
+            } else {
+                memcpy(m_data + pos, image + i * 4, count * 4);
+            }
+            pos += payload;
+            i = j;
+        }
+
+        m_part.data = m_data;
+        m_part.size = (int)pos;
+        return &m_part;
+    }
+
+private:
+    static bool samePixel(const unsigned char *image, size_t a, size_t b) {
+        return !memcmp(image + a * 4, image + b * 4, 4);
+    }
+
+    static bool sameColour(const unsigned char *image, size_t a, size_t b) {
+        return !memcmp(image + a * 4, image + b * 4, 3);
+    }
+
+    static bool solidAt(const unsigned char *image, size_t i, size_t n) {
+        if (i + SPAN_MIN_SOLID > n) return false;
+        for (size_t k = 1; k < SPAN_MIN_SOLID; k++) {
+            if (!samePixel(image, i, i + k)) return false;
+        }
+        return true;
+    }
+
+    size_t putVarint(size_t pos, uint64_t value) {
+        while (value >= 0x80) {
+            m_data[pos++] = (unsigned char)(value | 0x80);
+            value >>= 7;
+        }
+        m_data[pos++] = (unsigned char)value;
+        return pos;
+    }
+
+    bool reserve(size_t size) {
+        if (size <= m_capacity) return true;
+        size_t grown = m_capacity * 2 > size ? m_capacity * 2 : size;
+        unsigned char *resized = (unsigned char*)realloc(m_data, grown);
+        if (!resized) return false;
+        m_data = resized;
+        m_capacity = grown;
+        return true;
+    }
+
+    unsigned char *m_data;
+    size_t m_capacity;
+    SpanPart m_part;
+};
+
+#endif // SUBTITLESOCTOPUS_SPAN_CODEC_H
@@ -4,6 +4,72 @@ var FRAMETIME_ULP = 0.001;
 var EVENTTIME_ULP = 0.01;
 // maximum time offset for the next request in seconds
 var MAX_REQUEST_OFFSET = 1;
+// quality governor: share of the frame budget taken by rendering above which quality is lowered
+var QUALITY_DEGRADE_LOAD = 0.8;
+// ... and below which it is raised again
+var QUALITY_RESTORE_LOAD = 0.4;
+// minimum time in ms a quality level is kept before lowering or raising it
+var QUALITY_DEGRADE_HOLD = 1000;
+var QUALITY_RESTORE_HOLD = 5000;
+// render resolution relative to the prescaled one from quality level 1 on
+var QUALITY_SCALE = 0.75;
+var QUALITY_MAX_LEVEL = 3;
+// batched track changes, mirrors src/track_batch.h
+var TRACK_BATCH_OPS = {
+    event: {insert: 1, update: 2, delete: 3},
+    style: {insert: 4, update: 5}
+};
+var TRACK_BATCH_EVENT_FIELDS = [
+    ['Start', 'time'], ['Duration', 'time'], ['ReadOrder', 'int'], ['Layer', 'int'],
+    ['Style', 'int'], ['Name', 'string'], ['MarginL', 'int'], ['MarginR', 'int'],
+    ['MarginV', 'int'], ['Effect', 'string'], ['Text', 'string']
+];
+var TRACK_BATCH_STYLE_FIELDS = [
+    ['Name', 'string'], ['FontName', 'string'], ['FontSize', 'double'],
+    ['PrimaryColour', 'int'], ['SecondaryColour', 'int'], ['OutlineColour', 'int'], ['BackColour', 'int'],
+    ['Bold', 'int'], ['Italic', 'int'], ['Underline', 'int'], ['StrikeOut', 'int'],
+    ['ScaleX', 'double'], ['ScaleY', 'double'], ['Spacing', 'double'], ['Angle', 'double'],
+    ['BorderStyle', 'int'], ['Outline', 'double'], ['Shadow', 'double'], ['Alignment', 'int'],
+    ['MarginL', 'int'], ['MarginR', 'int'], ['MarginV', 'int'], ['Encoding', 'int'],
+    ['treat_fontname_as_pattern', 'int'], ['Blur', 'double'], ['Justify', 'int']
+];
+
+/**
+ * Stands in for the worker of an instance whose track is rendered by the
+ * worker of another one, see the shareWorker option: messages get the id of
+ * the track added and only the messages about that track come back.
+ */
+function TrackChannel(host, id) {
+    this.host = host;
+    this.id = id;
+    this.listeners = {message: [], error: []};
+}
+
+TrackChannel.prototype.postMessage = function (message, transfer) {
+    if (!this.host.worker) return;
+    message.track = this.id;
+    this.host.worker.postMessage(message, transfer);
+};
+
+TrackChannel.prototype.addEventListener = function (type, listener) {
+    this.listeners[type].push(listener);
+};
+
+TrackChannel.prototype.removeEventListener = function (type, listener) {
+    var listeners = this.listeners[type];
+    var i = listeners.indexOf(listener);
+    if (i >= 0) listeners.splice(i, 1);
+};
+
+TrackChannel.prototype.dispatch = function (type, event) {
+    this.listeners[type].slice().forEach(function (listener) {
+        listener(event);
+    });
+};
+
+TrackChannel.prototype.terminate = function () {
+    delete this.host.channels[this.id];
+};
 
 var SubtitlesOctopus = function (options) {
     var supportsWebAssembly = false;
@@ -18,31 +84,75 @@ var SubtitlesOctopus = function (options) {
     }
     console.log("WebAssembly support detected: " + (supportsWebAssembly ? "yes" : "no"));
 
+    var supportsWasmSimd = false;
+    try {
+        // v128 i8x16.splat + i8x16.popcnt, see https://github.com/GoogleChromeLabs/wasm-feature-detect
+        supportsWasmSimd = supportsWebAssembly && WebAssembly.validate(Uint8Array.of(
+            0x0, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x05, 0x01, 0x60, 0x00, 0x01, 0x7b,
+            0x03, 0x02, 0x01, 0x00, 0x0a, 0x0a, 0x01, 0x08, 0x00, 0x41, 0x00, 0xfd, 0x0f, 0xfd, 0x62, 0x0b));
+    } catch (e) {
+    }
+
+    // threads need shared memory, which browsers only grant to cross-origin isolated pages
+    var supportsThreads = supportsWebAssembly && typeof SharedArrayBuffer !== 'undefined' &&
+        typeof crossOriginIsolated !== 'undefined' && crossOriginIsolated;
+
     var self = this;
     self.canvas = options.canvas; // HTML canvas element (optional if video specified)
     self.renderMode = options.renderMode || (options.lossyRender ? 'lossy' : 'wasm-blend');
     self.dropAllAnimations = options.dropAllAnimations || false;
+    self.incrementalBlend = options.incrementalBlend || false; // only transfer and redraw regions which changed (wasm-blend mode only)
+    self.sharedFrames = options.sharedFrames || false; // read frames straight from the worker heap if it is shared (wasm-blend mode only)
+    self.webgl = options.webgl || false; // composite frames with WebGL from premultiplied pixels (wasm-blend mode without renderAhead only)
+    self.gl = null; // (internal) WebGL compositor state, see _createCompositor
+    self.atlasLimit = options.atlasLimit || 0; // MiB of bitmaps kept for drawing in the atlas mode; 0 - default
+    self.atlasBitmaps = {}; // (internal) bitmaps the worker sent in the atlas mode, by id
+    self.atlasScratch = null; // (internal) canvas the atlas bitmaps are coloured on
+    self.liveWindow = options.liveWindow || 0; // seconds of finished events kept for live tracks; 0 - keep all events
     self.libassMemoryLimit = options.libassMemoryLimit || 0;
     self.libassGlyphLimit = options.libassGlyphLimit || 0;
+    self.blendMemoryLimit = options.blendMemoryLimit || 0;
     self.targetFps = options.targetFps || 24;
     self.prescaleFactor = options.prescaleFactor || 1.0;
     self.prescaleHeightLimit = options.prescaleHeightLimit || 1080;
     self.maxRenderHeight = options.maxRenderHeight || 0; // 0 - no limit
+    self.adaptiveQuality = options.adaptiveQuality || false; // lower the quality while rendering does not keep up with targetFps (optional)
+    self.quality = {level: 0, load: 0, samples: 0, changedAt: 0}; // (internal) state of the quality governor
     self.resizeVariation = options.resizeVariation || 0.2; // by how many a size can vary before it would cause clearance of prerendered buffer
     self.renderAhead = options.renderAhead || 0; // how many MiB to render ahead and store; 0 to disable (approximate)
+    self.renderAheadWorkers = options.renderAheadWorkers || 1; // how many workers render ahead in parallel, each loads its own copy of the track
+    self.renderAheadChunk = options.renderAheadChunk || 5; // how many seconds of the timeline a render ahead worker gets at once
+    self.renderers = []; // (internal) render ahead workers, when there is more than one
+    self.shareWorker = options.shareWorker || null; // another SubtitlesOctopus instance whose worker renders this track as well, sharing fonts and libass (optional)
+    self.channels = {}; // (internal) instances sharing our worker by the id of their track, see TrackChannel
+    self.nextTrackId = 1; // (internal) id of the next instance to share our worker
+    self.warmAhead = options.warmAhead || 0; // how many upcoming events the worker renders into the caches of libass while idle (optional)
+    self.compactFrames = options.compactFrames || false; // keep render ahead frames span encoded until they are drawn (optional)
+    self.videoFrameSync = options.videoFrameSync || false; // time render ahead frames by the video frames shown, see requestVideoFrameCallback (optional)
+    self.frameClock = {duration: 0, origin: -1, mediaTime: -1, presentedFrames: 0, misses: 0}; // (internal) presentation times of the video frames
+    self.videoFrameId = 0; // (internal) pending requestVideoFrameCallback
     self.isOurCanvas = false; // (internal) we created canvas and manage it
     self.video = options.video; // HTML video element (optional if canvas specified)
     self.canvasParent = null; // (internal) HTML canvas parent element
     self.fonts = options.fonts || []; // Array with links to fonts used in sub (optional)
     self.availableFonts = options.availableFonts || []; // Object with all available fonts (optional). Key is font name in lower case, value is link: {"arial": "/font1.ttf"}
+    self.lazyFonts = options.lazyFonts || false; // Only load availableFonts shortly before an event uses them (optional)
+    self.lazyFontsLimit = options.lazyFontsLimit || 0; // MiB of lazily loaded fonts to keep before unused ones are dropped; 0 - no limit
     self.onReadyEvent = options.onReady; // Function called when SubtitlesOctopus is ready (optional)
-    if (supportsWebAssembly) {
+    if (supportsThreads && options.mtWorkerUrl) {
+        self.workerUrl = options.mtWorkerUrl; // Link to WebAssembly worker blending on multiple threads
+    } else if (supportsWasmSimd && options.simdWorkerUrl) {
+        self.workerUrl = options.simdWorkerUrl; // Link to WebAssembly worker built with SIMD blending
+    } else if (supportsWebAssembly) {
         self.workerUrl = options.workerUrl || 'subtitles-octopus-worker.js'; // Link to WebAssembly worker
     } else {
         self.workerUrl = options.legacyWorkerUrl || 'subtitles-octopus-worker-legacy.js'; // Link to legacy worker
     }
     self.subUrl = options.subUrl; // Link to sub file (optional if subContent specified)
     self.subContent = options.subContent || null; // Sub content (optional if subUrl specified)
+    self.subSnapshotUrl = options.subSnapshotUrl; // Link to a track snapshot made by getTrackSnapshot, used instead of subUrl and subContent (optional)
+    self.subSnapshot = options.subSnapshot || null; // Track snapshot as ArrayBuffer, used instead of subUrl and subContent (optional)
+    self.streamTrack = options.streamTrack || false; // Show events of subUrl while the rest of the file is still downloading (optional)
     self.onErrorEvent = options.onError; // Function called in case of critical error meaning sub wouldn't be shown and you should use alternative method (for instance it occurs if browser doesn't support web workers).
     self.debug = options.debug || false; // When debug enabled, some performance info printed in console.
     self.lastRenderTime = 0; // (internal) Last time we got some frame from worker
@@ -50,6 +160,19 @@ var SubtitlesOctopus = function (options) {
 
     self.timeOffset = options.timeOffset || 0; // Time offset would be applied to currentTime from video (option)
 
+    if (self.shareWorker) {
+        // tracks in the worker of another instance are blended in wasm and rendered as they play
+        self.renderMode = 'wasm-blend';
+        self.renderAhead = 0;
+        self.sharedFrames = false;
+        self.webgl = false;
+        self.adaptiveQuality = false;
+        self.lazyFonts = false;
+        self.subSnapshot = null;
+        self.subSnapshotUrl = null;
+        self.streamTrack = false;
+    }
+
     self.renderedItems = []; // used to store items rendered ahead when renderAhead > 0
     self.renderAhead = self.renderAhead * 1024 * 1024 * 0.9 /* try to eat less than requested */;
     self.oneshotState = {
@@ -62,7 +185,11 @@ var SubtitlesOctopus = function (options) {
         nextRequestOffset: 0, // Next request offset, s
         restart: true,
         prevWidth: null,
-        prevHeight: null
+        prevHeight: null,
+        chunkStart: -1, // Timeline handed out to the render ahead workers, s
+        chunkEnd: -1,
+        chunkId: 0,
+        chunksEnded: false // A worker reached end-of-events
     }
     self.rafId = 0;
 
@@ -119,7 +246,15 @@ var SubtitlesOctopus = function (options) {
             return;
         }
         // Worker
-        if (!self.worker) {
+        if (!self.worker && self.shareWorker) {
+            if (!self.shareWorker.worker) {
+                self.workerError('the instance to share the worker of was disposed');
+                return;
+            }
+            self.worker = self.shareWorker.joinWorker();
+            self.worker.addEventListener('message', self.onWorkerMessage);
+            self.worker.addEventListener('error', self.workerError);
+        } else if (!self.worker) {
             self.worker = new Worker(self.workerUrl);
             self.worker.addEventListener('message', self.onWorkerMessage);
             self.worker.addEventListener('error', self.workerError);
@@ -132,7 +267,7 @@ var SubtitlesOctopus = function (options) {
         targetWidth = self.canvas.width;
         targetHeight = self.canvas.height;
 
-        self.worker.postMessage({
+        var initMessage = {
             target: 'worker-init',
             width: self.canvas.width,
             height: self.canvas.height,
@@ -142,17 +277,82 @@ var SubtitlesOctopus = function (options) {
             renderMode: self.renderMode,
             subUrl: self.subUrl,
             subContent: self.subContent,
+            subSnapshotUrl: self.subSnapshotUrl,
+            subSnapshot: self.subSnapshot,
+            streamTrack: self.streamTrack,
             fonts: self.fonts,
             availableFonts: self.availableFonts,
+            lazyFonts: self.lazyFonts,
+            lazyFontsLimit: self.lazyFontsLimit,
             debug: self.debug,
             targetFps: self.targetFps,
             libassMemoryLimit: self.libassMemoryLimit,
             libassGlyphLimit: self.libassGlyphLimit,
+            blendMemoryLimit: self.blendMemoryLimit,
             renderOnDemand: self.renderAhead > 0,
-            dropAllAnimations: self.dropAllAnimations
-        });
+            dropAllAnimations: self.dropAllAnimations,
+            incrementalBlend: self.incrementalBlend,
+            sharedFrames: self.sharedFrames,
+            premultipliedAlpha: self.gl !== null,
+            atlasLimit: self.atlasLimit,
+            liveWindow: self.liveWindow,
+            compactFrames: self.compactFrames,
+            warmAhead: self.warmAhead
+        };
+        self.worker.postMessage(initMessage);
+
+        if (self.renderAhead > 0 && self.renderAheadWorkers > 1) {
+            self.renderers = [{worker: self.worker, busy: false}];
+            for (var i = 1; i < self.renderAheadWorkers; i++) {
+                var renderer = {worker: new Worker(self.workerUrl), busy: false};
+                renderer.onMessage = _rendererMessageHandler(i);
+                renderer.worker.addEventListener('message', renderer.onMessage);
+                renderer.worker.addEventListener('error', self.workerError);
+                renderer.worker.postMessage(initMessage);
+                self.renderers.push(renderer);
+            }
+        }
+    };
+
+    /**
+     * Let another instance render its track in our worker, see the shareWorker option.
+     * @returns {TrackChannel} what the instance uses as its worker.
+     */
+    self.joinWorker = function () {
+        if (self.shareWorker) {
+            return self.shareWorker.joinWorker();
+        }
+        var channel = new TrackChannel(self, self.nextTrackId++);
+        self.channels[channel.id] = channel;
+        return channel;
     };
 
+    /**
+     * Helper workers only render ahead, so everything but their oneshot
+     * results and logging is dropped.
+     */
+    function _rendererMessageHandler(index) {
+        return function (event) {
+            var data = event.data;
+            if (data.target === 'canvas' && (data.op === 'oneshot-result' || data.op === 'oneshot-chunk-done')) {
+                data.renderer = index;
+                self.onWorkerMessage(event);
+            } else if (data.target === 'stdout' || data.target === 'stderr' || data.target.indexOf('console-') === 0) {
+                self.onWorkerMessage(event);
+            }
+        };
+    }
+
+    /**
+     * Send a message which changes what is rendered to every worker.
+     */
+    function _postToRenderers(message) {
+        self.worker.postMessage(message);
+        for (var i = 1; i < self.renderers.length; i++) {
+            self.renderers[i].worker.postMessage(message);
+        }
+    }
+
     self.createCanvas = function () {
         if (!self.canvas) {
             if (self.video) {
@@ -178,6 +378,11 @@ var SubtitlesOctopus = function (options) {
                 }
             }
         }
+        if (self.webgl && self.renderMode == 'wasm-blend' && self.renderAhead == 0) {
+            self.gl = _createCompositor(self.canvas);
+            if (self.gl) return;
+            console.info('WebGL is not available, falling back to canvas 2D');
+        }
         self.ctx = self.canvas.getContext('2d');
         self.bufferCanvas = document.createElement('canvas');
         self.bufferCanvasCtx = self.bufferCanvas.getContext('2d');
@@ -242,6 +447,11 @@ var SubtitlesOctopus = function (options) {
     }
 
     self.setVideo = function (video) {
+        if (self.videoFrameId) {
+            self.video.cancelVideoFrameCallback(self.videoFrameId);
+            self.videoFrameId = 0;
+        }
+        self.frameClock = {duration: 0, origin: -1, mediaTime: -1, presentedFrames: 0, misses: 0};
         self.video = video;
         if (self.video) {
             self.video.addEventListener('timeupdate', onTimeUpdate, false);
@@ -341,13 +551,18 @@ var SubtitlesOctopus = function (options) {
 
     function tryRequestOneshot(currentTime, renderNow) {
         if (!self.renderAhead || self.renderAhead <= 0) return;
-        if (self.oneshotState.renderRequested && !renderNow) return;
+        if (self.oneshotState.renderRequested && !renderNow && self.renderers.length <= 1) return;
 
         if (typeof currentTime === 'undefined') {
             if (!self.video) return;
             currentTime = self.video.currentTime + self.timeOffset;
         }
 
+        if (self.renderers.length > 1) {
+            _dispatchChunks(currentTime);
+            return;
+        }
+
         var size = 0;
         for (var i = 0, len = self.renderedItems.length; i < len; i++) {
             var item = self.renderedItems[i];
@@ -384,6 +599,97 @@ var SubtitlesOctopus = function (options) {
         }
     }
 
+    /**
+     * Hand the timeline after `currentTime` out to idle render ahead workers,
+     * `renderAheadChunk` seconds each. Their results arrive out of order and
+     * are sorted into `renderedItems`.
+     */
+    function _dispatchChunks(currentTime) {
+        var state = self.oneshotState;
+        if (state.chunkStart < 0 || currentTime < state.chunkStart - EVENTTIME_ULP ||
+                currentTime > state.chunkEnd + EVENTTIME_ULP) {
+            // not covered by the chunks handed out so far (e.g. after a seek), start over from here;
+            // frames rendered so far stay valid, but busy workers get a new chunk right away
+            for (var i = 0; i < self.renderers.length; i++) {
+                self.renderers[i].busy = false;
+            }
+            state.chunkStart = state.chunkEnd = currentTime;
+            state.chunksEnded = false;
+        }
+        if (state.chunksEnded) return;
+
+        var size = 0;
+        for (var i = 0, len = self.renderedItems.length; i < len; i++) {
+            size += self.renderedItems[i].size;
+        }
+
+        for (var i = 0; i < self.renderers.length && size <= self.renderAhead; i++) {
+            var renderer = self.renderers[i];
+            if (renderer.busy) continue;
+            renderer.busy = true;
+            renderer.chunk = ++state.chunkId;
+            renderer.worker.postMessage({
+                target: 'oneshot-render',
+                lastRendered: state.chunkEnd,
+                until: state.chunkEnd + self.renderAheadChunk,
+                chunk: renderer.chunk,
+                frameDuration: _syncsVideoFrames() ? self.frameClock.duration : 0,
+                frameOrigin: self.frameClock.origin,
+                iteration: state.iteration
+            });
+            state.chunkEnd += self.renderAheadChunk;
+        }
+    }
+
+    /**
+     * Decode a part span encoded by the worker, see src/span_codec.h. Only
+     * done when it is drawn, so render ahead frames stay small until then.
+     * @returns {!ImageData} the pixels.
+     */
+    function _decodeSpans(part) {
+        var image = new ImageData(part.w, part.h);
+        var pixels = image.data, spans = part.spans;
+        var pos = 0, pixel = 0;
+        var varint = function () {
+            var value = 0, scale = 1, byte;
+            do {
+                byte = spans[pos++];
+                value += (byte & 0x7f) * scale;
+                scale *= 128;
+            } while (byte & 0x80);
+            return value;
+        };
+        while (pos < spans.length) {
+            pixel += varint();
+            var header = varint();
+            var count = Math.floor(header / 4), kind = header % 4;
+            var out = pixel * 4, end = out + count * 4;
+            if (kind === 0) {
+                for (; out < end; out += 4) {
+                    pixels[out] = spans[pos];
+                    pixels[out + 1] = spans[pos + 1];
+                    pixels[out + 2] = spans[pos + 2];
+                    pixels[out + 3] = spans[pos + 3];
+                }
+                pos += 4;
+            } else if (kind === 1) {
+                var r = spans[pos], g = spans[pos + 1], b = spans[pos + 2];
+                pos += 3;
+                for (; out < end; out += 4) {
+                    pixels[out] = r;
+                    pixels[out + 1] = g;
+                    pixels[out + 2] = b;
+                    pixels[out + 3] = spans[pos++];
+                }
+            } else {
+                pixels.set(spans.subarray(pos, pos + count * 4), out);
+                pos += count * 4;
+            }
+            pixel += count;
+        }
+        return image;
+    }
+
     function _renderSubtitleEvent(event, currentTime) {
         self.oneshotState.displayedEvent = event;
 
@@ -407,7 +713,7 @@ var SubtitlesOctopus = function (options) {
                 var image = event.items[i];
                 self.bufferCanvas.width = image.w;
                 self.bufferCanvas.height = image.h;
-                self.bufferCanvasCtx.putImageData(image.image, 0, 0);
+                self.bufferCanvasCtx.putImageData(image.image || _decodeSpans(image), 0, 0);
                 self.ctx.drawImage(self.bufferCanvas, image.x, image.y);
             }
         }
@@ -417,12 +723,70 @@ var SubtitlesOctopus = function (options) {
         }
     }
 
-    function oneshotRender() {
-        self.rafId = window.requestAnimationFrame(oneshotRender);
-        if (!self.video) return;
+    /**
+     * Whether render ahead frames are timed by the video frames, see videoFrameSync.
+     */
+    function _syncsVideoFrames() {
+        return self.videoFrameSync && self.renderAhead > 0 && self.video &&
+            typeof self.video.requestVideoFrameCallback === 'function';
+    }
 
-        var currentTime = self.video.currentTime + self.timeOffset;
+    /**
+     * Learn the frame duration and the presentation time grid of the video
+     * from the metadata of requestVideoFrameCallback.
+     */
+    function _trackVideoFrame(metadata) {
+        var clock = self.frameClock;
+        var frames = metadata.presentedFrames - clock.presentedFrames;
+        var delta = metadata.mediaTime - clock.mediaTime;
+        if (clock.mediaTime >= 0 && frames > 0 && delta > 0 && delta / frames < 0.5) {
+            var duration = delta / frames;
+            if (!clock.duration || duration < clock.duration * 0.75 || clock.misses > 10) {
+                clock.duration = duration;
+                clock.misses = 0;
+            } else if (duration < clock.duration * 1.25) {
+                // media times are rounded, so average them out
+                clock.duration = clock.duration * 0.9 + duration * 0.1;
+                clock.misses = 0;
+            } else {
+                // frames were dropped, unless it keeps happening
+                clock.misses++;
+            }
+        }
+        clock.mediaTime = metadata.mediaTime;
+        clock.presentedFrames = metadata.presentedFrames;
+        clock.origin = metadata.mediaTime + self.timeOffset;
+    }
+
+    /**
+     * The time a frame rendered at `time` is shown until: the next video frame
+     * with videoFrameSync, otherwise 1/targetFps (1/animationFps if animated) later.
+     */
+    function _nextFrameTime(time, animated) {
+        var clock = self.frameClock;
+        if (!_syncsVideoFrames() || !clock.duration) {
+            return time + 1.0 / (animated ? _animationFps() : self.targetFps);
+        }
+        var step = animated && self.quality.level >= 2 ? clock.duration * 2 : clock.duration;
+        return clock.origin + (Math.floor((time - clock.origin + FRAMETIME_ULP) / step) + 1) * step;
+    }
 
+    /**
+     * Time of the frame on screen: the video frame last presented with
+     * videoFrameSync, otherwise the current time of the video.
+     */
+    function _shownTime() {
+        if (_syncsVideoFrames() && !self.video.paused && !self.video.seeking && self.frameClock.mediaTime >= 0) {
+            return self.frameClock.mediaTime + self.timeOffset;
+        }
+        return self.video.currentTime + self.timeOffset;
+    }
+
+    /**
+     * Draw the render ahead frame of `currentTime`.
+     * @returns {Object} the frame, null if none was rendered for it.
+     */
+    function _showRendered(currentTime) {
         var eventToShow = null;
 
         for (var i = 0, len = self.renderedItems.length; i < len; i++) {
@@ -441,17 +805,38 @@ var SubtitlesOctopus = function (options) {
         } else if (self.oneshotState.displayedEvent) {
             _renderSubtitleEvent(self.oneshotState.displayedEvent, currentTime);
         }
+        return eventToShow;
+    }
+
+    /**
+     * Draw the subtitles of a video frame right before it is composited.
+     */
+    function onVideoFrame(now, metadata) {
+        self.videoFrameId = self.video.requestVideoFrameCallback(onVideoFrame);
+        _trackVideoFrame(metadata);
+        _showRendered(metadata.mediaTime + self.timeOffset);
+    }
+
+    function oneshotRender() {
+        self.rafId = window.requestAnimationFrame(oneshotRender);
+        if (!self.video) return;
+        if (_syncsVideoFrames() && !self.videoFrameId) {
+            self.videoFrameId = self.video.requestVideoFrameCallback(onVideoFrame);
+        }
+
+        var currentTime = _shownTime();
+        var eventToShow = _showRendered(currentTime);
 
         var nextTime = currentTime;
 
         if (!self.video.paused) {
             // request the next event with some extra time, because we won't get it instantly
-            nextTime += Math.max(self.oneshotState.nextRequestOffset, 1.0 / self.targetFps) * self.video.playbackRate;
+            var frameTime = _nextFrameTime(currentTime, false) - currentTime;
+            nextTime += Math.max(self.oneshotState.nextRequestOffset, frameTime) * self.video.playbackRate;
         }
 
         var nextEvent = null;
         var finishTime = -1;
-        var animated = false;
 
         for (var i = 0, len = self.renderedItems.length; i < len; i++) {
             var item = self.renderedItems[i];
@@ -466,7 +851,6 @@ var SubtitlesOctopus = function (options) {
                 // NOTE: self.renderedItems may have gaps due to seeking
                 if (item.eventStart - finishTime < EVENTTIME_ULP) {
                     finishTime = item.emptyFinish;
-                    animated = item.animated;
                 } else {
                     break;
                 }
@@ -489,7 +873,7 @@ var SubtitlesOctopus = function (options) {
 
         if ((freed || !eventToShow || self.oneshotState.restart)
                 && nextTime >= 0 && Math.abs(self.oneshotState.requestNextTimestamp - nextTime) > EVENTTIME_ULP) {
-            tryRequestOneshot(nextTime, nextTime === finishTime ? animated : true);
+            tryRequestOneshot(nextTime, true);
         }
 
         self.oneshotState.restart = false;
@@ -498,6 +882,10 @@ var SubtitlesOctopus = function (options) {
     function stopOneshotRender() {
         window.cancelAnimationFrame(self.rafId);
         self.rafId = 0;
+        if (self.videoFrameId) {
+            self.video.cancelVideoFrameCallback(self.videoFrameId);
+            self.videoFrameId = 0;
+        }
     }
 
     self.resetRenderAheadCache = function (isResizing) {
@@ -534,6 +922,10 @@ var SubtitlesOctopus = function (options) {
             self.oneshotState.prevHeight = targetHeight;
             self.oneshotState.prevWidth = targetWidth;
             self.oneshotState.nextRequestOffset = 0;
+            self.oneshotState.chunkStart = self.oneshotState.chunkEnd = -1;
+            for (var i = 0; i < self.renderers.length; i++) {
+                self.renderers[i].busy = false;
+            }
 
             // After resetting, the next `tryRequestOneshot` may be "eaten" by
             // an already existing (in the cache) event, and it won't be called
@@ -550,13 +942,183 @@ var SubtitlesOctopus = function (options) {
         }
     }
 
+    function _partKey(image) {
+        return image.x + ':' + image.y + ':' + image.w + ':' + image.h;
+    }
+
+    /**
+     * Frames which were never drawn still have to be accounted for, as the
+     * worker only sends regions which changed since the frame before.
+     * Takes over images for the unchanged regions of a frame from the pending one.
+     */
+    function _mergePendingFrame(data, pending) {
+        var pendingParts = {};
+        for (var i = 0; i < pending.canvases.length; i++) {
+            pendingParts[_partKey(pending.canvases[i])] = pending.canvases[i];
+        }
+        for (i = 0; i < data.canvases.length; i++) {
+            var prev = pendingParts[_partKey(data.canvases[i])];
+            if (data.canvases[i].unchanged && prev) {
+                data.canvases[i] = prev;
+            }
+        }
+    }
+
+    var GL_VERTEX_SHADER =
+        'attribute vec2 a_pos;' +
+        'uniform vec2 u_size;' +
+        'varying vec2 v_uv;' +
+        'void main() {' +
+        '    v_uv = a_pos / u_size;' +
+        '    gl_Position = vec4(v_uv.x * 2.0 - 1.0, 1.0 - v_uv.y * 2.0, 0.0, 1.0);' +
+        '}';
+    var GL_FRAGMENT_SHADER =
+        'precision mediump float;' +
+        'uniform sampler2D u_atlas;' +
+        'varying vec2 v_uv;' +
+        'void main() {' +
+        '    gl_FragColor = texture2D(u_atlas, v_uv);' +
+        '}';
+
+    /**
+     * WebGL compositing of wasm-blend frames. Regions arrive as premultiplied
+     * RGBA and are uploaded into an atlas texture the size of the canvas, each
+     * at its own position there, then drawn as a single batch of quads.
+     * Regions of a frame never overlap and a region flagged unchanged was in
+     * the frame before at the same place, so its pixels are still in the atlas.
+     * @returns {Object} compositor state or null if WebGL is not available.
+     */
+    function _createCompositor(canvas) {
+        var gl = canvas.getContext('webgl', {alpha: true, premultipliedAlpha: true, antialias: false, depth: false});
+        if (!gl) return null;
+
+        var compile = function (type, source) {
+            var shader = gl.createShader(type);
+            gl.shaderSource(shader, source);
+            gl.compileShader(shader);
+            if (!gl.getShaderParameter(shader, gl.COMPILE_STATUS)) {
+                console.error('cannot compile shader: ' + gl.getShaderInfoLog(shader));
+                return null;
+            }
+            return shader;
+        };
+        var vertexShader = compile(gl.VERTEX_SHADER, GL_VERTEX_SHADER);
+        var fragmentShader = compile(gl.FRAGMENT_SHADER, GL_FRAGMENT_SHADER);
+        if (!vertexShader || !fragmentShader) return null;
+        var program = gl.createProgram();
+        gl.attachShader(program, vertexShader);
+        gl.attachShader(program, fragmentShader);
+        gl.linkProgram(program);
+        if (!gl.getProgramParameter(program, gl.LINK_STATUS)) {
+            console.error('cannot link shaders: ' + gl.getProgramInfoLog(program));
+            return null;
+        }
+        gl.useProgram(program);
+
+        var texture = gl.createTexture();
+        gl.bindTexture(gl.TEXTURE_2D, texture);
+        // the atlas is sampled texel by texel and rarely a power of two in size
+        gl.texParameteri(gl.TEXTURE_2D, gl.TEXTURE_MIN_FILTER, gl.NEAREST);
+        gl.texParameteri(gl.TEXTURE_2D, gl.TEXTURE_MAG_FILTER, gl.NEAREST);
+        gl.texParameteri(gl.TEXTURE_2D, gl.TEXTURE_WRAP_S, gl.CLAMP_TO_EDGE);
+        gl.texParameteri(gl.TEXTURE_2D, gl.TEXTURE_WRAP_T, gl.CLAMP_TO_EDGE);
+        gl.pixelStorei(gl.UNPACK_PREMULTIPLY_ALPHA_WEBGL, false);
+        gl.uniform1i(gl.getUniformLocation(program, 'u_atlas'), 0);
+
+        var buffer = gl.createBuffer();
+        gl.bindBuffer(gl.ARRAY_BUFFER, buffer);
+        var position = gl.getAttribLocation(program, 'a_pos');
+        gl.enableVertexAttribArray(position);
+        gl.vertexAttribPointer(position, 2, gl.FLOAT, false, 0, 0);
+
+        return {
+            gl: gl,
+            size: gl.getUniformLocation(program, 'u_size'),
+            maxSize: gl.getParameter(gl.MAX_TEXTURE_SIZE),
+            width: 0,
+            height: 0,
+            vertices: new Float32Array(FRAME_SLOT_PARTS * 12)
+        };
+    }
+
+    /**
+     * Draw a frame with the WebGL compositor.
+     * @param {Array} parts regions {x, y, w, h, unchanged} of the frame.
+     * @param {function(number): Uint8Array} pixels premultiplied pixels of a changed region by index.
+     */
+    function _compositeFrame(parts, pixels) {
+        var state = self.gl;
+        var gl = state.gl;
+        var width = self.canvas.width, height = self.canvas.height;
+        if (state.width != width || state.height != height) {
+            if (width > state.maxSize || height > state.maxSize) {
+                console.error('canvas of ' + width + 'x' + height + ' exceeds the WebGL texture size limit');
+                return;
+            }
+            // the worker starts over with a full frame after a resize
+            gl.texImage2D(gl.TEXTURE_2D, 0, gl.RGBA, width, height, 0, gl.RGBA, gl.UNSIGNED_BYTE, null);
+            gl.uniform2f(state.size, width, height);
+            state.width = width;
+            state.height = height;
+        }
+        gl.viewport(0, 0, width, height);
+
+        var vertices = state.vertices;
+        if (vertices.length < parts.length * 12) {
+            vertices = state.vertices = new Float32Array(parts.length * 12);
+        }
+        for (var i = 0; i < parts.length; i++) {
+            var part = parts[i];
+            if (!part.unchanged) {
+                gl.texSubImage2D(gl.TEXTURE_2D, 0, part.x, part.y, part.w, part.h, gl.RGBA, gl.UNSIGNED_BYTE, pixels(i));
+            }
+            var x1 = part.x, y1 = part.y, x2 = part.x + part.w, y2 = part.y + part.h;
+            vertices.set([x1, y1, x2, y1, x1, y2, x1, y2, x2, y1, x2, y2], i * 12);
+        }
+
+        gl.clearColor(0, 0, 0, 0);
+        gl.clear(gl.COLOR_BUFFER_BIT);
+        if (parts.length > 0) {
+            gl.bufferData(gl.ARRAY_BUFFER, vertices.subarray(0, parts.length * 12), gl.DYNAMIC_DRAW);
+            gl.drawArrays(gl.TRIANGLES, 0, parts.length * 6);
+        }
+    }
+
     self.renderFrameData = null;
+    self.drawnParts = []; // (internal) regions currently drawn on the canvas by renderFrames
     function renderFrames() {
         var data = self.renderFramesData;
+        if (data.drawn) return;
+        data.drawn = true;
         var beforeDrawTime = performance.now();
-        self.ctx.clearRect(0, 0, self.canvas.width, self.canvas.height);
+        if (self.gl) {
+            _compositeFrame(data.canvases, function (i) {
+                return new Uint8Array(data.canvases[i].buffer);
+            });
+            if (self.debug) {
+                console.log('render: ' + Math.round(data.spentTime - data.blendTime) + ' ms, blend: ' + Math.round(data.blendTime) + ' ms, draw: ' + Math.round(performance.now() - beforeDrawTime) + ' ms');
+            }
+            return;
+        }
+        var keep = {};
         for (var i = 0; i < data.canvases.length; i++) {
+            if (data.canvases[i].unchanged) keep[_partKey(data.canvases[i])] = true;
+        }
+        if (data.canvases.length === 0 || Object.keys(keep).length === 0) {
+            self.ctx.clearRect(0, 0, self.canvas.width, self.canvas.height);
+        } else {
+            // regions of the canvas never overlap within a frame, so clearing
+            // the ones which went away leaves the unchanged ones intact
+            for (i = 0; i < self.drawnParts.length; i++) {
+                var drawn = self.drawnParts[i];
+                if (!keep[_partKey(drawn)]) self.ctx.clearRect(drawn.x, drawn.y, drawn.w, drawn.h);
+            }
+        }
+        self.drawnParts = [];
+        for (i = 0; i < data.canvases.length; i++) {
             var image = data.canvases[i];
+            self.drawnParts.push({x: image.x, y: image.y, w: image.w, h: image.h});
+            if (image.unchanged) continue;
             self.bufferCanvas.width = image.w;
             self.bufferCanvas.height = image.h;
             var imageBuffer = new Uint8ClampedArray(image.buffer);
@@ -581,6 +1143,174 @@ var SubtitlesOctopus = function (options) {
         }
     }
 
+    // FrameRing of SubtitleOctopus.cpp in 32-bit words
+    var FRAME_SLOT_FREE = 0, FRAME_SLOT_READY = 1;
+    var FRAME_RING_HEADER = 2, FRAME_SLOT_HEADER = 3, FRAME_PART_WORDS = 5;
+    var FRAME_SLOT_PARTS = 32; // MAX_BLEND_STORAGES
+    var FRAME_SLOT_WORDS = FRAME_SLOT_HEADER + FRAME_SLOT_PARTS * FRAME_PART_WORDS;
+
+    self.frameRing = null; // (internal) shared worker heap and address of the frame ring in it
+    self.sharedImages = []; // (internal) ImageData objects (pixel arrays with WebGL) reused across shared frames
+    function renderSharedFrames() {
+        var ring = self.frameRing;
+        var heap32 = new Int32Array(ring.buffer);
+        var base = ring.ptr >> 2;
+        var published = Atomics.load(heap32, base);
+        var slots = heap32[base + 1];
+
+        // draw only the latest frame and hand every other ready slot back right away
+        var frame = -1;
+        for (var i = 0; i < slots; i++) {
+            var slot = base + FRAME_RING_HEADER + i * FRAME_SLOT_WORDS;
+            if (Atomics.load(heap32, slot) !== FRAME_SLOT_READY) continue;
+            if (heap32[slot + 1] === published) {
+                frame = slot;
+            } else {
+                Atomics.store(heap32, slot, FRAME_SLOT_FREE);
+            }
+        }
+        if (frame === -1) return; // already drawn
+
+        var data = self.renderFramesData;
+        var beforeDrawTime = performance.now();
+        var count = heap32[frame + 2];
+        if (self.gl) {
+            var parts = [];
+            for (i = 0; i < count; i++) {
+                var part = frame + FRAME_SLOT_HEADER + i * FRAME_PART_WORDS;
+                parts.push({x: heap32[part], y: heap32[part + 1], w: heap32[part + 2], h: heap32[part + 3], ptr: heap32[part + 4] >>> 0});
+            }
+            _compositeFrame(parts, function (i) {
+                // WebGL does not take views of shared memory everywhere
+                var size = parts[i].w * parts[i].h * 4;
+                var pixels = self.sharedImages[i];
+                if (!pixels || pixels.length != size) {
+                    pixels = self.sharedImages[i] = new Uint8Array(size);
+                }
+                pixels.set(new Uint8Array(ring.buffer, parts[i].ptr, size));
+                return pixels;
+            });
+            Atomics.store(heap32, frame, FRAME_SLOT_FREE);
+            return;
+        }
+        self.ctx.clearRect(0, 0, self.canvas.width, self.canvas.height);
+        for (i = 0; i < count; i++) {
+            var part = frame + FRAME_SLOT_HEADER + i * FRAME_PART_WORDS;
+            var w = heap32[part + 2], h = heap32[part + 3];
+            var imageData = self.sharedImages[i];
+            if (!imageData || imageData.width != w || imageData.height != h) {
+                imageData = self.sharedImages[i] = new ImageData(w, h);
+            }
+            // canvas does not accept shared memory, so this is the only copy made
+            imageData.data.set(new Uint8ClampedArray(ring.buffer, heap32[part + 4] >>> 0, w * h * 4));
+            if (self.hasAlphaBug) {
+                var imageBuffer = imageData.data;
+                for (var j = 3; j < imageBuffer.length; j = j + 4) {
+                    imageBuffer[j] = (imageBuffer[j] >= 1) ? imageBuffer[j] : 1;
+                }
+            }
+            self.bufferCanvas.width = w;
+            self.bufferCanvas.height = h;
+            self.bufferCanvasCtx.putImageData(imageData, 0, 0);
+            self.ctx.drawImage(self.bufferCanvas, heap32[part], heap32[part + 1]);
+        }
+        Atomics.store(heap32, frame, FRAME_SLOT_FREE);
+
+        if (self.debug) {
+            var drawTime = Math.round(performance.now() - beforeDrawTime);
+            console.log('render: ' + Math.round(data.spentTime - data.blendTime) + ' ms, blend: ' + Math.round(data.blendTime) + ' ms, draw: ' + drawTime + ' ms; TOTAL=' + Math.round(data.spentTime + drawTime) + ' ms');
+            self.renderStart = performance.now();
+        }
+    }
+
+    // AtlasFrame of bitmap_atlas.h in 32-bit words
+    var ATLAS_COMMAND_WORDS = 4, ATLAS_BITMAP_WORDS = 4;
+
+    /**
+     * Take the bitmaps an atlas frame defines and releases; unlike drawing,
+     * this has to happen for every frame, in order.
+     */
+    function _applyAtlasFrame(data) {
+        if (data.reset) self.atlasBitmaps = {};
+        var bitmaps = data.bitmaps;
+        for (var i = 0; i < bitmaps.length; i += ATLAS_BITMAP_WORDS) {
+            var w = bitmaps[i + 1], h = bitmaps[i + 2], offset = bitmaps[i + 3];
+            self.atlasBitmaps[bitmaps[i]] = {w: w, h: h, mask: _atlasMask(data.pixels, offset, w, h)};
+        }
+        // released bitmaps are not drawn by this frame, later ones may reuse their ids
+        for (i = 0; i < data.releases.length; i++) {
+            delete self.atlasBitmaps[data.releases[i]];
+        }
+    }
+
+    /**
+     * Canvas with the coverage of a bitmap as alpha, the only copy the main
+     * thread keeps; bitmap_atlas.h counts it against atlasLimit.
+     */
+    function _atlasMask(coverage, offset, w, h) {
+        var imageData = new ImageData(w, h);
+        var pixels = imageData.data;
+        for (var j = 0, k = 0; j < w * h; j++, k += 4) {
+            pixels[k] = pixels[k + 1] = pixels[k + 2] = 255;
+            pixels[k + 3] = coverage[offset + j];
+        }
+        var canvas = document.createElement('canvas');
+        canvas.width = w;
+        canvas.height = h;
+        canvas.getContext('2d').putImageData(imageData, 0, 0);
+        return canvas;
+    }
+
+    /**
+     * Draw a bitmap in a libass colour, the same as buildResultItem of the worker makes.
+     * The colour is filled into the mask on a scratch canvas, so no copy is
+     * kept per colour and colour animations allocate nothing per frame.
+     */
+    function _drawAtlasBitmap(bitmap, x, y, color) {
+        var scratch = self.atlasScratch;
+        if (!scratch) {
+            scratch = self.atlasScratch = document.createElement('canvas');
+            scratch.width = scratch.height = 0;
+        }
+        if (scratch.width < bitmap.w || scratch.height < bitmap.h) {
+            scratch.width = Math.max(scratch.width, bitmap.w);
+            scratch.height = Math.max(scratch.height, bitmap.h);
+        }
+        var ctx = scratch.getContext('2d');
+        ctx.globalCompositeOperation = 'source-over';
+        ctx.clearRect(0, 0, bitmap.w, bitmap.h);
+        ctx.drawImage(bitmap.mask, 0, 0);
+        ctx.globalCompositeOperation = 'source-in';
+        ctx.fillStyle = 'rgba(' + ((color >>> 24) & 0xFF) + ',' + ((color >>> 16) & 0xFF) + ',' +
+            ((color >>> 8) & 0xFF) + ',' + (255 - (color & 0xFF)) / 255 + ')';
+        ctx.fillRect(0, 0, bitmap.w, bitmap.h);
+        self.ctx.drawImage(scratch, 0, 0, bitmap.w, bitmap.h, x, y, bitmap.w, bitmap.h);
+    }
+
+    /**
+     * Atlas Render Mode
+     *
+     */
+    function renderAtlasFrames() {
+        var data = self.renderFramesData;
+        if (data.drawn) return;
+        data.drawn = true;
+        var beforeDrawTime = performance.now();
+        self.ctx.clearRect(0, 0, self.canvas.width, self.canvas.height);
+        var commands = data.commands;
+        for (var i = 0; i < commands.length; i += ATLAS_COMMAND_WORDS) {
+            var bitmap = self.atlasBitmaps[commands[i]];
+            if (!bitmap) continue; // cannot happen unless frames got out of order
+            _drawAtlasBitmap(bitmap, commands[i + 1], commands[i + 2], commands[i + 3]);
+        }
+        if (self.debug) {
+            var drawTime = Math.round(performance.now() - beforeDrawTime);
+            console.log(commands.length / ATLAS_COMMAND_WORDS + ' commands, ' + data.bitmaps.length / ATLAS_BITMAP_WORDS +
+                ' new bitmaps, ' + Math.round(data.spentTime) + ' ms (+ ' + drawTime + ' ms draw)');
+            self.renderStart = performance.now();
+        }
+    }
+
     /**
      * Lossy Render Mode
      *
@@ -604,6 +1334,11 @@ var SubtitlesOctopus = function (options) {
     self.frameId = 0;
     self.onWorkerMessage = function (event) {
         //dump('\nclient got ' + JSON.stringify(event.data).substr(0, 150) + '\n');
+        if (event.data.track && !self.shareWorker) {
+            var channel = self.channels[event.data.track];
+            if (channel) channel.dispatch('message', event);
+            return;
+        }
         if (!self.workerActive) {
             self.workerActive = true;
             if (self.onReadyEvent) {
@@ -655,14 +1390,40 @@ var SubtitlesOctopus = function (options) {
                         break;
                     }
                     case 'renderCanvas': {
-                        if (self.lastRenderTime < data.time) {
+                        _trackQuality(data.spentTime);
+                        // incremental frames must not be dropped, they build upon each other
+                        if (self.lastRenderTime < data.time || self.incrementalBlend) {
                             self.lastRenderTime = data.time;
+                            if (self.renderFramesData && self.renderFramesData.canvases && !self.renderFramesData.drawn) {
+                                _mergePendingFrame(data, self.renderFramesData);
+                            }
                             self.renderFramesData = data;
                             window.requestAnimationFrame(renderFrames);
                         }
                         break;
                     }
+                    case 'frameRing': {
+                        self.frameRing = {buffer: data.buffer, ptr: data.ring};
+                        break;
+                    }
+                    case 'renderSharedCanvas': {
+                        _trackQuality(data.spentTime);
+                        self.renderFramesData = data;
+                        window.requestAnimationFrame(renderSharedFrames);
+                        break;
+                    }
+                    case 'renderAtlas': {
+                        _trackQuality(data.spentTime);
+                        _applyAtlasFrame(data);
+                        if (self.lastRenderTime < data.time) {
+                            self.lastRenderTime = data.time;
+                            self.renderFramesData = data;
+                            window.requestAnimationFrame(renderAtlasFrames);
+                        }
+                        break;
+                    }
                     case 'renderFastCanvas': {
+                        _trackQuality(data.libassTime + data.decodeTime);
                         if (self.lastRenderTime < data.time) {
                             self.lastRenderTime = data.time;
                             self.renderFramesData = data;
@@ -685,6 +1446,7 @@ var SubtitlesOctopus = function (options) {
                                     data.eventStart + ', empty=' + data.emptyFinish +
                                     '), render: ' + Math.round(data.spentTime) + ' ms');
                         }
+                        _trackQuality(data.spentTime);
                         self.oneshotState.renderRequested = false;
                         if (Math.abs(data.lastRenderedTime - self.oneshotState.requestNextTimestamp) < EVENTTIME_ULP) {
                             self.oneshotState.requestNextTimestamp = -1;
@@ -708,6 +1470,12 @@ var SubtitlesOctopus = function (options) {
                         var size = 0;
                         for (var i = 0, len = data.canvases.length; i < len; i++) {
                             var item = data.canvases[i];
+                            if (item.spans) {
+                                // decoded when drawn, see _decodeSpans
+                                items.push({w: item.w, h: item.h, x: item.x, y: item.y, spans: new Uint8Array(item.spans)});
+                                size += item.spans.byteLength;
+                                continue;
+                            }
                             items.push({
                                 w: item.w,
                                 h: item.h,
@@ -718,12 +1486,10 @@ var SubtitlesOctopus = function (options) {
                             size += item.buffer.byteLength;
                         }
 
-                        var eventSplitted = false;
                         if ((data.emptyFinish > 0 && data.emptyFinish - data.eventStart < 1.0 / self.targetFps) || data.animated) {
-                            var newFinish = data.eventStart + 1.0 / self.targetFps;
+                            var newFinish = _nextFrameTime(data.eventStart, data.animated);
                             data.emptyFinish = newFinish;
                             data.eventFinish = newFinish;
-                            eventSplitted = true;
                         }
                         self.renderedItems.push({
                             eventStart: data.eventStart,
@@ -741,19 +1507,38 @@ var SubtitlesOctopus = function (options) {
                             return a.eventStart - b.eventStart;
                         });
 
+                        if (self.renderers.length > 1) {
+                            // chunks are handed out as workers get idle, see 'oneshot-chunk-done'
+                            break;
+                        }
                         if (self.oneshotState.requestNextTimestamp >= 0) {
                             // requesting an out of order event render
                             tryRequestOneshot(self.oneshotState.requestNextTimestamp, true);
                         } else if (data.eventStart < 0) {
                             console.info('oneshot received "end of frames" event');
                         } else if (data.emptyFinish >= 0) {
-                            // there's some more event to render, try requesting next event
-                            tryRequestOneshot(data.emptyFinish, eventSplitted);
+                            // the output changes next at emptyFinish, which may well be in the middle
+                            // of an event going on, so render right there
+                            tryRequestOneshot(data.emptyFinish, true);
                         } else {
                             console.info('there are no more events to prerender');
                         }
                         break;
                     }
+                    case 'oneshot-chunk-done': {
+                        var renderer = self.renderers[data.renderer || 0];
+                        // the worker may have been given a newer chunk meanwhile
+                        if (data.iteration != self.oneshotState.iteration || data.chunk !== renderer.chunk) return;
+
+                        renderer.busy = false;
+                        if (data.ended) {
+                            console.info('there are no more events to prerender');
+                            self.oneshotState.chunksEnded = true;
+                        } else {
+                            _dispatchChunks(self.oneshotState.chunkEnd);
+                        }
+                        break;
+                    }
                     default:
                         throw 'eh?';
                 }
@@ -787,6 +1572,17 @@ var SubtitlesOctopus = function (options) {
             case 'get-styles': {
                 break;
             }
+            case 'get-track-snapshot': {
+                break;
+            }
+            case 'get-stats': {
+                break;
+            }
+            case 'track-stream-done': {
+                // frames rendered ahead so far did not know about the rest of the track
+                self.resetRenderAheadCache(false);
+                break;
+            }
             case 'ready': {
                 break;
             }
@@ -812,6 +1608,9 @@ var SubtitlesOctopus = function (options) {
             if (self.maxRenderHeight > 0 && newH > self.maxRenderHeight)
                 newH = self.maxRenderHeight;
 
+            if (self.quality.level >= 1)
+                newH *= QUALITY_SCALE;
+
             width *= newH / height;
             height = newH;
         }
@@ -819,6 +1618,57 @@ var SubtitlesOctopus = function (options) {
         return {'width': width, 'height': height};
     }
 
+    /**
+     * Frame rate animated events are rendered at; halved from quality level 2 on.
+     */
+    function _animationFps() {
+        return self.quality.level >= 2 ? self.targetFps / 2 : self.targetFps;
+    }
+
+    function _setQualityLevel(level) {
+        var quality = self.quality;
+        quality.level = level;
+        quality.changedAt = performance.now();
+        // judge the new level by its own frames only
+        quality.samples = 0;
+        if (self.debug) {
+            console.info('quality level: ' + level);
+        }
+        _postToRenderers({
+            target: 'set-quality-level',
+            level: level
+        });
+        if (self.video) {
+            // render resolution depends on the level
+            self.resize();
+        }
+    }
+
+    /**
+     * Quality governor: lower the quality level step by step while rendering a
+     * frame takes most of the 1/targetFps budget and raise it again once there
+     * is plenty of headroom for a while. Levels: 0 - full quality, 1 - lower
+     * render resolution, 2 - animated events at half the frame rate,
+     * 3 - animations of upcoming events dropped.
+     * @param {number} spentTime time spent on rendering and blending a frame, ms
+     */
+    function _trackQuality(spentTime) {
+        if (!self.adaptiveQuality) return;
+
+        var quality = self.quality;
+        var load = spentTime * self.targetFps / 1000;
+        quality.load = quality.samples > 0 ? quality.load * 0.9 + load * 0.1 : load;
+        quality.samples++;
+        if (quality.samples < 5) return;
+
+        var held = performance.now() - quality.changedAt;
+        if (quality.load > QUALITY_DEGRADE_LOAD && quality.level < QUALITY_MAX_LEVEL && held >= QUALITY_DEGRADE_HOLD) {
+            _setQualityLevel(quality.level + 1);
+        } else if (quality.load < QUALITY_RESTORE_LOAD && quality.level > 0 && held >= QUALITY_RESTORE_HOLD) {
+            _setQualityLevel(quality.level - 1);
+        }
+    }
+
     self.resize = function (width, height, top, left) {
         var videoSize = null;
         top = top || 0;
@@ -853,10 +1703,11 @@ var SubtitlesOctopus = function (options) {
         if (targetWidth !== width || targetHeight !== height) {
             self.canvas.width = width;
             self.canvas.height = height;
+            self.drawnParts = [];
             targetWidth = width;
             targetHeight = height;
 
-            self.worker.postMessage({
+            _postToRenderers({
                 target: 'canvas',
                 width: self.canvas.width,
                 height: self.canvas.height
@@ -893,23 +1744,128 @@ var SubtitlesOctopus = function (options) {
     };
 
     self.setTrackByUrl = function (url) {
-        self.worker.postMessage({
+        _postToRenderers({
             target: 'set-track-by-url',
             url: url
         });
         self.resetRenderAheadCache(false);
     };
 
+    /**
+     * Set the track by its URL and show its events while the rest of the file is still downloading.
+     * @param {!string} url the URL of the subtitle file.
+     */
+    self.setTrackStream = function (url) {
+        _postToRenderers({
+            target: 'set-track-stream',
+            url: url
+        });
+        self.resetRenderAheadCache(false);
+    };
+
     self.setTrack = function (content) {
-        self.worker.postMessage({
+        _postToRenderers({
             target: 'set-track',
             content: content
         });
         self.resetRenderAheadCache(false);
     };
 
+    /**
+     * Set the track from a snapshot made by getTrackSnapshot, which skips parsing it.
+     * @param {!ArrayBuffer} snapshot the snapshot.
+     */
+    self.setTrackSnapshot = function (snapshot) {
+        _postToRenderers({
+            target: 'set-track-snapshot',
+            snapshot: snapshot
+        });
+        self.resetRenderAheadCache(false);
+    };
+
+    /**
+     * Pack event and style changes into the layout read by src/track_batch.h.
+     * @param {!Array<!Object>} changes see applyTrackBatch.
+     * @returns {!ArrayBuffer} the batch.
+     */
+    function _packTrackBatch(changes) {
+        var encoder = new TextEncoder();
+        var strings = [];
+        var stringsSize = 0;
+        var recordsSize = 0;
+        changes.forEach(function (change) {
+            var fields = change.style ? TRACK_BATCH_STYLE_FIELDS : TRACK_BATCH_EVENT_FIELDS;
+            recordsSize += 16 + fields.length * 8;
+        });
+
+        var records = new DataView(new ArrayBuffer(8 + recordsSize));
+        records.setUint32(0, changes.length, true);
+        records.setUint32(4, 8 + recordsSize, true);
+        var pos = 8;
+        changes.forEach(function (change) {
+            var kind = change.style ? 'style' : 'event';
+            var op = TRACK_BATCH_OPS[kind][change.op];
+            if (!op) throw new Error('unsupported track batch op ' + change.op + ' for ' + kind);
+            var values = change[kind] || {};
+            var fields = kind === 'style' ? TRACK_BATCH_STYLE_FIELDS : TRACK_BATCH_EVENT_FIELDS;
+            var mask = 0;
+            records.setInt32(pos, op, true);
+            records.setInt32(pos + 4, change.index === undefined ? -1 : change.index, true);
+            fields.forEach(function (field, i) {
+                var slot = pos + 16 + i * 8;
+                if (!values.hasOwnProperty(field[0])) return;
+                var value = values[field[0]];
+                mask |= 1 << i;
+                if (field[1] === 'string') {
+                    if (value === null) {
+                        records.setInt32(slot, -1, true);
+                        return;
+                    }
+                    var bytes = encoder.encode(value + '\0');
+                    records.setInt32(slot, stringsSize, true);
+                    strings.push(bytes);
+                    stringsSize += bytes.length;
+                } else if (field[1] === 'int') {
+                    records.setInt32(slot, value, true);
+                } else if (field[1] === 'time') {
+                    if (typeof value !== 'number' || !isFinite(value)) {
+                        throw new Error('track batch ' + kind + ' ' + field[0] + ' is not a finite number: ' + value);
+                    }
+                    records.setFloat64(slot, value, true);
+                } else {
+                    records.setFloat64(slot, value, true);
+                }
+            });
+            records.setUint32(pos + 8, mask >>> 0, true);
+            pos += 16 + fields.length * 8;
+        });
+
+        var batch = new Uint8Array(pos + stringsSize);
+        batch.set(new Uint8Array(records.buffer), 0);
+        strings.forEach(function (bytes) {
+            batch.set(bytes, pos);
+            pos += bytes.length;
+        });
+        return batch.buffer;
+    }
+
+    /**
+     * Insert, update and delete many events and styles at once. Each change is
+     * {op: 'insert'|'update'|'delete', index: <position>, event: {Start: ..., Text: ...}}
+     * or {op: 'insert'|'update', index: <position>, style: {...}}, with only the
+     * fields to set. Indices refer to the track as left by the changes before.
+     * @param {!Array<!Object>} changes the changes, applied in order.
+     */
+    self.applyTrackBatch = function (changes) {
+        _postToRenderers({
+            target: 'track-batch',
+            batch: _packTrackBatch(changes)
+        });
+        self.resetRenderAheadCache(false);
+    };
+
     self.freeTrack = function (content) {
-        self.worker.postMessage({
+        _postToRenderers({
             target: 'free-track'
         });
         self.resetRenderAheadCache(false);
@@ -934,10 +1890,21 @@ var SubtitlesOctopus = function (options) {
     };
 
     self.dispose = function () {
-        self.worker.postMessage({
+        _postToRenderers({
             target: 'destroy'
         });
 
+        // instances sharing our worker stop rendering with it
+        self.channels = {};
+
+        for (var i = 1; i < self.renderers.length; i++) {
+            var renderer = self.renderers[i];
+            renderer.worker.terminate();
+            renderer.worker.removeEventListener('message', renderer.onMessage);
+            renderer.worker.removeEventListener('error', self.workerError);
+        }
+        self.renderers = [];
+
         self.worker.terminate();
         self.worker.removeEventListener('message', self.onWorkerMessage);
         self.worker.removeEventListener('error', self.workerError);
@@ -987,7 +1954,8 @@ var SubtitlesOctopus = function (options) {
             }, 5000)
 
             var resolve = function (event) {
-                if (event.data.target == target) {
+                // instances sharing the worker get the same replies, told apart by the track
+                if (event.data.target == target && event.data.track === workerOptions.track) {
                     onSuccess(event.data)
                     self.worker.removeEventListener('message', resolve)
                     self.worker.removeEventListener('error', reject)
@@ -1012,7 +1980,7 @@ var SubtitlesOctopus = function (options) {
     }
 
     self.createEvent = function (event) {
-        self.worker.postMessage({
+        _postToRenderers({
             target: 'create-event',
             event: event
         });
@@ -1026,8 +1994,46 @@ var SubtitlesOctopus = function (options) {
         }, onError);
     };
 
+    /**
+     * Get a binary snapshot of the current track (styles, events and lookup data),
+     * which loads faster than the script it was made from.
+     * @param {function(ArrayBuffer)} onSuccess gets the snapshot, null if there is no track
+     */
+    self.getTrackSnapshot = function (onSuccess, onError) {
+        self.fetchFromWorker({
+            target: 'get-track-snapshot'
+        }, function(data) {
+            onSuccess(data.snapshot)
+        }, onError);
+    };
+
+    /**
+     * Get rendering statistics of the worker: histograms of libass rendering,
+     * region splitting, blending and packing times plus image and buffer counters.
+     * @param {function(Object)} onSuccess gets the statistics
+     * @param {boolean} reset start collecting anew, which gives rolling statistics if called periodically
+     */
+    self.getStats = function (onSuccess, onError, reset) {
+        self.fetchFromWorker({
+            target: 'get-stats',
+            reset: !!reset
+        }, function(data) {
+            onSuccess(data.stats)
+        }, onError);
+    };
+
+    /**
+     * Tell the workers memory is short, so they free what they can rebuild later:
+     * blending buffers not in use and lazily loaded fonts.
+     */
+    self.memoryPressure = function () {
+        _postToRenderers({
+            target: 'memory-pressure'
+        });
+    };
+
     self.setEvent = function (event, index) {
-        self.worker.postMessage({
+        _postToRenderers({
             target: 'set-event',
             event: event,
             index: index
@@ -1035,14 +2041,14 @@ var SubtitlesOctopus = function (options) {
     };
 
     self.removeEvent = function (index) {
-        self.worker.postMessage({
+        _postToRenderers({
             target: 'remove-event',
             index: index
         });
     };
 
     self.createStyle = function (style) {
-        self.worker.postMessage({
+        _postToRenderers({
             target: 'create-style',
             style: style
         });
@@ -1057,7 +2063,7 @@ var SubtitlesOctopus = function (options) {
     };
 
     self.setStyle = function (style, index) {
-        self.worker.postMessage({
+        _postToRenderers({
             target: 'set-style',
             style: style,
             index: index
@@ -1065,7 +2071,7 @@ var SubtitlesOctopus = function (options) {
     };
 
     self.removeStyle = function (index) {
-        self.worker.postMessage({
+        _postToRenderers({
             target: 'remove-style',
             index: index
         });
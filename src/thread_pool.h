@@ -0,0 +1,145 @@
+/*
+    SubtitleOctopus.js - persistent worker threads
+
+    A few threads started once which run batches of independent jobs.
+    The calling thread takes part in every batch, so a batch completes even
+    if no thread got to start yet; emscripten only spawns pthreads which are
+    not pre-allocated once control returns to the event loop.
+*/
+
+#ifndef SUBTITLESOCTOPUS_THREAD_POOL_H
+#define SUBTITLESOCTOPUS_THREAD_POOL_H
+
+#include <pthread.h>
+#include <stdio.h>
+
+#define MAX_POOL_THREADS 8
+
+/**
+ * \param ctx    context passed to ThreadPool::run
+ * \param job    index of the job, 0 <= job < jobs
+ * \param worker 0 for the calling thread, 1..threads() for the pool threads
+ */
+typedef void (*ThreadPoolJob)(void *ctx, int job, int worker);
+
+class ThreadPool {
+public:
+    ThreadPool(): m_threads(0), m_fn(NULL), m_ctx(NULL), m_jobs(0), m_next(0), m_done(0), m_stop(false) {
+        pthread_mutex_init(&m_mutex, NULL);
+        pthread_cond_init(&m_wake, NULL);
+        pthread_cond_init(&m_finished, NULL);
+    }
+
+    ~ThreadPool() {
+        stop();
+        pthread_cond_destroy(&m_finished);
+        pthread_cond_destroy(&m_wake);
+        pthread_mutex_destroy(&m_mutex);
+    }
+
+    /**
+     * \brief Start up to `threads` threads
+     * \return number of threads actually running
+     */
+    int start(int threads) {
+        stop();
+        if (threads > MAX_POOL_THREADS) threads = MAX_POOL_THREADS;
+        m_stop = false;
+        for (m_threads = 0; m_threads < threads; m_threads++) {
+            m_args[m_threads].pool = this;
+            m_args[m_threads].worker = m_threads + 1;
+            if (pthread_create(m_handles + m_threads, NULL, threadMain, m_args + m_threads) != 0) {
+                fprintf(stderr, "jso: cannot start worker thread\n");
+                break;
+            }
+        }
+        return m_threads;
+    }
+
+    void stop() {
+        if (m_threads == 0) return;
+        pthread_mutex_lock(&m_mutex);
+        m_stop = true;
+        pthread_cond_broadcast(&m_wake);
+        pthread_mutex_unlock(&m_mutex);
+        for (int i = 0; i < m_threads; i++) {
+            pthread_join(m_handles[i], NULL);
+        }
+        m_threads = 0;
+    }
+
+    int threads() const {
+        return m_threads;
+    }
+
+    /**
+     * \brief Call fn(ctx, job, worker) for every job in [0, jobs) and wait for all of them
+     */
+    void run(ThreadPoolJob fn, void *ctx, int jobs) {
+        if (m_threads == 0 || jobs < 2) {
+            for (int job = 0; job < jobs; job++) fn(ctx, job, 0);
+            return;
+        }
+
+        pthread_mutex_lock(&m_mutex);
+        m_fn = fn;
+        m_ctx = ctx;
+        m_jobs = jobs;
+        m_next = m_done = 0;
+        pthread_cond_broadcast(&m_wake);
+        work(0);
+        while (m_done < m_jobs) pthread_cond_wait(&m_finished, &m_mutex);
+        m_fn = NULL;
+        pthread_mutex_unlock(&m_mutex);
+    }
+
+private:
+    struct ThreadArg {
+        ThreadPool *pool;
+        int worker;
+    };
+
+    /**
+     * \brief Take jobs of the current batch until none are left; called with the mutex held
+     */
+    void work(int worker) {
+        while (m_fn != NULL && m_next < m_jobs) {
+            int job = m_next++;
+            ThreadPoolJob fn = m_fn;
+            void *ctx = m_ctx;
+            pthread_mutex_unlock(&m_mutex);
+            fn(ctx, job, worker);
+            pthread_mutex_lock(&m_mutex);
+            if (++m_done == m_jobs) pthread_cond_signal(&m_finished);
+        }
+    }
+
+    static void *threadMain(void *arg) {
+        ThreadArg *self = (ThreadArg*)arg;
+        ThreadPool *pool = self->pool;
+        pthread_mutex_lock(&pool->m_mutex);
+        for (;;) {
+            while (!pool->m_stop && (pool->m_fn == NULL || pool->m_next >= pool->m_jobs)) {
+                pthread_cond_wait(&pool->m_wake, &pool->m_mutex);
+            }
+            if (pool->m_stop) break;
+            pool->work(self->worker);
+        }
+        pthread_mutex_unlock(&pool->m_mutex);
+        return NULL;
+    }
+
+    pthread_mutex_t m_mutex;
+    pthread_cond_t m_wake, m_finished;
+    pthread_t m_handles[MAX_POOL_THREADS];
+    ThreadArg m_args[MAX_POOL_THREADS];
+    int m_threads;
+
+    // current batch, guarded by m_mutex
+    ThreadPoolJob m_fn;
+    void *m_ctx;
+    int m_jobs, m_next, m_done;
+    bool m_stop;
+};
+
+#endif // SUBTITLESOCTOPUS_THREAD_POOL_H
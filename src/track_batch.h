@@ -0,0 +1,245 @@
+/*
+    SubtitleOctopus.js - batched track changes
+
+    Many event and style changes packed into one buffer and applied in a
+    single call, instead of setting fields one at a time through WebIDL.
+
+    Layout, all values little-endian:
+      header   u32 record count, u32 offset of the string table
+      records  one after another: i32 op, i32 index, u32 field mask, 4 bytes
+               padding, then an 8-byte slot per field of an event or a style,
+               in the order of track_batch_event_fields / track_batch_style_fields
+      strings  NUL-terminated UTF-8
+    Times and reals are doubles, times in ms, finite and clamped to
+    +-2^53 so that Start + Duration cannot overflow; everything else 32-bit
+    integers at the start of their slot; strings are their offset in the string table, -1 for NULL.
+    Only the fields whose bit is set in the mask are written, so an update
+    leaves the others as they are and an insert leaves them zero. Deletes
+    take a whole event record, of which only the index is read. Indices refer
+    to the track as left by the records before.
+*/
+
+#ifndef SUBTITLESOCTOPUS_TRACK_BATCH_H
+#define SUBTITLESOCTOPUS_TRACK_BATCH_H
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TRACK_BATCH_EVENT_INSERT 1
+#define TRACK_BATCH_EVENT_UPDATE 2
+#define TRACK_BATCH_EVENT_DELETE 3
+#define TRACK_BATCH_STYLE_INSERT 4
+#define TRACK_BATCH_STYLE_UPDATE 5
+
+#define TRACK_BATCH_HEADER 8
+#define TRACK_BATCH_RECORD_HEADER 16
+#define TRACK_BATCH_SLOT 8
+
+// largest time in ms accepted, far from where Start + Duration would overflow
+#define TRACK_BATCH_TIME_LIMIT 9007199254740992.0 // 2^53
+
+enum TrackBatchType {
+    TRACK_BATCH_INT,    // int or colour
+    TRACK_BATCH_TIME,   // long long ms, sent as double
+    TRACK_BATCH_DOUBLE,
+    TRACK_BATCH_STRING
+};
+
+struct TrackBatchField {
+    TrackBatchType type;
+    size_t offset;
+};
+
+static const TrackBatchField track_batch_event_fields[] = {
+    {TRACK_BATCH_TIME, offsetof(ASS_Event, Start)},
+    {TRACK_BATCH_TIME, offsetof(ASS_Event, Duration)},
+    {TRACK_BATCH_INT, offsetof(ASS_Event, ReadOrder)},
+    {TRACK_BATCH_INT, offsetof(ASS_Event, Layer)},
+    {TRACK_BATCH_INT, offsetof(ASS_Event, Style)},
+    {TRACK_BATCH_STRING, offsetof(ASS_Event, Name)},
+    {TRACK_BATCH_INT, offsetof(ASS_Event, MarginL)},
+    {TRACK_BATCH_INT, offsetof(ASS_Event, MarginR)},
+    {TRACK_BATCH_INT, offsetof(ASS_Event, MarginV)},
+    {TRACK_BATCH_STRING, offsetof(ASS_Event, Effect)},
+    {TRACK_BATCH_STRING, offsetof(ASS_Event, Text)}
+};
+
+static const TrackBatchField track_batch_style_fields[] = {
+    {TRACK_BATCH_STRING, offsetof(ASS_Style, Name)},
+    {TRACK_BATCH_STRING, offsetof(ASS_Style, FontName)},
+    {TRACK_BATCH_DOUBLE, offsetof(ASS_Style, FontSize)},
+    {TRACK_BATCH_INT, offsetof(ASS_Style, PrimaryColour)},
+    {TRACK_BATCH_INT, offsetof(ASS_Style, SecondaryColour)},
+    {TRACK_BATCH_INT, offsetof(ASS_Style, OutlineColour)},
+    {TRACK_BATCH_INT, offsetof(ASS_Style, BackColour)},
+    {TRACK_BATCH_INT, offsetof(ASS_Style, Bold)},
+    {TRACK_BATCH_INT, offsetof(ASS_Style, Italic)},
+    {TRACK_BATCH_INT, offsetof(ASS_Style, Underline)},
+    {TRACK_BATCH_INT, offsetof(ASS_Style, StrikeOut)},
+    {TRACK_BATCH_DOUBLE, offsetof(ASS_Style, ScaleX)},
+    {TRACK_BATCH_DOUBLE, offsetof(ASS_Style, ScaleY)},
+    {TRACK_BATCH_DOUBLE, offsetof(ASS_Style, Spacing)},
+    {TRACK_BATCH_DOUBLE, offsetof(ASS_Style, Angle)},
+    {TRACK_BATCH_INT, offsetof(ASS_Style, BorderStyle)},
+    {TRACK_BATCH_DOUBLE, offsetof(ASS_Style, Outline)},
+    {TRACK_BATCH_DOUBLE, offsetof(ASS_Style, Shadow)},
+    {TRACK_BATCH_INT, offsetof(ASS_Style, Alignment)},
+    {TRACK_BATCH_INT, offsetof(ASS_Style, MarginL)},
+    {TRACK_BATCH_INT, offsetof(ASS_Style, MarginR)},
+    {TRACK_BATCH_INT, offsetof(ASS_Style, MarginV)},
+    {TRACK_BATCH_INT, offsetof(ASS_Style, Encoding)},
+    {TRACK_BATCH_INT, offsetof(ASS_Style, treat_fontname_as_pattern)},
+    {TRACK_BATCH_DOUBLE, offsetof(ASS_Style, Blur)},
+    {TRACK_BATCH_INT, offsetof(ASS_Style, Justify)}
+};
+
+#define TRACK_BATCH_EVENT_FIELDS ((int)(sizeof(track_batch_event_fields) / sizeof(track_batch_event_fields[0])))
+#define TRACK_BATCH_STYLE_FIELDS ((int)(sizeof(track_batch_style_fields) / sizeof(track_batch_style_fields[0])))
+
+static int32_t track_batch_get32(const unsigned char *data) {
+    return (int32_t)((uint32_t)data[0] | (uint32_t)data[1] << 8 | (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24);
+}
+
+static double track_batch_get_double(const unsigned char *data) {
+    uint64_t bits = 0;
+    for (int i = 7; i >= 0; i--) bits = bits << 8 | data[i];
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/**
+ * \brief Read a time as the ms of an event, clamped to +-TRACK_BATCH_TIME_LIMIT
+ * \return false if the time is not finite
+ */
+static bool track_batch_get_time(const unsigned char *data, long long *time) {
+    double value = track_batch_get_double(data);
+    if (!isfinite(value)) return false;
+    if (value > TRACK_BATCH_TIME_LIMIT) value = TRACK_BATCH_TIME_LIMIT;
+    if (value < -TRACK_BATCH_TIME_LIMIT) value = -TRACK_BATCH_TIME_LIMIT;
+    *time = (long long)value;
+    return true;
+}
+
+class TrackBatchReader {
+public:
+    TrackBatchReader(const void *data, size_t size):
+        m_data((const unsigned char*)data), m_size(size), m_pos(TRACK_BATCH_HEADER), m_count(0), m_strings(0) {
+        if (size < TRACK_BATCH_HEADER) return;
+        m_count = track_batch_get32(m_data);
+        m_strings = (uint32_t)track_batch_get32(m_data + 4);
+        if (m_count < 0 || m_strings < TRACK_BATCH_HEADER || m_strings > size) m_count = 0;
+    }
+
+    int count() const {
+        return m_count;
+    }
+
+    /**
+     * \brief Step to the next record
+     * \return false if it does not fit the batch or has an unknown op
+     */
+    bool next() {
+        if (m_pos + TRACK_BATCH_RECORD_HEADER > m_strings) return false;
+        m_record = m_data + m_pos;
+        op = track_batch_get32(m_record);
+        index = track_batch_get32(m_record + 4);
+        mask = (uint32_t)track_batch_get32(m_record + 8);
+        switch (op) {
+            case TRACK_BATCH_EVENT_INSERT:
+            case TRACK_BATCH_EVENT_UPDATE:
+            case TRACK_BATCH_EVENT_DELETE:
+                m_field_count = TRACK_BATCH_EVENT_FIELDS;
+                break;
+            case TRACK_BATCH_STYLE_INSERT:
+            case TRACK_BATCH_STYLE_UPDATE:
+                m_field_count = TRACK_BATCH_STYLE_FIELDS;
+                break;
+            default:
+                return false;
+        }
+        size_t size = TRACK_BATCH_RECORD_HEADER + (size_t)m_field_count * TRACK_BATCH_SLOT;
+        if (m_pos + size > m_strings) return false;
+        m_pos += size;
+        return true;
+    }
+
+    /**
+     * \brief Write the masked fields of the current record into an event or a style
+     * Strings and times are checked first, so nothing is written if one of
+     * them is invalid.
+     */
+    bool apply(void *target) {
+        const TrackBatchField *fields = m_field_count == TRACK_BATCH_EVENT_FIELDS ?
+                                        track_batch_event_fields : track_batch_style_fields;
+        for (int i = 0; i < m_field_count; i++) {
+            if (!(mask & (1u << i))) continue;
+            if (fields[i].type == TRACK_BATCH_STRING) {
+                if (!string(slot(i)) && track_batch_get32(slot(i)) != -1) return false;
+            } else if (fields[i].type == TRACK_BATCH_TIME) {
+                long long time;
+                if (!track_batch_get_time(slot(i), &time)) return false;
+            }
+        }
+
+        for (int i = 0; i < m_field_count; i++) {
+            if (!(mask & (1u << i))) continue;
+            char *field = (char*)target + fields[i].offset;
+            switch (fields[i].type) {
+                case TRACK_BATCH_INT: {
+                    int32_t value = track_batch_get32(slot(i));
+                    memcpy(field, &value, sizeof(value));
+                    break;
+                }
+                case TRACK_BATCH_TIME:
+                    track_batch_get_time(slot(i), (long long*)field);
+                    break;
+                case TRACK_BATCH_DOUBLE:
+                    *(double*)field = track_batch_get_double(slot(i));
+                    break;
+                case TRACK_BATCH_STRING: {
+                    const char *value = string(slot(i));
+                    char *copy = value ? strdup(value) : NULL;
+                    if (value && !copy) return false;
+                    free(*(char**)field);
+                    *(char**)field = copy;
+                    break;
+                }
+            }
+        }
+        return true;
+    }
+
+    int op;
+    int index;
+    uint32_t mask;
+
+private:
+    const unsigned char* slot(int field) const {
+        return m_record + TRACK_BATCH_RECORD_HEADER + field * TRACK_BATCH_SLOT;
+    }
+
+    /**
+     * \return string at the offset in the slot, NULL if there is none or it is out of bounds
+     */
+    const char* string(const unsigned char *slot) const {
+        int32_t offset = track_batch_get32(slot);
+        if (offset < 0 || offset >= (int64_t)(m_size - m_strings)) return NULL;
+        const unsigned char *str = m_data + m_strings + offset;
+        if (!memchr(str, '\0', m_size - m_strings - offset)) return NULL;
+        return (const char*)str;
+    }
+
+    const unsigned char *m_data;
+    size_t m_size;
+    size_t m_pos;
+    int m_count;
+    size_t m_strings;
+    const unsigned char *m_record;
+    int m_field_count;
+};
+
+#endif // SUBTITLESOCTOPUS_TRACK_BATCH_H
@@ -0,0 +1,471 @@
+/*
+    SubtitleOctopus.js - binary track snapshots
+
+    A snapshot holds everything needed to recreate a parsed track: script
+    info, styles and events, plus the animation flags and the start time
+    order of events, so loading it skips parsing the script, scanning every
+    event for animation tags and sorting the event index.
+
+    Layout, all values in host byte order (little-endian on wasm):
+      header   "JSOS", version, flags
+      info     track_type, PlayResX, PlayResY, LayoutResX, LayoutResY, Timer,
+               WrapStyle, ScaledBorderAndShadow, Kerning, YCbCrMatrix,
+               Language, name, style_format, event_format
+      styles   count, default_style, then every ASS_Style field in order
+      events   count, then every ASS_Event field in order
+      animated one byte per event
+      order    event ids sorted by start time
+    Integers are 32 bit except event timing (64 bit), reals are doubles and
+    strings are a 32-bit length followed by the bytes, 0xffffffff for NULL.
+
+    Fonts embedded in the script are not part of the snapshot.
+*/
+
+#ifndef SUBTITLESOCTOPUS_TRACK_SNAPSHOT_H
+#define SUBTITLESOCTOPUS_TRACK_SNAPSHOT_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TRACK_SNAPSHOT_MAGIC "JSOS"
+#define TRACK_SNAPSHOT_VERSION 2
+
+// animation flags were computed with animations dropped
+#define TRACK_SNAPSHOT_DROPPED_ANIMATIONS 1
+
+#define TRACK_SNAPSHOT_NULL_STRING 0xffffffffu
+
+// event times beyond +-2^53 ms mark a corrupt snapshot, Start + Duration could overflow
+#define TRACK_SNAPSHOT_TIME_LIMIT 9007199254740992LL
+
+class TrackSnapshotWriter {
+public:
+    TrackSnapshotWriter(): m_data(NULL), m_size(0), m_capacity(0), m_failed(false) {}
+
+    ~TrackSnapshotWriter() {
+        free(m_data);
+    }
+
+    void put32(uint32_t value) {
+        put(&value, sizeof(value));
+    }
+
+    void put64(int64_t value) {
+        put(&value, sizeof(value));
+    }
+
+    void putDouble(double value) {
+        put(&value, sizeof(value));
+    }
+
+    void putString(const char *str) {
+        if (!str) {
+            put32(TRACK_SNAPSHOT_NULL_STRING);
+            return;
+        }
+        uint32_t len = (uint32_t)strlen(str);
+        put32(len);
+        put(str, len);
+    }
+
+    void put(const void *data, size_t size) {
+        if (!reserve(size)) return;
+        memcpy(m_data + m_size, data, size);
+        m_size += size;
+    }
+
+    /**
+     * \brief Write everything put so far into a file
+     * \return true on success
+     */
+    bool save(const char *path) const {
+        if (m_failed) return false;
+        FILE *fp = fopen(path, "wb");
+        if (!fp) {
+            fprintf(stderr, "jso: cannot open %s for writing\n", path);
+            return false;
+        }
+        bool ok = fwrite(m_data, 1, m_size, fp) == m_size;
+        if (fclose(fp) != 0) ok = false;
+        if (!ok) fprintf(stderr, "jso: cannot write %s\n", path);
+        return ok;
+    }
+
+private:
+    bool reserve(size_t size) {
+        if (m_failed) return false;
+        if (m_size + size <= m_capacity) return true;
+        size_t capacity = m_capacity ? m_capacity : 4096;
+        while (capacity < m_size + size) capacity *= 2;
+        unsigned char *data = (unsigned char*)realloc(m_data, capacity);
+        if (!data) {
+            fprintf(stderr, "jso: cannot allocate track snapshot\n");
+            m_failed = true;
+            return false;
+        }
+        m_data = data;
+        m_capacity = capacity;
+        return true;
+    }
+
+    unsigned char *m_data;
+    size_t m_size, m_capacity;
+    bool m_failed;
+};
+
+class TrackSnapshotReader {
+public:
+    TrackSnapshotReader(): m_data(NULL), m_pos(NULL), m_end(NULL), m_failed(false) {}
+
+    ~TrackSnapshotReader() {
+        free(m_data);
+    }
+
+    /**
+     * \brief Read a whole snapshot file into memory
+     * \return true on success
+     */
+    bool load(const char *path) {
+        FILE *fp = fopen(path, "rb");
+        if (!fp) {
+            fprintf(stderr, "jso: cannot open %s\n", path);
+            return false;
+        }
+        long size = -1;
+        if (fseek(fp, 0, SEEK_END) == 0) size = ftell(fp);
+        if (size < 0 || fseek(fp, 0, SEEK_SET) != 0) {
+            fclose(fp);
+            fprintf(stderr, "jso: cannot read %s\n", path);
+            return false;
+        }
+
+        free(m_data);
+        m_data = (unsigned char*)malloc(size ? size : 1);
+        if (!m_data) {
+            fclose(fp);
+            fprintf(stderr, "jso: cannot allocate track snapshot\n");
+            return false;
+        }
+        bool ok = fread(m_data, 1, size, fp) == (size_t)size;
+        fclose(fp);
+        if (!ok) {
+            fprintf(stderr, "jso: cannot read %s\n", path);
+            return false;
+        }
+        m_pos = m_data;
+        m_end = m_data + size;
+        m_failed = false;
+        return true;
+    }
+
+    /**
+     * \brief Whether some read ran past the end of the snapshot
+     */
+    bool failed() const {
+        return m_failed;
+    }
+
+    uint32_t get32() {
+        uint32_t value = 0;
+        get(&value, sizeof(value));
+        return value;
+    }
+
+    int64_t get64() {
+        int64_t value = 0;
+        get(&value, sizeof(value));
+        return value;
+    }
+
+    double getDouble() {
+        double value = 0;
+        get(&value, sizeof(value));
+        return value;
+    }
+
+    /**
+     * \brief Read a string into a newly allocated buffer, NULL if it was NULL or on errors
+     */
+    char *getString() {
+        uint32_t len = get32();
+        if (m_failed || len == TRACK_SNAPSHOT_NULL_STRING) return NULL;
+        if (len > (size_t)(m_end - m_pos)) {
+            m_failed = true;
+            return NULL;
+        }
+        char *str = (char*)malloc(len + 1);
+        if (!str) {
+            m_failed = true;
+            return NULL;
+        }
+        memcpy(str, m_pos, len);
+        str[len] = '\0';
+        m_pos += len;
+        return str;
+    }
+
+    /**
+     * \brief Point at the next `size` bytes and skip them, NULL if there are not enough
+     */
+    const unsigned char *take(size_t size) {
+        if (m_failed || size > (size_t)(m_end - m_pos)) {
+            m_failed = true;
+            return NULL;
+        }
+        const unsigned char *data = m_pos;
+        m_pos += size;
+        return data;
+    }
+
+    void get(void *data, size_t size) {
+        const unsigned char *src = take(size);
+        if (src) memcpy(data, src, size);
+    }
+
+private:
+    unsigned char *m_data;
+    const unsigned char *m_pos, *m_end;
+    bool m_failed;
+};
+
+/**
+ * \brief Replace a string owned by libass
+ */
+static inline void track_snapshot_set_string(char **field, char *value) {
+    free(*field);
+    *field = value;
+}
+
+static void track_snapshot_write_style(TrackSnapshotWriter& out, const ASS_Style *style) {
+    out.putString(style->Name);
+    out.putString(style->FontName);
+    out.putDouble(style->FontSize);
+    out.put32(style->PrimaryColour);
+    out.put32(style->SecondaryColour);
+    out.put32(style->OutlineColour);
+    out.put32(style->BackColour);
+    out.put32(style->Bold);
+    out.put32(style->Italic);
+    out.put32(style->Underline);
+    out.put32(style->StrikeOut);
+    out.putDouble(style->ScaleX);
+    out.putDouble(style->ScaleY);
+    out.putDouble(style->Spacing);
+    out.putDouble(style->Angle);
+    out.put32(style->BorderStyle);
+    out.putDouble(style->Outline);
+    out.putDouble(style->Shadow);
+    out.put32(style->Alignment);
+    out.put32(style->MarginL);
+    out.put32(style->MarginR);
+    out.put32(style->MarginV);
+    out.put32(style->Encoding);
+    out.put32(style->treat_fontname_as_pattern);
+    out.putDouble(style->Blur);
+    out.put32(style->Justify);
+}
+
+static void track_snapshot_read_style(TrackSnapshotReader& in, ASS_Style *style) {
+    track_snapshot_set_string(&style->Name, in.getString());
+    track_snapshot_set_string(&style->FontName, in.getString());
+    style->FontSize = in.getDouble();
+    style->PrimaryColour = in.get32();
+    style->SecondaryColour = in.get32();
+    style->OutlineColour = in.get32();
+    style->BackColour = in.get32();
+    style->Bold = (int32_t)in.get32();
+    style->Italic = (int32_t)in.get32();
+    style->Underline = (int32_t)in.get32();
+    style->StrikeOut = (int32_t)in.get32();
+    style->ScaleX = in.getDouble();
+    style->ScaleY = in.getDouble();
+    style->Spacing = in.getDouble();
+    style->Angle = in.getDouble();
+    style->BorderStyle = (int32_t)in.get32();
+    style->Outline = in.getDouble();
+    style->Shadow = in.getDouble();
+    style->Alignment = (int32_t)in.get32();
+    style->MarginL = (int32_t)in.get32();
+    style->MarginR = (int32_t)in.get32();
+    style->MarginV = (int32_t)in.get32();
+    style->Encoding = (int32_t)in.get32();
+    style->treat_fontname_as_pattern = (int32_t)in.get32();
+    style->Blur = in.getDouble();
+    style->Justify = (int32_t)in.get32();
+}
+
+static void track_snapshot_write_event(TrackSnapshotWriter& out, const ASS_Event *event) {
+    out.put64(event->Start);
+    out.put64(event->Duration);
+    out.put32(event->ReadOrder);
+    out.put32(event->Layer);
+    out.put32(event->Style);
+    out.putString(event->Name);
+    out.put32(event->MarginL);
+    out.put32(event->MarginR);
+    out.put32(event->MarginV);
+    out.putString(event->Effect);
+    out.putString(event->Text);
+}
+
+static void track_snapshot_read_event(TrackSnapshotReader& in, ASS_Event *event) {
+    event->Start = in.get64();
+    event->Duration = in.get64();
+    event->ReadOrder = (int32_t)in.get32();
+    event->Layer = (int32_t)in.get32();
+    event->Style = (int32_t)in.get32();
+    track_snapshot_set_string(&event->Name, in.getString());
+    event->MarginL = (int32_t)in.get32();
+    event->MarginR = (int32_t)in.get32();
+    event->MarginV = (int32_t)in.get32();
+    track_snapshot_set_string(&event->Effect, in.getString());
+    track_snapshot_set_string(&event->Text, in.getString());
+}
+
+/**
+ * \brief Serialize a track
+ * \param animated animation flag of every event
+ * \param order    event ids sorted by start time
+ * \param flags    TRACK_SNAPSHOT_* flags
+ */
+static void track_snapshot_write(TrackSnapshotWriter& out, const ASS_Track *track,
+                                 const int *animated, const int *order, uint32_t flags) {
+    out.put(TRACK_SNAPSHOT_MAGIC, 4);
+    out.put32(TRACK_SNAPSHOT_VERSION);
+    out.put32(flags);
+
+    out.put32(track->track_type);
+    out.put32(track->PlayResX);
+    out.put32(track->PlayResY);
+    out.put32(track->LayoutResX);
+    out.put32(track->LayoutResY);
+    out.putDouble(track->Timer);
+    out.put32(track->WrapStyle);
+    out.put32(track->ScaledBorderAndShadow);
+    out.put32(track->Kerning);
+    out.put32(track->YCbCrMatrix);
+    out.putString(track->Language);
+    out.putString(track->name);
+    out.putString(track->style_format);
+    out.putString(track->event_format);
+
+    out.put32(track->n_styles);
+    out.put32(track->default_style);
+    for (int i = 0; i < track->n_styles; i++) {
+        track_snapshot_write_style(out, track->styles + i);
+    }
+
+    out.put32(track->n_events);
+    for (int i = 0; i < track->n_events; i++) {
+        track_snapshot_write_event(out, track->events + i);
+    }
+    for (int i = 0; i < track->n_events; i++) {
+        unsigned char flag = animated[i] ? 1 : 0;
+        out.put(&flag, 1);
+    }
+    for (int i = 0; i < track->n_events; i++) {
+        out.put32(order[i]);
+    }
+}
+
+/**
+ * \brief Recreate a track from a snapshot
+ * \param animated receives a malloc'ed array with the animation flag of every event
+ * \param order    receives a malloc'ed array of event ids sorted by start time
+ * \param flags    receives the TRACK_SNAPSHOT_* flags
+ * \return the track or NULL if the snapshot is not valid
+ */
+static ASS_Track *track_snapshot_read(TrackSnapshotReader& in, ASS_Library *library,
+                                      int **animated, int **order, uint32_t *flags) {
+    *animated = NULL;
+    *order = NULL;
+
+    const unsigned char *magic = in.take(4);
+    if (!magic || memcmp(magic, TRACK_SNAPSHOT_MAGIC, 4) != 0) {
+        fprintf(stderr, "jso: not a track snapshot\n");
+        return NULL;
+    }
+    uint32_t version = in.get32();
+    if (version != TRACK_SNAPSHOT_VERSION) {
+        fprintf(stderr, "jso: unsupported track snapshot version %u\n", version);
+        return NULL;
+    }
+    *flags = in.get32();
+
+    ASS_Track *track = ass_new_track(library);
+    if (!track) {
+        fprintf(stderr, "jso: cannot allocate track\n");
+        return NULL;
+    }
+
+    uint32_t track_type = in.get32();
+    track->track_type = track_type == ASS_Track::TRACK_TYPE_SSA ? ASS_Track::TRACK_TYPE_SSA : ASS_Track::TRACK_TYPE_ASS;
+    track->PlayResX = (int32_t)in.get32();
+    track->PlayResY = (int32_t)in.get32();
+    track->LayoutResX = (int32_t)in.get32();
+    track->LayoutResY = (int32_t)in.get32();
+    track->Timer = in.getDouble();
+    track->WrapStyle = (int32_t)in.get32();
+    track->ScaledBorderAndShadow = (int32_t)in.get32();
+    track->Kerning = (int32_t)in.get32();
+    track->YCbCrMatrix = (int32_t)in.get32();
+    track_snapshot_set_string(&track->Language, in.getString());
+    track_snapshot_set_string(&track->name, in.getString());
+    track_snapshot_set_string(&track->style_format, in.getString());
+    track_snapshot_set_string(&track->event_format, in.getString());
+
+    int n_styles = (int32_t)in.get32();
+    int default_style = (int32_t)in.get32();
+    for (int i = 0; i < n_styles && !in.failed(); i++) {
+        int sid = ass_alloc_style(track);
+        if (sid < 0) break;
+        track_snapshot_read_style(in, track->styles + sid);
+    }
+    track->default_style = default_style >= 0 && default_style < track->n_styles ? default_style : 0;
+
+    int n_events = (int32_t)in.get32();
+    bool times_valid = true;
+    for (int i = 0; i < n_events && !in.failed() && times_valid; i++) {
+        int eid = ass_alloc_event(track);
+        if (eid < 0) break;
+        ASS_Event *event = track->events + eid;
+        track_snapshot_read_event(in, event);
+        times_valid = event->Start >= -TRACK_SNAPSHOT_TIME_LIMIT && event->Start <= TRACK_SNAPSHOT_TIME_LIMIT &&
+                      event->Duration >= -TRACK_SNAPSHOT_TIME_LIMIT && event->Duration <= TRACK_SNAPSHOT_TIME_LIMIT;
+    }
+
+    const unsigned char *flag = in.take(n_events);
+    const unsigned char *ids = in.take(sizeof(int32_t) * (size_t)n_events);
+    if (!times_valid) {
+        fprintf(stderr, "jso: corrupt track snapshot\n");
+        ass_free_track(track);
+        return NULL;
+    }
+    if (in.failed() || track->n_styles != n_styles || track->n_events != n_events) {
+        fprintf(stderr, "jso: truncated track snapshot\n");
+        ass_free_track(track);
+        return NULL;
+    }
+
+    *animated = (int*)malloc(sizeof(int) * (n_events ? n_events : 1));
+    *order = (int*)malloc(sizeof(int) * (n_events ? n_events : 1));
+    if (!*animated || !*order) {
+        fprintf(stderr, "jso: cannot allocate track snapshot\n");
+        free(*animated);
+        free(*order);
+        *animated = *order = NULL;
+        ass_free_track(track);
+        return NULL;
+    }
+    for (int i = 0; i < n_events; i++) {
+        int32_t id;
+        memcpy(&id, ids + sizeof(int32_t) * i, sizeof(id));
+        (*animated)[i] = flag[i];
+        (*order)[i] = id;
+    }
+    return track;
+}
+
+#endif // SUBTITLESOCTOPUS_TRACK_SNAPSHOT_H
@@ -0,0 +1,105 @@
+/*
+    SubtitleOctopus.js - event index tests
+
+    The index only notes inserts, updates and removals and catches up on
+    the next query. Random changes, some queried after each and some in
+    long runs like a track batch, have to give the same answers as
+    looking at every event of the track.
+*/
+
+#include "test.h"
+
+struct ActiveCollector {
+    int count;
+    long long sum; // of event ids, to tell apart sets of the same size
+
+    bool operator()(int eid, long long, long long) {
+        count++;
+        sum += eid;
+        return true;
+    }
+};
+
+static void check_queries(EventIndex& index, const ASS_Track *track, long long now) {
+    long long next = -1;
+    int count = 0;
+    long long sum = 0;
+    for (int eid = 0; eid < track->n_events; eid++) {
+        const ASS_Event *event = track->events + eid;
+        if (event->Start > now && (next == -1 || event->Start < next)) next = event->Start;
+        if (event->Start <= now && now < event->Start + event->Duration) {
+            count++;
+            sum += eid;
+        }
+    }
+
+    ActiveCollector active = {0, 0};
+    index.forEachActive(now, active);
+    bool same = index.nextStart(now) == next && active.count == count && active.sum == sum;
+    CHECK(same);
+    if (!same) printf("  at %lld with %d events\n", now, track->n_events);
+}
+
+static void set_timing(EventIndex& index, ASS_Track *track, int eid, unsigned *state) {
+    ASS_Event *event = track->events + eid;
+    event->Start = test_random(state) % 200 * 50;
+    event->Duration = 1 + test_random(state) % 40 * 50;
+    index.update(eid);
+}
+
+/**
+ * \brief Remove the events finished at or before `before`, the way evictEvents does
+ */
+static void evict(EventIndex& index, ASS_Track *track, long long before) {
+    int *remap = (int*)malloc(sizeof(int) * (track->n_events ? track->n_events : 1));
+    int kept = 0;
+    for (int eid = 0; eid < track->n_events; eid++) {
+        ASS_Event *event = track->events + eid;
+        if (event->Start + event->Duration <= before) {
+            ass_free_event(track, eid);
+            remap[eid] = -1;
+            continue;
+        }
+        remap[eid] = kept;
+        track->events[kept++] = *event;
+    }
+    track->n_events = kept;
+    index.compact(remap);
+    free(remap);
+}
+
+int main() {
+    ASS_Library *library = ass_library_init();
+    ASS_Track *track = ass_new_track(library);
+    EventIndex index;
+    index.build(track);
+
+    unsigned state = 3;
+    for (int round = 0; round < 3000; round++) {
+        // mostly single changes, every few rounds a run of them
+        int changes = round % 10 == 0 ? 1 + test_random(&state) % 200 : 1;
+        for (int i = 0; i < changes; i++) {
+            int n = track->n_events;
+            int what = test_random(&state) % 10;
+            if (n == 0 || what < 4) {
+                int eid = ass_alloc_event(track);
+                index.add(eid);
+                set_timing(index, track, eid, &state);
+            } else if (what < 8) {
+                set_timing(index, track, test_random(&state) % n, &state);
+            } else {
+                int eid = test_random(&state) % n;
+                ass_free_event(track, eid);
+                memmove(track->events + eid, track->events + eid + 1, sizeof(ASS_Event) * (n - eid - 1));
+                track->n_events--;
+                index.remove(eid);
+            }
+        }
+        if (round % 100 == 50) evict(index, track, test_random(&state) % 200 * 50);
+        check_queries(index, track, test_random(&state) % 220 * 50 - 500);
+        check_queries(index, track, test_random(&state) % 11000);
+    }
+    ass_free_track(track);
+    ass_library_done(library);
+    return test_result("event-index");
+}
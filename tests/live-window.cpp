@@ -0,0 +1,59 @@
+/*
+    SubtitleOctopus.js - live window tests
+
+    A live track grows for as long as the stream runs; with a live window
+    set, every way of rendering it has to evict what went out of the
+    window, not only renderImage.
+*/
+
+#include "test.h"
+
+static void add_event(SubtitleOctopus& octopus, int second) {
+    int eid = octopus.allocEvent();
+    ASS_Event *event = octopus.track->events + eid;
+    event->Start = second * 1000LL;
+    event->Duration = 1500;
+    event->ReadOrder = second;
+    event->Text = strdup(second % 3 ? "live" : "{\\fad(100,100)}live");
+    octopus.updateEvent(eid);
+}
+
+enum RenderPath { RENDER_IMAGE, RENDER_BLEND, RENDER_ATLAS };
+
+/**
+ * \brief Stream an event a second for ten minutes, rendering only through `path`
+ */
+static void test_bounded(RenderPath path) {
+    SubtitleOctopus octopus;
+    octopus.initLibrary(640, 360);
+    octopus.createTrackStream();
+    octopus.track->track_type = ASS_Track::TRACK_TYPE_ASS;
+    octopus.setLiveWindow(5);
+
+    int most = 0;
+    for (int second = 0; second < 600; second++) {
+        add_event(octopus, second);
+        for (double tm = second; tm < second + 1; tm += 0.25) {
+            int changed;
+            switch (path) {
+                case RENDER_IMAGE: octopus.renderImage(tm, &changed); break;
+                case RENDER_BLEND: octopus.renderBlend(tm, 1); break;
+                case RENDER_ATLAS: octopus.renderAtlas(tm, 1); break;
+            }
+        }
+        if (octopus.getEventCount() > most) most = octopus.getEventCount();
+    }
+    // the window and the events still showing, not the whole stream
+    CHECK(most <= 8);
+    CHECK(octopus.getEventCount() >= 5);
+    CHECK(octopus.findNextEventStart(590) == -1 || octopus.findNextEventStart(590) >= 590);
+    if (most > 8) printf("  path %d kept up to %d events\n", (int)path, most);
+    octopus.quitLibrary();
+}
+
+int main() {
+    test_bounded(RENDER_IMAGE);
+    test_bounded(RENDER_BLEND);
+    test_bounded(RENDER_ATLAS);
+    return test_result("live-window");
+}
@@ -0,0 +1,195 @@
+/*
+    SubtitleOctopus.js - override tag scanner tests
+
+    OverrideTagScanner replaced loops which looked at every character of an
+    event text for braces and backslashes. Those loops are kept here as the
+    reference, and both have to agree on texts put together from pieces of
+    tags, text and stray braces.
+*/
+
+#include <string>
+#include <vector>
+
+#include "test.h"
+
+struct TagSpan {
+    long name, end; // offsets into the text
+};
+
+/**
+ * \brief Tags of the closed blocks, found one character at a time
+ */
+static std::vector<TagSpan> reference_tags(const char *text) {
+    std::vector<TagSpan> tags;
+    const char *block_start = NULL; // points to opening {
+    for (const char *p = text; *p != '\0'; p++) {
+        if (*p == '{') {
+            if (!block_start && (p == text || *(p-1) != '\\'))
+                block_start = p;
+        } else if (*p == '}') {
+            if (block_start && p - block_start > 2) {
+                const char *tag_start = NULL; // points to beginning backslash
+                for (const char *q = block_start + 1; q <= p; q++) {
+                    if (*q != '\\' && q != p) continue;
+                    if (tag_start) tags.push_back(TagSpan{tag_start + 1 - text, q - 1 - text});
+                    tag_start = q;
+                }
+            }
+            block_start = NULL;
+        }
+    }
+    return tags;
+}
+
+static bool reference_is_block_animated(char *start, char *end, bool drop_animations) {
+    char *tag_start = NULL;
+    for (char *p = start; p <= end; p++) {
+        if (*p == '\\') {
+            if (tag_start && _is_animated_tag(tag_start + 1, p - 1)) {
+                if (!drop_animations)
+                    return true;
+                _remove_tag(tag_start, p - 1);
+            }
+            tag_start = p;
+        }
+    }
+
+    if (tag_start && _is_animated_tag(tag_start + 1, end)) {
+        if (!drop_animations)
+            return true;
+        _remove_tag(tag_start, end);
+    }
+
+    return false;
+}
+
+static bool reference_is_event_animated(ASS_Event *event, bool drop_animations) {
+    if (event->Effect && event->Effect[0] != '\0') {
+        if (!drop_animations) return true;
+        event->Effect[0] = '\0';
+    }
+    if (!event->Text) return false;
+
+    char *block_start = NULL;
+    for (char *p = event->Text; *p != '\0'; p++) {
+        switch (*p) {
+            case '{':
+                if (!block_start && (p == event->Text || *(p-1) != '\\'))
+                    block_start = p;
+                break;
+            case '}':
+                if (block_start && p - block_start > 2
+                        && reference_is_block_animated(block_start + 1, p - 1, drop_animations))
+                    return true;
+                block_start = NULL;
+                break;
+            default:
+                break;
+        }
+    }
+
+    return false;
+}
+
+static void reference_animation_times(const ASS_Event *event, AnimationTimes& times) {
+    if (event->Effect && event->Effect[0] != '\0') {
+        times.add(0, times.duration);
+        return;
+    }
+    if (!event->Text) return;
+
+    long long karaoke = 0;
+    std::vector<TagSpan> tags = reference_tags(event->Text);
+    for (size_t i = 0; i < tags.size(); i++) {
+        char *name = event->Text + tags[i].name, *end = event->Text + tags[i].end;
+        if (_is_animated_tag(name, end)) _add_tag_animation(name, end, &karaoke, times);
+    }
+}
+
+static const char *pieces[] = {
+    "{", "}", "\\", "\\{", "\\k20", "\\K30", "\\kf10", "\\ko15", "\\kt40", "\\t(0,500,\\fs20)", "\\t(\\1c&HFF&)",
+    "\\move(1,2,3,4)", "\\move(1,2,3,4,100,200)", "\\fad(100,200)", "\\fade(1,2,3,4,5,6,7)", "\\fnArial",
+    "\\fs20", "\\b1", "text", " ", "\\N", "\\pos(1,2)", "x", "\\t", "\\frz30", "\\\\", "{}", "{\\}"
+};
+#define PIECE_COUNT ((int)(sizeof(pieces) / sizeof(pieces[0])))
+
+static std::string random_text(unsigned *state) {
+    std::string text;
+    int count = test_random(state) % 14;
+    for (int i = 0; i < count; i++) text += pieces[test_random(state) % PIECE_COUNT];
+    return text;
+}
+
+static void check_tags(const std::string& text) {
+    std::vector<char> buffer(text.begin(), text.end());
+    buffer.push_back('\0');
+    std::vector<TagSpan> expected = reference_tags(buffer.data());
+
+    OverrideTagScanner scanner(buffer.data());
+    OverrideTag tag;
+    size_t i = 0;
+    bool same = true;
+    while (scanner.next(&tag)) {
+        same = same && i < expected.size() && tag.name - buffer.data() == expected[i].name &&
+               tag.end - buffer.data() == expected[i].end;
+        i++;
+    }
+    same = same && i == expected.size();
+    CHECK(same);
+    if (!same) printf("  tags of \"%s\"\n", text.c_str());
+}
+
+static void check_animation(const std::string& text, bool with_effect) {
+    for (int drop = 0; drop < 2; drop++) {
+        std::vector<char> a(text.begin(), text.end()), b(text.begin(), text.end());
+        a.push_back('\0');
+        b.push_back('\0');
+        char effect_a[] = "Banner;10", effect_b[] = "Banner;10";
+        if (!with_effect) effect_a[0] = effect_b[0] = '\0';
+        ASS_Event x = {}, y = {};
+        x.Text = a.data();
+        x.Effect = effect_a;
+        y.Text = b.data();
+        y.Effect = effect_b;
+
+        bool expected = reference_is_event_animated(&x, drop);
+        FontNames fonts;
+        bool animated = _is_event_animated(&y, drop, drop ? NULL : &fonts);
+        bool same = animated == expected && !strcmp(a.data(), b.data()) && !strcmp(effect_a, effect_b);
+        if (!drop) same = same && _is_event_animated(&y, false) == expected;
+        CHECK(same);
+        if (!same) printf("  animation of \"%s\", dropping %d\n", text.c_str(), drop);
+        if (drop) continue;
+
+        for (long long now = -1; now < 1100; now += 37) {
+            AnimationTimes t1(now, 1000), t2(now, 1000);
+            reference_animation_times(&x, t1);
+            _event_animation_times(&y, t2);
+            same = t1.active == t2.active && t1.next == t2.next;
+            CHECK(same);
+            if (!same) {
+                printf("  animation times of \"%s\" at %lld\n", text.c_str(), now);
+                break;
+            }
+        }
+    }
+}
+
+int main() {
+    static const char *fixed[] = {
+        "", "{", "}", "{}", "{\\}", "{\\k}", "\\{\\move(1,2,3,4)}", "{\\move(1,2,3,4)", "{{\\fad(1,2)}}",
+        "{\\b1\\\\\\t(\\fs20)}x", "a{\\k10}b{\\k20}c{\\kt5\\k10}d", "{\\fad(100,200)}{\\fnArial}"
+    };
+    for (size_t i = 0; i < sizeof(fixed) / sizeof(fixed[0]); i++) {
+        check_tags(fixed[i]);
+        check_animation(fixed[i], false);
+    }
+
+    unsigned state = 7;
+    for (int round = 0; round < 40000; round++) {
+        std::string text = random_text(&state);
+        check_tags(text);
+        check_animation(text, round % 16 == 0);
+    }
+    return test_result("override-tags");
+}
@@ -0,0 +1,109 @@
+/*
+    SubtitleOctopus.js - native tests
+
+    Each test is a program of its own which includes the core the way the
+    tools do and links against the libass of the host system. CHECK reports
+    a failed condition and carries on; test_result() turns the failures into
+    the exit status.
+*/
+
+#ifndef SUBTITLESOCTOPUS_TEST_H
+#define SUBTITLESOCTOPUS_TEST_H
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../src/SubtitleOctopus.cpp"
+
+static int test_checks = 0;
+static int test_failures = 0;
+
+#define CHECK(cond) do { \
+        test_checks++; \
+        if (!(cond)) { \
+            printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            test_failures++; \
+        } \
+    } while (0)
+
+// sanitizer reports go to stdout, as stderr is silenced while feeding broken
+// input; leaks are not checked, fontconfig keeps some memory until exit
+extern "C" const char *__asan_default_options() {
+    return "log_path=stdout:detect_leaks=0";
+}
+extern "C" const char *__ubsan_default_options() {
+    return "log_path=stdout:print_stacktrace=1";
+}
+
+/**
+ * \brief Silence stderr, e.g. the complaints about every corrupt buffer fed
+ * \param quiet false to bring it back
+ */
+static inline void test_quiet(bool quiet) {
+    static int saved = -1;
+    fflush(stderr);
+    if (quiet && saved < 0) {
+        int null = open("/dev/null", O_WRONLY);
+        if (null < 0) return;
+        saved = dup(2);
+        dup2(null, 2);
+        close(null);
+    } else if (!quiet && saved >= 0) {
+        dup2(saved, 2);
+        close(saved);
+        saved = -1;
+    }
+}
+
+/**
+ * \brief Path of a scratch file named after the test and its process
+ */
+static inline const char *test_temp_path(const char *name) {
+    static char path[256];
+    const char *dir = getenv("TMPDIR");
+    snprintf(path, sizeof(path), "%s/octopus-%s-%d", dir && *dir ? dir : "/tmp", name, (int)getpid());
+    return path;
+}
+
+static inline bool test_write_file(const char *path, const void *data, size_t size) {
+    FILE *fp = fopen(path, "wb");
+    if (!fp) return false;
+    bool ok = fwrite(data, 1, size, fp) == size;
+    return fclose(fp) == 0 && ok;
+}
+
+/**
+ * \brief Whole contents of a file, malloc'ed; NULL if it cannot be read
+ */
+static inline unsigned char *test_read_file(const char *path, size_t *size) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return NULL;
+    fseek(fp, 0, SEEK_END);
+    long length = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    unsigned char *data = length >= 0 ? (unsigned char*)malloc(length ? length : 1) : NULL;
+    if (data && fread(data, 1, length, fp) != (size_t)length) {
+        free(data);
+        data = NULL;
+    }
+    fclose(fp);
+    *size = data ? (size_t)length : 0;
+    return data;
+}
+
+/**
+ * \brief Small deterministic generator, so failures can be replayed
+ */
+static inline unsigned test_random(unsigned *state) {
+    *state = *state * 1103515245u + 12345u;
+    return (*state >> 16) & 0x7fff;
+}
+
+static inline int test_result(const char *name) {
+    printf("%s: %d checks, %d failed\n", name, test_checks, test_failures);
+    return test_failures ? 1 : 0;
+}
+
+#endif // SUBTITLESOCTOPUS_TEST_H
@@ -0,0 +1,315 @@
+/*
+    SubtitleOctopus.js - batched track change tests
+
+    Applies batches packed the way _packTrackBatch in subtitles-octopus.js
+    does and compares the track with the same changes made one by one.
+    Truncated and corrupted batches have to stop at the first bad record
+    without touching memory they do not own.
+*/
+
+#include <string>
+#include <vector>
+
+#include "test.h"
+
+/**
+ * \brief Builds a batch, see the layout in track_batch.h
+ */
+class BatchPacker {
+public:
+    BatchPacker(): m_count(0) {}
+
+    /**
+     * \return offset of the first field slot of the record
+     */
+    size_t record(int op, int index, int fields) {
+        size_t at = m_records.size();
+        m_records.resize(at + TRACK_BATCH_RECORD_HEADER + fields * TRACK_BATCH_SLOT);
+        put32(at, op);
+        put32(at + 4, index);
+        m_count++;
+        return at + TRACK_BATCH_RECORD_HEADER;
+    }
+
+    void setInt(size_t slot, int field, int32_t value) {
+        put32(slot + field * TRACK_BATCH_SLOT, value);
+        mark(slot, field);
+    }
+
+    void setDouble(size_t slot, int field, double value) {
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        for (int i = 0; i < 8; i++) m_records[slot + field * TRACK_BATCH_SLOT + i] = (bits >> (8 * i)) & 0xff;
+        mark(slot, field);
+    }
+
+    void setString(size_t slot, int field, const char *value) {
+        if (!value) {
+            setInt(slot, field, -1);
+            return;
+        }
+        setInt(slot, field, (int32_t)m_strings.size());
+        m_strings.append(value);
+        m_strings.push_back('\0');
+    }
+
+    std::vector<unsigned char> done() const {
+        std::vector<unsigned char> batch(TRACK_BATCH_HEADER);
+        uint32_t count = m_count, strings = TRACK_BATCH_HEADER + m_records.size();
+        for (int i = 0; i < 4; i++) {
+            batch[i] = (count >> (8 * i)) & 0xff;
+            batch[4 + i] = (strings >> (8 * i)) & 0xff;
+        }
+        batch.insert(batch.end(), m_records.begin(), m_records.end());
+        batch.insert(batch.end(), m_strings.begin(), m_strings.end());
+        return batch;
+    }
+
+private:
+    void put32(size_t at, int32_t value) {
+        for (int i = 0; i < 4; i++) m_records[at + i] = ((uint32_t)value >> (8 * i)) & 0xff;
+    }
+
+    void mark(size_t slot, int field) {
+        size_t at = slot - TRACK_BATCH_RECORD_HEADER + 8;
+        uint32_t mask = 0;
+        for (int i = 0; i < 4; i++) mask |= (uint32_t)m_records[at + i] << (8 * i);
+        put32(at, (int32_t)(mask | 1u << field));
+    }
+
+    std::vector<unsigned char> m_records;
+    std::string m_strings;
+    int m_count;
+};
+
+// field positions in track_batch_event_fields / track_batch_style_fields
+enum { EV_START, EV_DURATION, EV_READ_ORDER, EV_LAYER, EV_STYLE, EV_NAME, EV_MARGIN_L,
+       EV_MARGIN_R, EV_MARGIN_V, EV_EFFECT, EV_TEXT };
+enum { ST_NAME, ST_FONT_NAME, ST_FONT_SIZE, ST_PRIMARY_COLOUR };
+
+static const char *texts[] = {
+    "plain", "{\\move(1,2,3,4)}moving", "{\\fad(100,100)}fading", "{\\k10}ka{\\k20}ra", "{\\b1}bold"
+};
+#define TEXT_COUNT ((int)(sizeof(texts) / sizeof(texts[0])))
+
+static void pack_event(BatchPacker& packer, int op, int index, int i) {
+    size_t slot = packer.record(op, index, TRACK_BATCH_EVENT_FIELDS);
+    packer.setDouble(slot, EV_START, (i * 37 % 50) * 400.0);
+    packer.setDouble(slot, EV_DURATION, 1000.0 + i % 3 * 250);
+    packer.setInt(slot, EV_READ_ORDER, i);
+    packer.setInt(slot, EV_LAYER, i % 2);
+    packer.setString(slot, EV_NAME, i % 3 ? "Actor" : NULL);
+    packer.setInt(slot, EV_MARGIN_V, -i);
+    packer.setString(slot, EV_EFFECT, "");
+    packer.setString(slot, EV_TEXT, texts[i % TEXT_COUNT]);
+}
+
+/**
+ * \brief What pack_event sends, done through the API of the instance
+ */
+static void set_event(SubtitleOctopus& octopus, int eid, int i) {
+    ASS_Event *event = octopus.track->events + eid;
+    event->Start = (i * 37 % 50) * 400;
+    event->Duration = 1000 + i % 3 * 250;
+    event->ReadOrder = i;
+    event->Layer = i % 2;
+    free(event->Name);
+    event->Name = i % 3 ? strdup("Actor") : NULL;
+    event->MarginV = -i;
+    free(event->Effect);
+    event->Effect = strdup("");
+    free(event->Text);
+    event->Text = strdup(texts[i % TEXT_COUNT]);
+    octopus.updateEvent(eid);
+}
+
+static bool same_string(const char *a, const char *b) {
+    return a == b || (a && b && !strcmp(a, b));
+}
+
+static void check_same_track(SubtitleOctopus& a, SubtitleOctopus& b) {
+    CHECK(a.track->n_events == b.track->n_events && a.track->n_styles == b.track->n_styles);
+    for (int i = 0; i < a.track->n_events && i < b.track->n_events; i++) {
+        const ASS_Event *x = a.track->events + i, *y = b.track->events + i;
+        CHECK(x->Start == y->Start && x->Duration == y->Duration && x->ReadOrder == y->ReadOrder);
+        CHECK(x->Layer == y->Layer && x->MarginV == y->MarginV);
+        CHECK(same_string(x->Name, y->Name) && same_string(x->Effect, y->Effect) && same_string(x->Text, y->Text));
+    }
+    for (int i = 0; i < a.track->n_styles && i < b.track->n_styles; i++) {
+        const ASS_Style *x = a.track->styles + i, *y = b.track->styles + i;
+        CHECK(same_string(x->Name, y->Name) && same_string(x->FontName, y->FontName));
+        CHECK(x->FontSize == y->FontSize && x->PrimaryColour == y->PrimaryColour);
+    }
+    for (double tm = -1; tm < 25; tm += 0.25) {
+        CHECK(a.findNextEventStart(tm) == b.findNextEventStart(tm));
+        EventStopTimesResult x = *a.findEventStopTimes(tm), y = *b.findEventStopTimes(tm);
+        CHECK(x.eventFinish == y.eventFinish && x.emptyFinish == y.emptyFinish && x.is_animated == y.is_animated);
+    }
+}
+
+static void start_track(SubtitleOctopus& octopus) {
+    octopus.initLibrary(640, 360);
+    octopus.createTrackStream();
+    int sid = octopus.allocStyle();
+    octopus.track->styles[sid].Name = strdup("Default");
+    octopus.track->styles[sid].FontName = strdup("Arial");
+    octopus.track->styles[sid].FontSize = 20;
+}
+
+/**
+ * \brief A batch of inserts, updates, deletes and style changes, applied one by one to `expected`
+ */
+static std::vector<unsigned char> make_batch(SubtitleOctopus& expected, int *records) {
+    BatchPacker packer;
+    for (int i = 0; i < 40; i++) {
+        pack_event(packer, TRACK_BATCH_EVENT_INSERT, -1, i);
+        set_event(expected, expected.allocEvent(), i);
+    }
+    for (int i = 0; i < 40; i += 7) {
+        pack_event(packer, TRACK_BATCH_EVENT_UPDATE, i, i + 100);
+        set_event(expected, i, i + 100);
+    }
+    for (int i = 30; i > 0; i -= 9) {
+        packer.record(TRACK_BATCH_EVENT_DELETE, i, TRACK_BATCH_EVENT_FIELDS);
+        expected.removeEvent(i);
+    }
+
+    size_t slot = packer.record(TRACK_BATCH_STYLE_INSERT, -1, TRACK_BATCH_STYLE_FIELDS);
+    packer.setString(slot, ST_NAME, "Sign");
+    packer.setString(slot, ST_FONT_NAME, "Comic Sans");
+    packer.setDouble(slot, ST_FONT_SIZE, 31.5);
+    int sid = expected.allocStyle();
+    expected.track->styles[sid].Name = strdup("Sign");
+    expected.track->styles[sid].FontName = strdup("Comic Sans");
+    expected.track->styles[sid].FontSize = 31.5;
+
+    slot = packer.record(TRACK_BATCH_STYLE_UPDATE, 0, TRACK_BATCH_STYLE_FIELDS);
+    packer.setInt(slot, ST_PRIMARY_COLOUR, (int32_t)0xff00ff00u);
+    expected.track->styles[0].PrimaryColour = 0xff00ff00u;
+
+    *records = 40 + 6 + 4 + 2;
+    return packer.done();
+}
+
+static void test_round_trip() {
+    SubtitleOctopus a, b;
+    start_track(a);
+    start_track(b);
+    int records;
+    std::vector<unsigned char> batch = make_batch(b, &records);
+    CHECK(a.applyTrackBatch(batch.data(), (int)batch.size()) == records);
+    check_same_track(a, b);
+    a.quitLibrary();
+    b.quitLibrary();
+}
+
+/**
+ * \brief Apply a single event record to a fresh track
+ * \return records applied
+ */
+static int apply_event(SubtitleOctopus& octopus, int op, int index, int field, double time, int32_t value) {
+    BatchPacker packer;
+    size_t slot = packer.record(op, index, TRACK_BATCH_EVENT_FIELDS);
+    packer.setString(slot, EV_TEXT, "text");
+    if (field == EV_START || field == EV_DURATION) {
+        packer.setDouble(slot, field, time);
+    } else if (field >= 0) {
+        packer.setInt(slot, field, value);
+    }
+    std::vector<unsigned char> batch = packer.done();
+    return octopus.applyTrackBatch(batch.data(), (int)batch.size());
+}
+
+static void test_bad_records() {
+    SubtitleOctopus a;
+    start_track(a);
+    test_quiet(true);
+
+    // string offsets outside of the table, or anything negative but -1
+    CHECK(apply_event(a, TRACK_BATCH_EVENT_INSERT, -1, EV_NAME, 0, 1 << 20) == 0);
+    CHECK(apply_event(a, TRACK_BATCH_EVENT_INSERT, -1, EV_NAME, 0, -5) == 0);
+    CHECK(apply_event(a, TRACK_BATCH_EVENT_INSERT, -1, EV_NAME, 0, INT32_MIN) == 0);
+    CHECK(apply_event(a, TRACK_BATCH_EVENT_INSERT, -1, EV_NAME, 0, -1) == 1);
+    CHECK(a.getEventCount() == 1);
+
+    // unknown ops and positions which do not exist
+    CHECK(apply_event(a, 0, 0, -1, 0, 0) == 0);
+    CHECK(apply_event(a, 99, 0, -1, 0, 0) == 0);
+    CHECK(apply_event(a, -3, 0, -1, 0, 0) == 0);
+    CHECK(apply_event(a, TRACK_BATCH_EVENT_UPDATE, 1, -1, 0, 0) == 0);
+    CHECK(apply_event(a, TRACK_BATCH_EVENT_UPDATE, -1, -1, 0, 0) == 0);
+    CHECK(apply_event(a, TRACK_BATCH_EVENT_DELETE, 5, -1, 0, 0) == 0);
+    CHECK(apply_event(a, TRACK_BATCH_STYLE_UPDATE, 7, -1, 0, 0) == 0);
+    CHECK(a.getEventCount() == 1);
+
+    // times which are not finite are rejected, huge ones clamped so Start + Duration fits
+    CHECK(apply_event(a, TRACK_BATCH_EVENT_UPDATE, 0, EV_START, NAN, 0) == 0);
+    CHECK(apply_event(a, TRACK_BATCH_EVENT_UPDATE, 0, EV_DURATION, -INFINITY, 0) == 0);
+    CHECK(apply_event(a, TRACK_BATCH_EVENT_UPDATE, 0, EV_START, 1e300, 0) == 1);
+    CHECK(apply_event(a, TRACK_BATCH_EVENT_UPDATE, 0, EV_DURATION, 9.3e18, 0) == 1);
+    CHECK(a.track->events[0].Start == 9007199254740992LL && a.track->events[0].Duration == 9007199254740992LL);
+    CHECK(a.findNextEventStart(0) == 9007199254740.992);
+    CHECK(apply_event(a, TRACK_BATCH_EVENT_UPDATE, 0, EV_START, -1e300, 0) == 1);
+    CHECK(a.track->events[0].Start == -9007199254740992LL);
+    CHECK(a.findEventStopTimes(-1)->eventFinish == 0);
+
+    // a string table without the final NUL
+    BatchPacker packer;
+    size_t slot = packer.record(TRACK_BATCH_EVENT_INSERT, -1, TRACK_BATCH_EVENT_FIELDS);
+    packer.setString(slot, EV_TEXT, "unterminated");
+    std::vector<unsigned char> batch = packer.done();
+    CHECK(a.applyTrackBatch(batch.data(), (int)batch.size() - 1) == 0);
+
+    // headers pointing past the batch
+    CHECK(a.applyTrackBatch(batch.data(), 4) == 0);
+    batch[4] = 0xff;
+    CHECK(a.applyTrackBatch(batch.data(), (int)batch.size()) == 0);
+    CHECK(a.applyTrackBatch(NULL, 0) == 0);
+    CHECK(a.getEventCount() == 1);
+
+    test_quiet(false);
+    a.quitLibrary();
+}
+
+static void test_corrupt() {
+    SubtitleOctopus expected;
+    start_track(expected);
+    int records;
+    std::vector<unsigned char> valid = make_batch(expected, &records);
+    expected.quitLibrary();
+
+    test_quiet(true);
+    // every truncation stops at the first record which does not fit
+    for (size_t length = 0; length < valid.size(); length += 3) {
+        SubtitleOctopus a;
+        start_track(a);
+        std::vector<unsigned char> batch(valid.begin(), valid.begin() + length);
+        CHECK(a.applyTrackBatch(batch.data(), (int)batch.size()) < records);
+        a.quitLibrary();
+    }
+
+    // random damage may reject records, but must not do more
+    SubtitleOctopus a;
+    start_track(a);
+    unsigned state = 1;
+    for (int round = 0; round < 3000; round++) {
+        std::vector<unsigned char> batch(valid);
+        int damage = 1 + test_random(&state) % 4;
+        for (int i = 0; i < damage; i++) {
+            size_t pos = ((size_t)test_random(&state) << 15 | test_random(&state)) % batch.size();
+            batch[pos] = round & 1 ? (unsigned char)test_random(&state) : 0xff;
+        }
+        a.applyTrackBatch(batch.data(), (int)batch.size());
+        if (a.getEventCount() > 2000) a.removeAllEvents();
+        a.findEventStopTimes(1);
+    }
+    test_quiet(false);
+    a.quitLibrary();
+}
+
+int main() {
+    test_round_trip();
+    test_bad_records();
+    test_corrupt();
+    return test_result("track-batch");
+}
@@ -0,0 +1,289 @@
+/*
+    SubtitleOctopus.js - track snapshot tests
+
+    Round-trips tracks through saveTrackSnapshot/createTrackSnapshot and
+    feeds track_snapshot_read truncated and corrupted snapshots, which it
+    has to reject or read without touching memory it does not own.
+*/
+
+#include "test.h"
+
+static const char *texts[] = {
+    "plain text",
+    "{\\move(10,20,30,40)}moving",
+    "{\\fad(200,300)}fading",
+    "{\\k20}ka{\\k30}ra{\\kf40}oke",
+    "{\\b1}bold{\\fnArial} no animation",
+    "{\\t(0,500,\\fs40)}growing",
+    "escaped \\{\\move(1,2,3,4)} braces",
+    "",
+    NULL
+};
+
+static char *copy(const char *str) {
+    return str ? strdup(str) : NULL;
+}
+
+static bool same_string(const char *a, const char *b) {
+    return a == b || (a && b && !strcmp(a, b));
+}
+
+static void fill_style(ASS_Style *style, int i) {
+    style->Name = strdup(i ? "Sign" : "Default");
+    style->FontName = strdup(i ? "Comic Sans" : "Arial");
+    style->FontSize = 20 + i * 2.5;
+    style->PrimaryColour = 0xffffff00u + i;
+    style->SecondaryColour = 0x00ffff00u;
+    style->OutlineColour = 0x00000000u + i;
+    style->BackColour = 0x80000000u;
+    style->Bold = i & 1;
+    style->Italic = !(i & 1);
+    style->ScaleX = style->ScaleY = 1.0;
+    style->Spacing = 0.5 * i;
+    style->Angle = 10.0 * i;
+    style->BorderStyle = 1;
+    style->Outline = 2;
+    style->Shadow = 1.5;
+    style->Alignment = 2 + i;
+    style->MarginL = style->MarginR = 10 + i;
+    style->MarginV = 20;
+    style->Blur = 0.25 * i;
+}
+
+static void fill_event(ASS_Event *event, int i) {
+    // not in start order, so the snapshot has to keep the sorted order
+    event->Start = (i * 7919) % 40 * 500;
+    event->Duration = 800 + (i % 5) * 400;
+    event->ReadOrder = i;
+    event->Layer = i % 3;
+    event->Style = i % 2;
+    event->Name = copy(i % 4 ? "Actor" : NULL);
+    event->MarginL = i;
+    event->Effect = copy(i % 11 == 3 ? "Banner;10" : "");
+    event->Text = copy(texts[i % (sizeof(texts) / sizeof(texts[0]))]);
+}
+
+/**
+ * \brief Start a track of `events` events in an instance, through its own API
+ */
+static void make_track(SubtitleOctopus& octopus, int events) {
+    octopus.initLibrary(640, 360);
+    octopus.createTrackStream();
+    octopus.track->track_type = ASS_Track::TRACK_TYPE_ASS;
+    octopus.track->PlayResX = 1280;
+    octopus.track->PlayResY = 720;
+    octopus.track->LayoutResX = 1920;
+    octopus.track->LayoutResY = 1080;
+    octopus.track->WrapStyle = 2;
+    octopus.track->ScaledBorderAndShadow = 1;
+    octopus.track->YCbCrMatrix = 3;
+    octopus.track->Language = strdup("en");
+    for (int i = 0; i < 2; i++) {
+        int sid = octopus.allocStyle();
+        fill_style(octopus.track->styles + sid, i);
+    }
+    for (int i = 0; i < events; i++) {
+        int eid = octopus.allocEvent();
+        fill_event(octopus.track->events + eid, i);
+        octopus.updateEvent(eid);
+    }
+}
+
+static void check_same_track(const ASS_Track *a, const ASS_Track *b) {
+    CHECK(a->track_type == b->track_type);
+    CHECK(a->PlayResX == b->PlayResX && a->PlayResY == b->PlayResY);
+    CHECK(a->LayoutResX == b->LayoutResX && a->LayoutResY == b->LayoutResY);
+    CHECK(a->Timer == b->Timer && a->WrapStyle == b->WrapStyle);
+    CHECK(a->ScaledBorderAndShadow == b->ScaledBorderAndShadow && a->Kerning == b->Kerning);
+    CHECK(a->YCbCrMatrix == b->YCbCrMatrix);
+    CHECK(same_string(a->Language, b->Language) && same_string(a->name, b->name));
+
+    CHECK(a->n_styles == b->n_styles && a->default_style == b->default_style);
+    for (int i = 0; i < a->n_styles && i < b->n_styles; i++) {
+        const ASS_Style *x = a->styles + i, *y = b->styles + i;
+        CHECK(same_string(x->Name, y->Name) && same_string(x->FontName, y->FontName));
+        CHECK(x->FontSize == y->FontSize && x->PrimaryColour == y->PrimaryColour);
+        CHECK(x->SecondaryColour == y->SecondaryColour && x->OutlineColour == y->OutlineColour);
+        CHECK(x->BackColour == y->BackColour && x->Bold == y->Bold && x->Italic == y->Italic);
+        CHECK(x->Spacing == y->Spacing && x->Angle == y->Angle && x->Outline == y->Outline);
+        CHECK(x->Alignment == y->Alignment && x->MarginL == y->MarginL && x->Blur == y->Blur);
+    }
+
+    CHECK(a->n_events == b->n_events);
+    for (int i = 0; i < a->n_events && i < b->n_events; i++) {
+        const ASS_Event *x = a->events + i, *y = b->events + i;
+        CHECK(x->Start == y->Start && x->Duration == y->Duration);
+        CHECK(x->ReadOrder == y->ReadOrder && x->Layer == y->Layer && x->Style == y->Style);
+        CHECK(x->MarginL == y->MarginL && x->MarginR == y->MarginR && x->MarginV == y->MarginV);
+        CHECK(same_string(x->Name, y->Name) && same_string(x->Effect, y->Effect));
+        CHECK(same_string(x->Text, y->Text));
+    }
+}
+
+static void check_same_timing(SubtitleOctopus& a, SubtitleOctopus& b) {
+    for (double tm = -1; tm < 25; tm += 0.125) {
+        CHECK(a.findNextEventStart(tm) == b.findNextEventStart(tm));
+        EventStopTimesResult x = *a.findEventStopTimes(tm), y = *b.findEventStopTimes(tm);
+        CHECK(x.eventFinish == y.eventFinish && x.emptyFinish == y.emptyFinish);
+        CHECK(x.is_animated == y.is_animated);
+    }
+}
+
+static void test_round_trip(const char *path) {
+    SubtitleOctopus a, b;
+    make_track(a, 60);
+    CHECK(a.saveTrackSnapshot(path));
+    b.initLibrary(640, 360);
+    CHECK(b.createTrackSnapshot(path));
+    check_same_track(a.track, b.track);
+    check_same_timing(a, b);
+    a.quitLibrary();
+    b.quitLibrary();
+}
+
+static void test_dropped_animations(const char *path) {
+    // animations dropped by the quality governor are saved as they were
+    SubtitleOctopus a, b, c;
+    make_track(a, 30);
+    make_track(c, 30);
+    CHECK(a.dropAnimationsInRange(0, 10) > 0);
+    CHECK(a.saveTrackSnapshot(path));
+    int stripped = 0;
+    for (int i = 0; i < a.track->n_events; i++) {
+        if (!same_string(a.track->events[i].Text, c.track->events[i].Text)) stripped++;
+    }
+    CHECK(stripped > 0); // still dropped in the live track
+    b.initLibrary(640, 360);
+    CHECK(b.createTrackSnapshot(path));
+    check_same_track(c.track, b.track);
+    check_same_timing(c, b);
+
+    // with all animations dropped the flags are rescanned if the loader keeps them
+    a.setDropAnimations(1);
+    CHECK(a.saveTrackSnapshot(path));
+    b.setDropAnimations(0);
+    CHECK(b.createTrackSnapshot(path));
+    check_same_track(a.track, b.track);
+    for (double tm = 0; tm < 25; tm += 0.5) CHECK(!b.findEventStopTimes(tm)->is_animated);
+    a.quitLibrary();
+    b.quitLibrary();
+    c.quitLibrary();
+}
+
+/**
+ * \return track read from `size` bytes of `data`, NULL if rejected
+ */
+static ASS_Track *read_snapshot(ASS_Library *library, const char *path, const unsigned char *data, size_t size) {
+    if (!test_write_file(path, data, size)) return NULL;
+    TrackSnapshotReader in;
+    if (!in.load(path)) return NULL;
+    int *animated, *order;
+    uint32_t flags;
+    ASS_Track *track = track_snapshot_read(in, library, &animated, &order, &flags);
+    if (track) {
+        // what createTrackSnapshot does with it next
+        EventIndex index;
+        index.buildSorted(track, order);
+        index.nextStart(0);
+        free(animated);
+        free(order);
+    }
+    return track;
+}
+
+static void test_corrupt(const char *path) {
+    SubtitleOctopus a;
+    make_track(a, 12);
+    CHECK(a.saveTrackSnapshot(path));
+    size_t size;
+    unsigned char *valid = test_read_file(path, &size);
+    CHECK(valid != NULL && size > 64);
+    if (!valid) return;
+    unsigned char *data = (unsigned char*)malloc(size);
+
+    test_quiet(true);
+    ASS_Track *track = read_snapshot(a.ass_library, path, valid, size);
+    CHECK(track != NULL);
+    ass_free_track(track);
+
+    // every truncation is rejected
+    for (size_t length = 0; length < size; length++) {
+        track = read_snapshot(a.ass_library, path, valid, length);
+        CHECK(track == NULL);
+        if (track) ass_free_track(track);
+    }
+
+    // the track of an instance survives a snapshot it cannot use
+    CHECK(test_write_file(path, valid, size / 2));
+    int events = a.getEventCount();
+    CHECK(!a.createTrackSnapshot(path));
+    CHECK(a.track != NULL && a.getEventCount() == events);
+
+    // wrong magic and versions
+    uint32_t version;
+    memcpy(data, valid, size);
+    data[0] = 'X';
+    CHECK(read_snapshot(a.ass_library, path, data, size) == NULL);
+    memcpy(data, valid, size);
+    version = 1;
+    memcpy(data + 4, &version, sizeof(version));
+    CHECK(read_snapshot(a.ass_library, path, data, size) == NULL);
+    version = TRACK_SNAPSHOT_VERSION + 1;
+    memcpy(data + 4, &version, sizeof(version));
+    CHECK(read_snapshot(a.ass_library, path, data, size) == NULL);
+
+    // length of Language, after the header, 9 ints and a double of the info block
+    memcpy(data, valid, size);
+    uint32_t length = 0xfffffff0u;
+    memcpy(data + 56, &length, sizeof(length));
+    CHECK(read_snapshot(a.ass_library, path, data, size) == NULL);
+
+    // random damage must not do more than get the snapshot rejected
+    unsigned state = 1;
+    for (int round = 0; round < 4000; round++) {
+        memcpy(data, valid, size);
+        int damage = 1 + test_random(&state) % 4;
+        for (int i = 0; i < damage; i++) {
+            size_t pos = 12 + ((size_t)test_random(&state) << 15 | test_random(&state)) % (size - 12);
+            data[pos] = round & 1 ? (unsigned char)test_random(&state) : 0xff;
+        }
+        track = read_snapshot(a.ass_library, path, data, size);
+        if (track) ass_free_track(track);
+    }
+    test_quiet(false);
+
+    free(data);
+    free(valid);
+    a.quitLibrary();
+}
+
+static void test_huge_times(const char *path) {
+    SubtitleOctopus a;
+    a.initLibrary(640, 360);
+    ASS_Track *track = ass_new_track(a.ass_library);
+    int eid = ass_alloc_event(track);
+    track->events[eid].Start = LLONG_MAX - 10;
+    track->events[eid].Duration = 1000;
+    track->events[eid].Text = strdup("overflowing");
+    int animated = 0, order = 0;
+    TrackSnapshotWriter out;
+    track_snapshot_write(out, track, &animated, &order, 0);
+    CHECK(out.save(path));
+    ass_free_track(track);
+
+    test_quiet(true);
+    CHECK(!a.createTrackSnapshot(path));
+    test_quiet(false);
+    a.quitLibrary();
+}
+
+int main() {
+    char path[256];
+    snprintf(path, sizeof(path), "%s", test_temp_path("snapshot"));
+    test_round_trip(path);
+    test_dropped_animations(path);
+    test_corrupt(path);
+    test_huge_times(path);
+    remove(path);
+    return test_result("track-snapshot");
+}
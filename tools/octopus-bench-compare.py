@@ -0,0 +1,65 @@
+#!/usr/bin/env python3
+## JavascriptSubtitlesOctopus
+## Compare octopus-bench results of a change with a baseline
+
+"""
+Usage: octopus-bench-compare.py [--tolerance T] --base A.json [--base ...] --head B.json [--head ...]
+
+Every file benchmarked on both sides is compared by its sweep time; with
+several runs per side the fastest one counts, which keeps the noise of shared
+CI machines out. Exits with 1 if any file got slower than the baseline by more
+than the tolerance (a fraction, 0.15 by default).
+"""
+
+import argparse
+import json
+import sys
+
+
+def best_times(paths):
+    times = {}
+    for path in paths:
+        with open(path) as f:
+            result = json.load(f)
+        for entry in result['files']:
+            name = entry['file']
+            if name not in times or entry['total_ms'] < times[name]:
+                times[name] = entry['total_ms']
+    return times
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Compare octopus-bench results with a baseline')
+    parser.add_argument('--base', action='append', required=True, help='JSON of the baseline, may be repeated')
+    parser.add_argument('--head', action='append', required=True, help='JSON of the change, may be repeated')
+    parser.add_argument('--tolerance', type=float, default=0.15, help='allowed slowdown as a fraction')
+    args = parser.parse_args()
+
+    base = best_times(args.base)
+    head = best_times(args.head)
+
+    slower = 0
+    for name in sorted(head):
+        if name not in base:
+            print('%s: not in the baseline' % name)
+            continue
+        ratio = head[name] / base[name] if base[name] > 0 else 1.0
+        verdict = 'ok'
+        if ratio > 1.0 + args.tolerance:
+            verdict = 'SLOWER'
+            slower += 1
+        print('%s: %.3f ms -> %.3f ms (%+.1f%%) %s' % (name, base[name], head[name], (ratio - 1.0) * 100, verdict))
+    for name in sorted(base):
+        if name not in head:
+            print('%s: missing from the results' % name)
+            slower += 1
+
+    if slower:
+        print('octopus-bench-compare: %d file(s) slower than the %.0f%% tolerance allows or missing'
+              % (slower, args.tolerance * 100))
+        return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
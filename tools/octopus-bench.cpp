@@ -0,0 +1,357 @@
+/*
+    SubtitleOctopus.js - headless benchmark
+
+    Native build of the SubtitleOctopus core which sweeps renderBlend or
+    renderImage across the timeline of every given .ass file and reports
+    per-frame latency percentiles, throughput and peak RSS as JSON.
+    With --areas it also compares the pixel area blended by the region
+    partitioner with the one of the former fixed 3x3 grid, in a second pass
+    after the timed one. Files which cannot be loaded are reported and skipped.
+
+    Usage: octopus-bench [options] <file.ass|directory>...
+*/
+
+#include <dirent.h>
+#include <strings.h>
+#include <getopt.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "../src/SubtitleOctopus.cpp"
+
+enum BenchMode {
+    BENCH_BLEND,
+    BENCH_IMAGE
+};
+
+struct BenchOptions {
+    int width, height;
+    double fps;
+    double start, duration;
+    int force;
+    int areas;
+    BenchMode mode;
+    const char *fonts_dir;
+    const char *output;
+};
+
+struct BenchResult {
+    std::string file;
+    int events;
+    double start, finish;
+    int frames, changed_frames;
+    long long images, bytes;
+    long long parts, area, grid_parts, grid_area; // blended frames only, with --areas
+    double load_time, total_time;
+    std::vector<double> render, blend, frame;
+};
+
+static void usage(const char *name) {
+    fprintf(stderr,
+        "Usage: %s [options] <file.ass|directory>...\n"
+        "  -W, --width N       canvas width (default 1920)\n"
+        "  -H, --height N      canvas height (default 1080)\n"
+        "  -f, --fps N         frames per second to sweep at (default 24)\n"
+        "  -s, --start SEC     start of the sweep (default: first event)\n"
+        "  -d, --duration SEC  length of the sweep (default: until last event ends)\n"
+        "  -m, --mode MODE     'blend' for renderBlend (default), 'image' for renderImage\n"
+        "  -F, --force         force blending of unchanged frames\n"
+        "  -A, --areas         compare blended area with the former 3x3 grid\n"
+        "      --fonts-dir DIR load all fonts from DIR\n"
+        "  -o, --output FILE   write JSON to FILE instead of stdout\n", name);
+}
+
+static bool has_suffix(const std::string& str, const char *suffix) {
+    size_t len = strlen(suffix);
+    return str.size() >= len && strcasecmp(str.c_str() + str.size() - len, suffix) == 0;
+}
+
+/**
+ * \brief Expand directories into the .ass/.ssa files they contain (sorted)
+ */
+static void collect_files(const char *path, std::vector<std::string>& files) {
+    DIR *dir = opendir(path);
+    if (!dir) {
+        files.push_back(path);
+        return;
+    }
+
+    std::vector<std::string> found;
+    for (struct dirent *entry = readdir(dir); entry != NULL; entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (has_suffix(name, ".ass") || has_suffix(name, ".ssa"))
+            found.push_back(std::string(path) + "/" + name);
+    }
+    closedir(dir);
+
+    std::sort(found.begin(), found.end());
+    files.insert(files.end(), found.begin(), found.end());
+}
+
+static double percentile(std::vector<double> values, double p) {
+    if (values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    size_t rank = (size_t)(p / 100.0 * (values.size() - 1) + 0.5);
+    return values[rank];
+}
+
+static void print_stats(FILE *out, const char *name, const std::vector<double>& values, bool last) {
+    double sum = 0;
+    for (size_t i = 0; i < values.size(); i++) sum += values[i];
+    fprintf(out, "      \"%s\": {\"mean\": %.4f, \"p50\": %.4f, \"p90\": %.4f, \"p99\": %.4f, \"max\": %.4f}%s\n",
+            name, values.empty() ? 0.0 : sum / values.size(),
+            percentile(values, 50), percentile(values, 90), percentile(values, 99),
+            percentile(values, 100), last ? "" : ",");
+}
+
+static void print_json_string(FILE *out, const std::string& str) {
+    fputc('"', out);
+    for (size_t i = 0; i < str.size(); i++) {
+        unsigned char c = str[i];
+        if (c == '"' || c == '\\') fprintf(out, "\\%c", c);
+        else if (c < 0x20) fprintf(out, "\\u%04x", c);
+        else fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+/**
+ * \brief Regions of the former partitioning: images bucketed into a 3x3 grid
+ * by their centre, then intersecting buckets merged
+ * \return total area of the regions, their count in `parts`
+ */
+static long long grid_area(ASS_Image *img, int width, int height, int *parts) {
+    int split_x_low = width / 3, split_x_high = 2 * width / 3;
+    int split_y_low = height / 3, split_y_high = 2 * height / 3;
+    BoundingBox boxes[3 * 3];
+    for (ASS_Image *cur = img; cur != NULL; cur = cur->next) {
+        if (cur->w == 0 || cur->h == 0) continue;
+        int middle_x = cur->dst_x + (cur->w >> 1), middle_y = cur->dst_y + (cur->h >> 1);
+        int index = (middle_y > split_y_high ? 2 : middle_y > split_y_low ? 1 : 0) * 3 +
+                    (middle_x > split_x_high ? 2 : middle_x > split_x_low ? 1 : 0);
+        boxes[index].add(cur->dst_x, cur->dst_y, cur->w, cur->h);
+    }
+    for (bool merged = true; merged;) {
+        merged = false;
+        for (int box1 = 0; box1 < 3 * 3 - 1; box1++) {
+            if (boxes[box1].empty()) continue;
+            for (int box2 = box1 + 1; box2 < 3 * 3; box2++) {
+                if (boxes[box2].empty() || !boxes[box1].tryMerge(boxes[box2])) continue;
+                boxes[box2].clear();
+                merged = true;
+            }
+        }
+    }
+
+    long long area = 0;
+    *parts = 0;
+    for (int i = 0; i < 3 * 3; i++) {
+        if (boxes[i].empty()) continue;
+        area += boxes[i].area();
+        (*parts)++;
+    }
+    return area;
+}
+
+/**
+ * \brief Compare the regions of the partitioner with the former grid for the frames given
+ * Runs after the timed sweep, as rendering the frames again resets the change
+ * detection of libass.
+ */
+static void compare_areas(SubtitleOctopus& octopus, const std::vector<double>& times,
+                          const BenchOptions& opts, BenchResult& res) {
+    RegionPartitioner partitioner;
+    for (size_t n = 0; n < times.size(); n++) {
+        int unused, parts;
+        ASS_Image *img = ass_render_frame(octopus.ass_renderer, octopus.track, (int)(times[n] * 1000), &unused);
+        BoundingBox boxes[MAX_BLEND_STORAGES];
+        parts = partitioner.partition(img, boxes, MAX_BLEND_STORAGES);
+        for (int i = 0; i < parts; i++) res.area += boxes[i].area();
+        res.parts += parts;
+        res.grid_area += grid_area(img, opts.width, opts.height, &parts);
+        res.grid_parts += parts;
+    }
+}
+
+static bool run_file(SubtitleOctopus& octopus, const std::string& file, const BenchOptions& opts, BenchResult& res) {
+    res.file = file;
+    res.frames = res.changed_frames = 0;
+    res.images = res.bytes = 0;
+    res.parts = res.area = res.grid_parts = res.grid_area = 0;
+    std::vector<double> blended; // times of the frames blended, with --areas
+
+    // createTrack exits on a file libass cannot read, which would end the whole run
+    ASS_Track *probe = ass_read_file(octopus.ass_library, (char*)file.c_str(), NULL);
+    if (!probe) {
+        fprintf(stderr, "octopus-bench: %s cannot be loaded, skipping\n", file.c_str());
+        return false;
+    }
+    ass_free_track(probe);
+
+    double t0 = emscripten_get_now();
+    octopus.createTrack((char*)file.c_str());
+    res.load_time = emscripten_get_now() - t0;
+    res.events = octopus.getEventCount();
+    if (res.events == 0) {
+        fprintf(stderr, "octopus-bench: %s has no events, skipping\n", file.c_str());
+        return false;
+    }
+
+    long long first = -1, last = 0;
+    for (int i = 0; i < octopus.track->n_events; i++) {
+        ASS_Event *event = octopus.track->events + i;
+        if (first == -1 || event->Start < first) first = event->Start;
+        if (event->Start + event->Duration > last) last = event->Start + event->Duration;
+    }
+    res.start = opts.start >= 0 ? opts.start : first / 1000.0;
+    res.finish = opts.duration > 0 ? res.start + opts.duration : last / 1000.0;
+
+    if (opts.areas && res.finish > res.start) blended.reserve((size_t)((res.finish - res.start) * opts.fps) + 1);
+
+    int changed;
+    double sweep_start = emscripten_get_now();
+    for (int n = 0;; n++) {
+        double tm = res.start + n / opts.fps;
+        if (tm > res.finish) break;
+
+        double frame_start = emscripten_get_now();
+        if (opts.mode == BENCH_IMAGE) {
+            ASS_Image *img = octopus.renderImage(tm, &changed);
+            double spent = emscripten_get_now() - frame_start;
+            for (; img != NULL; img = img->next) {
+                res.images++;
+                res.bytes += (long long)img->h * img->stride;
+            }
+            res.render.push_back(spent);
+            res.frame.push_back(spent);
+        } else {
+            RenderBlendResult *result = octopus.renderBlend(tm, opts.force);
+            double spent = emscripten_get_now() - frame_start;
+            changed = result->changed;
+            for (RenderBlendPart *part = result->part; part != NULL; part = part->next) {
+                res.images++;
+                res.bytes += 4LL * part->dest_width * part->dest_height;
+            }
+            res.render.push_back(spent - result->blend_time);
+            res.blend.push_back(result->blend_time);
+            res.frame.push_back(spent);
+
+            if (opts.areas && (changed || opts.force)) blended.push_back(tm);
+        }
+        res.frames++;
+        if (changed) res.changed_frames++;
+    }
+    res.total_time = emscripten_get_now() - sweep_start;
+
+    if (!blended.empty()) compare_areas(octopus, blended, opts, res);
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    BenchOptions opts = {1920, 1080, 24.0, -1.0, 0.0, 0, 0, BENCH_BLEND, NULL, NULL};
+
+    static struct option long_options[] = {
+        {"width", required_argument, NULL, 'W'},
+        {"height", required_argument, NULL, 'H'},
+        {"fps", required_argument, NULL, 'f'},
+        {"start", required_argument, NULL, 's'},
+        {"duration", required_argument, NULL, 'd'},
+        {"mode", required_argument, NULL, 'm'},
+        {"force", no_argument, NULL, 'F'},
+        {"areas", no_argument, NULL, 'A'},
+        {"fonts-dir", required_argument, NULL, 1},
+        {"output", required_argument, NULL, 'o'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "W:H:f:s:d:m:FAo:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'W': opts.width = atoi(optarg); break;
+            case 'H': opts.height = atoi(optarg); break;
+            case 'f': opts.fps = atof(optarg); break;
+            case 's': opts.start = atof(optarg); break;
+            case 'd': opts.duration = atof(optarg); break;
+            case 'm':
+                if (!strcmp(optarg, "blend")) {
+                    opts.mode = BENCH_BLEND;
+                } else if (!strcmp(optarg, "image")) {
+                    opts.mode = BENCH_IMAGE;
+                } else {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'F': opts.force = 1; break;
+            case 'A': opts.areas = 1; break;
+            case 1: opts.fonts_dir = optarg; break;
+            case 'o': opts.output = optarg; break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    std::vector<std::string> files;
+    for (int i = optind; i < argc; i++) collect_files(argv[i], files);
+    if (files.empty() || opts.width <= 0 || opts.height <= 0 || opts.fps <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    FILE *out = opts.output ? fopen(opts.output, "w") : stdout;
+    if (!out) {
+        perror(opts.output);
+        return 1;
+    }
+
+    SubtitleOctopus octopus;
+    octopus.setLogLevel(1); // keep stdout clean for the JSON
+    octopus.initLibrary(opts.width, opts.height);
+    if (opts.fonts_dir) {
+        ass_set_fonts_dir(octopus.ass_library, opts.fonts_dir);
+        octopus.reloadFonts();
+    }
+
+    fprintf(out, "{\n  \"kernel\": \"%s\",\n  \"mode\": \"%s\",\n", blend_kernel_name(),
+            opts.mode == BENCH_IMAGE ? "image" : "blend");
+    fprintf(out, "  \"width\": %d,\n  \"height\": %d,\n  \"fps\": %g,\n  \"files\": [", opts.width, opts.height, opts.fps);
+
+    bool first = true;
+    for (size_t i = 0; i < files.size(); i++) {
+        BenchResult res;
+        fprintf(stderr, "octopus-bench: %s\n", files[i].c_str());
+        if (!run_file(octopus, files[i], opts, res)) continue;
+
+        fprintf(out, "%s\n    {\n      \"file\": ", first ? "" : ",");
+        print_json_string(out, res.file);
+        fprintf(out, ",\n      \"events\": %d,\n      \"start\": %.3f,\n      \"finish\": %.3f,\n",
+                res.events, res.start, res.finish);
+        fprintf(out, "      \"frames\": %d,\n      \"changed_frames\": %d,\n", res.frames, res.changed_frames);
+        fprintf(out, "      \"images\": %lld,\n      \"bytes\": %lld,\n", res.images, res.bytes);
+        if (opts.areas && opts.mode == BENCH_BLEND) {
+            fprintf(out, "      \"blended_parts\": %lld,\n      \"blended_area\": %lld,\n", res.parts, res.area);
+            fprintf(out, "      \"grid_parts\": %lld,\n      \"grid_area\": %lld,\n", res.grid_parts, res.grid_area);
+        }
+        fprintf(out, "      \"load_ms\": %.3f,\n      \"total_ms\": %.3f,\n", res.load_time, res.total_time);
+        fprintf(out, "      \"fps\": %.2f,\n", res.total_time > 0 ? res.frames * 1000.0 / res.total_time : 0.0);
+        fprintf(out, "      \"bytes_per_sec\": %.0f,\n", res.total_time > 0 ? res.bytes * 1000.0 / res.total_time : 0.0);
+        print_stats(out, "render_ms", res.render, false);
+        if (opts.mode == BENCH_BLEND) print_stats(out, "blend_ms", res.blend, false);
+        print_stats(out, "frame_ms", res.frame, true);
+        fprintf(out, "    }");
+        first = false;
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    fprintf(out, "\n  ],\n  \"peak_rss_kib\": %ld\n}\n", usage.ru_maxrss);
+
+    octopus.quitLibrary();
+    if (out != stdout) fclose(out);
+    return 0;
+}
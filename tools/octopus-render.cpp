@@ -0,0 +1,484 @@
+/*
+    SubtitleOctopus.js - offline overlay renderer
+
+    Native build of the SubtitleOctopus core which renders a whole track into
+    RGBA overlay frames, e.g. for burning subtitles into a video. The timeline
+    is walked from one event boundary to the next with findEventStopTimes, so
+    static events are rendered once and animated ones at the given fps. Each
+    distinct image is stored once, however many frames show it. Chunks of the
+    timeline are rendered in parallel, every thread with its own SubtitleOctopus.
+
+    The output is either a directory of PAM or raw RGBA images plus index.txt
+    listing the frames, or a single container file, see ImageStore.
+
+    Usage: octopus-render [options] <file.ass> <output>
+*/
+
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "../src/SubtitleOctopus.cpp"
+
+enum RenderFormat {
+    FORMAT_PAM,
+    FORMAT_RAW,
+    FORMAT_CONTAINER
+};
+
+struct RenderOptions {
+    int width, height;
+    double fps;
+    double start, duration;
+    double chunk;
+    int jobs;
+    int full;
+    RenderFormat format;
+    const char *fonts_dir;
+};
+
+/**
+ * An overlay image shown from `start` until right before `end`, in ms
+ */
+struct OverlayFrame {
+    long long start, end;
+    int x, y, w, h;
+    int image; // index in ImageStore
+};
+
+static void usage(const char *name) {
+    fprintf(stderr,
+        "Usage: %s [options] <file.ass> <output>\n"
+        "  -W, --width N        canvas width (default 1920)\n"
+        "  -H, --height N       canvas height (default 1080)\n"
+        "  -f, --fps N          frames per second of animated events (default 24)\n"
+        "  -s, --start SEC      start of the range to render (default: first event)\n"
+        "  -d, --duration SEC   length of the range (default: until last event ends)\n"
+        "  -j, --jobs N         render threads (default: number of cores)\n"
+        "  -c, --chunk SEC      length of the timeline a thread takes at once (default 60)\n"
+        "  -F, --format FORMAT  'pam' (default) or 'raw' images in the <output> directory,\n"
+        "                       'container' for a single <output> file\n"
+        "      --full           canvas-sized images instead of cropped ones\n"
+        "      --fonts-dir DIR  load all fonts from DIR\n", name);
+}
+
+// seconds for the methods taking them, which truncate to ms again
+static double seconds(long long ms) {
+    return (ms + 0.5) / 1000.0;
+}
+
+static long long milliseconds(double sec) {
+    return llround(sec * 1000.0);
+}
+
+static void put_u32(unsigned char *out, uint32_t value) {
+    for (int i = 0; i < 4; i++) out[i] = (unsigned char)(value >> (8 * i));
+}
+
+static void put_u64(unsigned char *out, uint64_t value) {
+    for (int i = 0; i < 8; i++) out[i] = (unsigned char)(value >> (8 * i));
+}
+
+/**
+ * \brief Images of the overlay frames, stored once each; shared by the render threads
+ *
+ * The container file, all numbers little-endian:
+ *   0  "OCTPOVL1"
+ *   8  u32 canvas width, u32 canvas height
+ *  16  u32 frame count, u32 image count
+ *  24  u64 offset of the frame table
+ *  32  images, w * h RGBA pixels with straight alpha each
+ *      frame table, sorted by start: i64 start ms, i64 end ms, i32 x, y, w, h, u64 image offset
+ */
+class ImageStore {
+public:
+    static const int CONTAINER_HEADER = 32;
+    static const int CONTAINER_FRAME = 40;
+
+    ImageStore(const RenderOptions& opts, const std::string& output):
+        m_opts(opts), m_output(output), m_file(NULL), m_offset(CONTAINER_HEADER), m_bytes(0), m_failed(false) {}
+
+    ~ImageStore() {
+        if (m_file) fclose(m_file);
+    }
+
+    bool open() {
+        if (m_opts.format == FORMAT_CONTAINER) {
+            m_file = fopen(m_output.c_str(), "wb");
+            if (!m_file) {
+                perror(m_output.c_str());
+                return false;
+            }
+            // header is written last
+            unsigned char header[CONTAINER_HEADER] = {0};
+            return fwrite(header, sizeof(header), 1, m_file) == 1;
+        }
+        if (mkdir(m_output.c_str(), 0777) != 0 && errno != EEXIST) {
+            perror(m_output.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * \brief Store an image unless an identical one was stored before
+     * \return index of the image, -1 on error
+     */
+    int add(const unsigned char *rgba, int w, int h) {
+        uint64_t hash = hashImage(rgba, w, h);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_failed) return -1;
+        std::pair<uint64_t, std::pair<int, int> > key(hash, std::make_pair(w, h));
+        std::map<std::pair<uint64_t, std::pair<int, int> >, int>::iterator found = m_index.find(key);
+        if (found != m_index.end()) return found->second;
+
+        Image image = {hash, w, h, m_offset};
+        size_t size = (size_t)w * h * 4;
+        if (!write(image, rgba, size)) {
+            m_failed = true;
+            return -1;
+        }
+        m_offset += size;
+        m_bytes += size;
+        m_images.push_back(image);
+        m_index[key] = (int)m_images.size() - 1;
+        return (int)m_images.size() - 1;
+    }
+
+    /**
+     * \brief Write the list of frames, which must be sorted by start
+     */
+    bool finish(const std::vector<OverlayFrame>& frames) {
+        if (m_opts.format == FORMAT_CONTAINER) return finishContainer(frames);
+
+        std::string path = m_output + "/index.txt";
+        FILE *index = fopen(path.c_str(), "w");
+        if (!index) {
+            perror(path.c_str());
+            return false;
+        }
+        fprintf(index, "# canvas %d %d\n# start_ms end_ms x y width height file\n", m_opts.width, m_opts.height);
+        for (size_t i = 0; i < frames.size(); i++) {
+            const OverlayFrame& frame = frames[i];
+            fprintf(index, "%lld %lld %d %d %d %d %s\n", frame.start, frame.end, frame.x, frame.y,
+                    frame.w, frame.h, name(m_images[frame.image]).c_str());
+        }
+        return fclose(index) == 0;
+    }
+
+    size_t imageCount() const {
+        return m_images.size();
+    }
+
+    unsigned long long bytes() const {
+        return m_bytes;
+    }
+
+private:
+    struct Image {
+        uint64_t hash;
+        int w, h;
+        unsigned long long offset; // in the container
+    };
+
+    static uint64_t hashImage(const unsigned char *rgba, int w, int h) {
+        // FNV-1a over 64-bit words
+        uint64_t hash = 14695981039346656037ULL;
+        hash = (hash ^ (uint64_t)w) * 1099511628211ULL;
+        hash = (hash ^ (uint64_t)h) * 1099511628211ULL;
+        size_t size = (size_t)w * h * 4, i = 0;
+        for (; i + 8 <= size; i += 8) {
+            uint64_t word;
+            memcpy(&word, rgba + i, 8);
+            hash = (hash ^ word) * 1099511628211ULL;
+            hash ^= hash >> 29;
+        }
+        for (; i < size; i++) hash = (hash ^ rgba[i]) * 1099511628211ULL;
+        return hash;
+    }
+
+    std::string name(const Image& image) const {
+        char name[40];
+        snprintf(name, sizeof(name), "%016llx-%dx%d.%s", (unsigned long long)image.hash, image.w, image.h,
+                 m_opts.format == FORMAT_PAM ? "pam" : "rgba");
+        return name;
+    }
+
+    bool write(const Image& image, const unsigned char *rgba, size_t size) {
+        if (m_opts.format == FORMAT_CONTAINER) {
+            if (fwrite(rgba, size, 1, m_file) == 1) return true;
+            perror(m_output.c_str());
+            return false;
+        }
+
+        std::string path = m_output + "/" + name(image);
+        FILE *out = fopen(path.c_str(), "wb");
+        if (!out) {
+            perror(path.c_str());
+            return false;
+        }
+        if (m_opts.format == FORMAT_PAM) {
+            fprintf(out, "P7\nWIDTH %d\nHEIGHT %d\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n", image.w, image.h);
+        }
+        bool ok = fwrite(rgba, size, 1, out) == 1;
+        if (fclose(out) != 0) ok = false;
+        if (!ok) perror(path.c_str());
+        return ok;
+    }
+
+    bool finishContainer(const std::vector<OverlayFrame>& frames) {
+        unsigned char entry[CONTAINER_FRAME];
+        for (size_t i = 0; i < frames.size(); i++) {
+            const OverlayFrame& frame = frames[i];
+            put_u64(entry, (uint64_t)frame.start);
+            put_u64(entry + 8, (uint64_t)frame.end);
+            put_u32(entry + 16, (uint32_t)frame.x);
+            put_u32(entry + 20, (uint32_t)frame.y);
+            put_u32(entry + 24, (uint32_t)frame.w);
+            put_u32(entry + 28, (uint32_t)frame.h);
+            put_u64(entry + 32, m_images[frame.image].offset);
+            if (fwrite(entry, sizeof(entry), 1, m_file) != 1) break;
+        }
+
+        unsigned char header[CONTAINER_HEADER];
+        memcpy(header, "OCTPOVL1", 8);
+        put_u32(header + 8, (uint32_t)m_opts.width);
+        put_u32(header + 12, (uint32_t)m_opts.height);
+        put_u32(header + 16, (uint32_t)frames.size());
+        put_u32(header + 20, (uint32_t)m_images.size());
+        put_u64(header + 24, m_offset);
+        bool ok = !ferror(m_file) && fseek(m_file, 0, SEEK_SET) == 0 &&
+                  fwrite(header, sizeof(header), 1, m_file) == 1;
+        if (fclose(m_file) != 0) ok = false;
+        m_file = NULL;
+        if (!ok) perror(m_output.c_str());
+        return ok;
+    }
+
+    const RenderOptions& m_opts;
+    std::string m_output;
+    FILE *m_file; // container
+    unsigned long long m_offset; // end of the images in the container
+    unsigned long long m_bytes;
+    bool m_failed;
+    std::vector<Image> m_images;
+    std::map<std::pair<uint64_t, std::pair<int, int> >, int> m_index; // by hash and size
+    std::mutex m_mutex;
+};
+
+/**
+ * \brief Turn the parts of a blended frame into one image and append it to `frames`
+ */
+static bool add_frame(RenderBlendResult *result, long long start, long long end, const RenderOptions& opts,
+                      ImageStore& store, std::vector<unsigned char>& pixels, std::vector<OverlayFrame>& frames) {
+    BoundingBox box;
+    for (RenderBlendPart *part = result->part; part != NULL; part = part->next) {
+        box.add(part->dest_x, part->dest_y, part->dest_width, part->dest_height);
+    }
+    if (box.empty()) return true; // nothing visible
+    if (opts.full) {
+        box.min_x = box.min_y = 0;
+        box.max_x = opts.width - 1;
+        box.max_y = opts.height - 1;
+    }
+
+    OverlayFrame frame = {start, end, box.min_x, box.min_y, box.max_x - box.min_x + 1, box.max_y - box.min_y + 1, -1};
+    pixels.assign((size_t)frame.w * frame.h * 4, 0);
+    for (RenderBlendPart *part = result->part; part != NULL; part = part->next) {
+        size_t row = (size_t)part->dest_width * 4;
+        for (int y = 0; y < part->dest_height; y++) {
+            memcpy(&pixels[(((size_t)(part->dest_y - frame.y + y)) * frame.w + part->dest_x - frame.x) * 4],
+                   part->image + y * row, row);
+        }
+    }
+    frame.image = store.add(&pixels[0], frame.w, frame.h);
+    if (frame.image < 0) return false;
+
+    if (!frames.empty()) {
+        OverlayFrame& last = frames.back();
+        if (last.image == frame.image && last.end == frame.start && last.x == frame.x && last.y == frame.y) {
+            // e.g. an animated event not changing for a while
+            last.end = frame.end;
+            return true;
+        }
+    }
+    frames.push_back(frame);
+    return true;
+}
+
+// length of the frames of animated events in ms
+static long long frame_step(const RenderOptions& opts) {
+    return std::max(1LL, (long long)llround(1000.0 / opts.fps));
+}
+
+/**
+ * \brief Render the frames starting within [from, to), in ms
+ * Frames are cut at `to`, the next chunk starts with the state at `to`.
+ * Frames of animated events end on a grid of frame_step from `origin`,
+ * which chunk boundaries are on as well, so they do not depend on the chunks.
+ */
+static bool render_chunk(SubtitleOctopus& octopus, long long origin, long long from, long long to, const RenderOptions& opts,
+                         ImageStore& store, std::vector<unsigned char>& pixels, std::vector<OverlayFrame>& frames) {
+    long long step = frame_step(opts);
+    for (long long now = from; now < to;) {
+        double next = octopus.findNextEventStart(seconds(now));
+        if (next < 0) break;
+        long long start = std::max(now, milliseconds(next));
+        if (start >= to) break;
+
+        EventStopTimesResult *stop = octopus.findEventStopTimes(seconds(start));
+        long long end = stop->eventFinish >= 0 ? milliseconds(stop->eventFinish) : to;
+        if (stop->is_animated) end = std::min(end, origin + ((start - origin) / step + 1) * step);
+        end = std::min(std::max(end, start + 1), to);
+
+        RenderBlendResult *result = octopus.renderBlend(seconds(start), 1);
+        if (!add_frame(result, start, end, opts, store, pixels, frames)) return false;
+        now = end;
+    }
+    return true;
+}
+
+static bool frame_before(const OverlayFrame& a, const OverlayFrame& b) {
+    return a.start < b.start;
+}
+
+int main(int argc, char *argv[]) {
+    RenderOptions opts = {1920, 1080, 24.0, -1.0, 0.0, 60.0, 0, 0, FORMAT_PAM, NULL};
+
+    static struct option long_options[] = {
+        {"width", required_argument, NULL, 'W'},
+        {"height", required_argument, NULL, 'H'},
+        {"fps", required_argument, NULL, 'f'},
+        {"start", required_argument, NULL, 's'},
+        {"duration", required_argument, NULL, 'd'},
+        {"jobs", required_argument, NULL, 'j'},
+        {"chunk", required_argument, NULL, 'c'},
+        {"format", required_argument, NULL, 'F'},
+        {"full", no_argument, NULL, 2},
+        {"fonts-dir", required_argument, NULL, 1},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "W:H:f:s:d:j:c:F:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'W': opts.width = atoi(optarg); break;
+            case 'H': opts.height = atoi(optarg); break;
+            case 'f': opts.fps = atof(optarg); break;
+            case 's': opts.start = atof(optarg); break;
+            case 'd': opts.duration = atof(optarg); break;
+            case 'j': opts.jobs = atoi(optarg); break;
+            case 'c': opts.chunk = atof(optarg); break;
+            case 'F':
+                if (!strcmp(optarg, "pam")) {
+                    opts.format = FORMAT_PAM;
+                } else if (!strcmp(optarg, "raw")) {
+                    opts.format = FORMAT_RAW;
+                } else if (!strcmp(optarg, "container")) {
+                    opts.format = FORMAT_CONTAINER;
+                } else {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 2: opts.full = 1; break;
+            case 1: opts.fonts_dir = optarg; break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (argc - optind != 2 || opts.width <= 0 || opts.height <= 0 || opts.fps <= 0 || opts.chunk <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (opts.jobs <= 0) opts.jobs = std::max(1, (int)std::thread::hardware_concurrency());
+    const char *file = argv[optind];
+
+    // libass and fontconfig get set up one instance after the other
+    std::vector<SubtitleOctopus*> octopuses;
+    for (int i = 0; i < opts.jobs; i++) {
+        SubtitleOctopus *octopus = new SubtitleOctopus();
+        octopus->setLogLevel(1);
+        octopus->initLibrary(opts.width, opts.height);
+        if (opts.fonts_dir) {
+            ass_set_fonts_dir(octopus->ass_library, opts.fonts_dir);
+            octopus->reloadFonts();
+        }
+        octopus->createTrack((char*)file);
+        octopuses.push_back(octopus);
+    }
+
+    ASS_Track *track = octopuses[0]->track;
+    long long first = -1, last = 0;
+    for (int i = 0; i < track->n_events; i++) {
+        ASS_Event *event = track->events + i;
+        if (first == -1 || event->Start < first) first = event->Start;
+        if (event->Start + event->Duration > last) last = event->Start + event->Duration;
+    }
+    long long from = opts.start >= 0 ? milliseconds(opts.start) : std::max(first, 0LL);
+    long long to = opts.duration > 0 ? from + milliseconds(opts.duration) : last;
+    long long step = frame_step(opts);
+    long long chunk = (milliseconds(opts.chunk) + step - 1) / step * step;
+    int chunks = to > from ? (int)((to - from + chunk - 1) / chunk) : 0;
+
+    ImageStore store(opts, argv[optind + 1]);
+    if (!store.open()) return 1;
+
+    double t0 = emscripten_get_now();
+    std::atomic<int> next_chunk(0);
+    std::atomic<bool> failed(false);
+    std::vector<std::vector<OverlayFrame> > frames(opts.jobs);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < opts.jobs; i++) {
+        threads.push_back(std::thread([&, i]() {
+            std::vector<unsigned char> pixels;
+            for (int n = next_chunk++; n < chunks && !failed; n = next_chunk++) {
+                long long start = from + n * chunk;
+                if (!render_chunk(*octopuses[i], from, start, std::min(start + chunk, to), opts, store, pixels, frames[i])) {
+                    failed = true;
+                }
+            }
+        }));
+    }
+    for (size_t i = 0; i < threads.size(); i++) threads[i].join();
+
+    std::vector<OverlayFrame> all;
+    for (int i = 0; i < opts.jobs; i++) {
+        all.insert(all.end(), frames[i].begin(), frames[i].end());
+        octopuses[i]->quitLibrary();
+        delete octopuses[i];
+    }
+    if (failed) return 1;
+
+    // join frames which were cut at chunk boundaries
+    std::sort(all.begin(), all.end(), frame_before);
+    std::vector<OverlayFrame> joined;
+    for (size_t i = 0; i < all.size(); i++) {
+        if (!joined.empty()) {
+            OverlayFrame& prev = joined.back();
+            if (prev.image == all[i].image && prev.end == all[i].start && prev.x == all[i].x && prev.y == all[i].y) {
+                prev.end = all[i].end;
+                continue;
+            }
+        }
+        joined.push_back(all[i]);
+    }
+    if (!store.finish(joined)) return 1;
+
+    fprintf(stderr, "octopus-render: %zu frames, %zu images (%llu bytes) in %.0f ms\n",
+            joined.size(), store.imageCount(), store.bytes(), emscripten_get_now() - t0);
+    return 0;
+}